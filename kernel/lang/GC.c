@@ -25,6 +25,7 @@
 
 #include <pf_q-percpu.h>
 #include <pf_q-global.h>
+#include <pf_q-memory.h>
 #include <pf_q-transmit.h>
 
 
@@ -36,6 +37,7 @@ void GC_reset(struct GC_data *gc)
 		GC_log_init(&gc->log[n]);
 	}
 	gc->pool.len = 0;
+	GC_xmit_queue_init(&gc->xmit);
 }
 
 
@@ -70,6 +72,7 @@ GC_alloc_buff(struct GC_data *gc, size_t size)
 
 	skb = alloc_skb(size, GFP_ATOMIC);
 	if (skb == NULL) {
+		sparse_inc(&global_drops, reason[pfq_skb_pool_drop_reason(pfq_rx_skb_pool())]);
 		pr_devel("[PFQ] GC: out of memory!\n");
 		ret = NULL;
 		return ret;
@@ -95,6 +98,7 @@ GC_copy_buff(struct GC_data *gc, struct sk_buff __GC * orig)
 
 	skb = skb_copy(PFQ_SKB(orig), GFP_ATOMIC);
 	if (skb == NULL) {
+		sparse_inc(&global_drops, reason[Q_DROP_NOMEM]);
 		pr_devel("[PFQ] GC: out of memory!\n");
 		ret = NULL;
 		return ret;
@@ -108,6 +112,9 @@ GC_copy_buff(struct GC_data *gc, struct sk_buff __GC * orig)
 
 	PFQ_CB(ret)->group_mask = PFQ_CB(orig)->group_mask;
 	PFQ_CB(ret)->direct     = PFQ_CB(orig)->direct;
+	PFQ_CB(ret)->vlan_tci   = PFQ_CB(orig)->vlan_tci;
+	PFQ_CB(ret)->l3_proto   = PFQ_CB(orig)->l3_proto;
+	PFQ_CB(ret)->l3_off     = PFQ_CB(orig)->l3_off;
 	PFQ_CB(ret)->monad      = PFQ_CB(orig)->monad;
 
 	return ret;
@@ -115,21 +122,64 @@ GC_copy_buff(struct GC_data *gc, struct sk_buff __GC * orig)
 
 
 
-void
-GC_get_lazy_endpoints(struct GC_data *gc, struct pfq_endpoint_info *ts)
+int
+GC_lazy_xmit(struct GC_data *gc, struct sk_buff __GC *skb, struct net_device *dev, int queue)
 {
-	size_t n, i;
+	struct GC_xmit_queue *xq = &gc->xmit;
+	struct GC_xmit_bucket *b;
+	struct GC_xmit_slot *s;
+	size_t n;
 
-	ts->num = 0;
-        ts->cnt_total = 0;
+	if (xq->len >= Q_GC_XMIT_QUEUE_LEN) {
+		pr_devel("[PFQ] GC: forward queue exhausted!\n");
+		return -ENOMEM;
+	}
 
-	for(n = 0; n < gc->pool.len; ++n)
-	{
-		for(i = 0; i < gc->log[n].num_devs; i++)
+	/* get the bucket of this device (likely the last one used) */
+
+	if (xq->num_devs && xq->bucket[xq->last].dev == dev) {
+		n = xq->last;
+	}
+	else {
+		for(n = 0; n < xq->num_devs; n++)
 		{
-			add_dev_to_endpoints(gc->log[n].dev[i], ts);
+			if (xq->bucket[n].dev == dev)
+				break;
+		}
+
+		if (n == xq->num_devs) {
+			if (n >= Q_GC_XMIT_DEVICES) {
+				pr_devel("[PFQ] GC: too many forward devices!\n");
+				return -ENOMEM;
+			}
+
+			xq->bucket[n].dev  = dev;
+			xq->bucket[n].len  = 0;
+			xq->bucket[n].head = -1;
+			xq->num_devs++;
 		}
+
+		xq->last = n;
 	}
+
+	/* append the skb to the bucket */
+
+	b = &xq->bucket[n];
+	s = &xq->slot[xq->len];
+
+	s->skb   = skb;
+	s->queue = queue;
+	s->next  = -1;
+
+	if (b->head == -1)
+		b->head = (int)xq->len;
+	else
+		xq->slot[b->tail].next = (int)xq->len;
+
+	b->tail = (int)xq->len;
+	b->len++;
+	xq->len++;
+	return 0;
 }
 
 
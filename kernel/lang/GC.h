@@ -29,7 +29,6 @@
 #include <linux/skbuff.h>
 #include <pragma/diagnostic_pop>
 
-#include <pf_q-endpoint.h>
 #include <pf_q-skbuff.h>
 #include <pf_q-define.h>
 #include <pf_q-skbuff.h>
@@ -40,13 +39,42 @@ typedef struct sk_buff __GC * SkBuff;
 
 struct GC_log
 {
-	struct net_device * dev[Q_GC_LOG_QUEUE_LEN];
-	size_t num_devs;
+	size_t num_devs;	/* forwards of this skb */
 	size_t to_kernel;
 	size_t xmit_todo;
 };
 
 
+/* lazy forwarding: the skbs forwarded during the batch are queued in a
+ * per-device bucket (a list of slots), so that each device is transmitted
+ * in a single pass, under one HARD_TX_LOCK per hw queue.
+ */
+
+struct GC_xmit_slot
+{
+	struct sk_buff __GC *skb;
+	int queue;
+	int next;
+};
+
+struct GC_xmit_bucket
+{
+	struct net_device *dev;
+	size_t len;
+	int head;
+	int tail;
+};
+
+struct GC_xmit_queue
+{
+	size_t len;
+	size_t num_devs;
+	size_t last;		/* last bucket used */
+	struct GC_xmit_bucket	bucket[Q_GC_XMIT_DEVICES];
+	struct GC_xmit_slot	slot[Q_GC_XMIT_QUEUE_LEN];
+};
+
+
 struct GC_skbuff_batch
 {
         size_t len;
@@ -64,6 +92,7 @@ struct GC_data
 {
 	struct GC_log		log[Q_GC_POOL_QUEUE_LEN];
 	struct GC_skbuff_queue	pool;
+	struct GC_xmit_queue	xmit;
 };
 
 
@@ -78,21 +107,15 @@ struct sk_buff __GC * pfq_lang_alloc_buff(size_t size);
 struct sk_buff __GC * pfq_lang_copy_buff(struct sk_buff __GC * skb);
 
 
-struct skb_lazy_targets;
-
-extern void  GC_get_lazy_endpoints(struct GC_data *gc, struct pfq_endpoint_info *info);
+extern int GC_lazy_xmit(struct GC_data *gc, struct sk_buff __GC *skb, struct net_device *dev, int queue);
 
 
-static inline size_t
-GC_count_dev_in_log(struct net_device *dev, struct GC_log *log)
+static inline
+void GC_xmit_queue_init(struct GC_xmit_queue *xq)
 {
-	size_t n, ret = 0;
-	for(n = 0; n < log->num_devs; n++)
-	{
-		if (dev == log->dev[n])
-			ret++;
-	}
-	return ret;
+	xq->len = 0;
+	xq->num_devs = 0;
+	xq->last = 0;
 }
 
 
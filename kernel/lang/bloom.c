@@ -36,7 +36,7 @@
 static bool
 bloom_src(arguments_t args, SkBuff skb)
 {
-	if (eth_hdr(PFQ_SKB(skb))->h_proto == __constant_htons(ETH_P_IP))
+	if (PFQ_CB(skb)->l3_proto == __constant_htons(ETH_P_IP))
 	{
 		struct iphdr _iph;
 		const struct iphdr *ip;
@@ -44,7 +44,7 @@ bloom_src(arguments_t args, SkBuff skb)
 		__be32 mask;
 		char *mem;
 
-		ip = skb_header_pointer(PFQ_SKB(skb), skb->mac_len, sizeof(_iph), &_iph);
+		ip = skb_header_pointer(PFQ_SKB(skb), PFQ_CB(skb)->l3_off, sizeof(_iph), &_iph);
 		if (ip == NULL)
 			return false;
 
@@ -68,7 +68,7 @@ bloom_src(arguments_t args, SkBuff skb)
 static bool
 bloom_dst(arguments_t args, SkBuff skb)
 {
-	if (eth_hdr(PFQ_SKB(skb))->h_proto == __constant_htons(ETH_P_IP))
+	if (PFQ_CB(skb)->l3_proto == __constant_htons(ETH_P_IP))
 	{
 		struct iphdr _iph;
 		const struct iphdr *ip;
@@ -76,7 +76,7 @@ bloom_dst(arguments_t args, SkBuff skb)
 		__be32 mask;
 		char *mem;
 
-		ip = skb_header_pointer(PFQ_SKB(skb), skb->mac_len, sizeof(_iph), &_iph);
+		ip = skb_header_pointer(PFQ_SKB(skb), PFQ_CB(skb)->l3_off, sizeof(_iph), &_iph);
 		if (ip == NULL)
 			return false;
 
@@ -99,7 +99,7 @@ bloom_dst(arguments_t args, SkBuff skb)
 static bool
 bloom(arguments_t args, SkBuff skb)
 {
-	if (eth_hdr(PFQ_SKB(skb))->h_proto == __constant_htons(ETH_P_IP))
+	if (PFQ_CB(skb)->l3_proto == __constant_htons(ETH_P_IP))
 	{
 		struct iphdr _iph;
 		const struct iphdr *ip;
@@ -107,7 +107,7 @@ bloom(arguments_t args, SkBuff skb)
 		__be32 mask;
 		char *mem;
 
-		ip = skb_header_pointer(PFQ_SKB(skb), skb->mac_len, sizeof(_iph), &_iph);
+		ip = skb_header_pointer(PFQ_SKB(skb), PFQ_CB(skb)->l3_off, sizeof(_iph), &_iph);
 		if (ip == NULL)
 			return false;
 
@@ -26,6 +26,7 @@
 #include <linux/kernel.h>
 #include <linux/module.h>
 #include <linux/cache.h>
+#include <linux/netdevice.h>
 
 #include <pragma/diagnostic_pop>
 
@@ -36,6 +37,7 @@
 #include <pf_q-skbuff.h>
 #include <pf_q-transmit.h>
 #include <pf_q-global.h>
+#include <pf_q-group.h>
 
 
 static int
@@ -107,6 +109,29 @@ link_fini(arguments_t args)
 }
 
 
+/* the Tx queue of the egress device, according to the policy of the forwarder */
+
+static inline int
+forward_tx_queue(SkBuff skb, struct net_device *dev, int policy)
+{
+	uint32_t hash;
+
+	switch(policy)
+	{
+	case Q_FWD_QUEUE_INGRESS:
+		return skb_rx_queue_recorded(PFQ_SKB(skb)) ? skb_get_rx_queue(PFQ_SKB(skb)) : -1;
+
+	case Q_FWD_QUEUE_HASH:
+		hash = PFQ_CB(skb)->monad->fanout.hash;
+		if (hash == 0 || dev->real_num_tx_queues == 1)
+			return -1;
+		return (int)(hash % dev->real_num_tx_queues);
+	}
+
+	return policy < 0 ? -1 : policy;
+}
+
+
 static ActionSkBuff
 forwardIO(arguments_t args, SkBuff skb)
 {
@@ -209,6 +234,207 @@ link(arguments_t args, SkBuff skb)
 }
 
 
+static ActionSkBuff
+forward_queue(arguments_t args, SkBuff skb)
+{
+	struct net_device *dev = GET_ARG(struct net_device *, args);
+	const int policy = GET_ARG_1(int, args);
+
+	if (dev == NULL) {
+                if (printk_ratelimit())
+                        printk(KERN_INFO "[PFQ/lang] forward_queue: device error!\n");
+                return Pass(skb);
+	}
+
+	pfq_lazy_xmit(skb, dev, forward_tx_queue(skb, dev, policy));
+
+	local_inc(&get_group_stats(skb)->frwd);
+
+	return Pass(skb);
+}
+
+
+static ActionSkBuff
+bridge_queue(arguments_t args, SkBuff skb)
+{
+	struct net_device *dev = GET_ARG(struct net_device *, args);
+	const int policy = GET_ARG_1(int, args);
+
+	if (dev == NULL) {
+                if (printk_ratelimit())
+                        printk(KERN_INFO "[PFQ/lang] bridge_queue: device error!\n");
+                return Drop(skb);
+	}
+
+	pfq_lazy_xmit(skb, dev, forward_tx_queue(skb, dev, policy));
+
+	local_inc(&get_group_stats(skb)->frwd);
+
+	return Drop(skb);
+}
+
+
+static ActionSkBuff
+link_queue(arguments_t args, SkBuff skb)
+{
+        struct net_device **dev = GET_ARRAY(struct net_device *,args);
+	const int policy = GET_ARG_1(int, args);
+	size_t n, ndev = LEN_ARRAY(args);
+        struct pfq_group_stats *stats = get_group_stats(skb);
+
+	for(n = 0; n < ndev; n++)
+	{
+		if (dev[n] != NULL && skb->dev != dev[n])
+		{
+			pfq_lazy_xmit(skb, dev[n], forward_tx_queue(skb, dev[n], policy));
+			local_inc(&stats->frwd);
+		}
+	}
+
+	return Pass(skb);
+}
+
+
+static ActionSkBuff
+tee_queue(arguments_t args, SkBuff skb)
+{
+	struct net_device *dev = GET_ARG(struct net_device *, args);
+	const int policy = GET_ARG_1(int, args);
+	predicate_t pred_  = GET_ARG_2(predicate_t, args);
+
+	if (dev == NULL) {
+                if (printk_ratelimit())
+                        printk(KERN_INFO "[PFQ/lang] tee_queue: device error!\n");
+                return Drop(skb);
+	}
+
+	pfq_lazy_xmit(skb, dev, forward_tx_queue(skb, dev, policy));
+
+	local_inc(&get_group_stats(skb)->frwd);
+
+        if (EVAL_PREDICATE(pred_, skb))
+		return Pass(skb);
+
+	return Drop(skb);
+}
+
+
+/* link groups: the device with carrier for the flow of the packet, weighted
+ * devices first, then the backups (weight 0). NULL if none has carrier. */
+
+static inline bool
+link_is_up(struct net_device *dev)
+{
+	return netif_running(dev) && netif_carrier_ok(dev);
+}
+
+
+static struct net_device *
+link_group_select(struct pfq_link_group const *lg, uint32_t hash)
+{
+	unsigned int total = 0, backups = 0, pick;
+	int n;
+
+	for(n = 0; n < lg->num; n++)
+	{
+		if (!link_is_up(lg->dev[n]))
+			continue;
+		if (lg->weight[n])
+			total += lg->weight[n];
+		else
+			backups++;
+	}
+
+	if (total) {
+		pick = (unsigned int)(((uint64_t)hash * total) >> 32);
+		for(n = 0; n < lg->num; n++)
+		{
+			if (!lg->weight[n] || !link_is_up(lg->dev[n]))
+				continue;
+			if (pick < lg->weight[n])
+				return lg->dev[n];
+			pick -= lg->weight[n];
+		}
+	}
+	else if (backups) {
+		pick = (unsigned int)(((uint64_t)hash * backups) >> 32);
+		for(n = 0; n < lg->num; n++)
+		{
+			if (lg->weight[n] || !link_is_up(lg->dev[n]))
+				continue;
+			if (pick-- == 0)
+				return lg->dev[n];
+		}
+	}
+
+	return NULL;
+}
+
+
+static bool
+link_group_xmit(SkBuff skb, int id)
+{
+	struct pfq_group *group = PFQ_CB(skb)->monad->group;
+	struct pfq_link_group *lg;
+	struct net_device *dev;
+	uint32_t hash;
+
+	if (unlikely(id < 0 || id >= Q_MAX_LINK_GROUPS))
+		return false;
+
+	lg = (struct pfq_link_group *)atomic_long_read(&group->links[id]);
+	if (lg == NULL)
+		return false;
+
+	/* the flow: the hash of the steering function, or the flow hash */
+
+	hash = PFQ_CB(skb)->monad->fanout.hash;
+	if (hash == 0)
+#if(LINUX_VERSION_CODE >= KERNEL_VERSION(3,14,0))
+		hash = skb_get_hash(PFQ_SKB(skb));
+#else
+		hash = skb_get_rxhash(PFQ_SKB(skb));
+#endif
+
+	dev = link_group_select(lg, hash);
+	if (dev == NULL || dev == skb->dev)
+		return false;
+
+	pfq_lazy_xmit(skb, dev, dev->real_num_tx_queues > 1 ? (int)(hash % dev->real_num_tx_queues) : -1);
+	return true;
+}
+
+
+static ActionSkBuff
+link_group(arguments_t args, SkBuff skb)
+{
+	const int id = GET_ARG(int, args);
+        struct pfq_group_stats *stats = get_group_stats(skb);
+
+	if (link_group_xmit(skb, id))
+		local_inc(&stats->frwd);
+	else
+		local_inc(&stats->disc);
+
+	return Pass(skb);
+}
+
+
+static ActionSkBuff
+bridge_link_group(arguments_t args, SkBuff skb)
+{
+	const int id = GET_ARG(int, args);
+        struct pfq_group_stats *stats = get_group_stats(skb);
+
+	if (link_group_xmit(skb, id))
+		local_inc(&stats->frwd);
+	else
+		local_inc(&stats->disc);
+
+	return Drop(skb);
+}
+
+
 static ActionSkBuff
 tap(arguments_t args, SkBuff skb)
 {
@@ -271,5 +497,13 @@ struct pfq_lang_function_descr forward_functions[] = {
 	{ "tee",	"String -> (SkBuff -> Bool) -> SkBuff -> Action SkBuff", tee,	    forward_init, forward_fini },
 	{ "tap",	"String -> (SkBuff -> Bool) -> SkBuff -> Action SkBuff", tap,	    forward_init, forward_fini },
 
+	{ "forward_queue", "String -> CInt -> SkBuff -> Action SkBuff",			forward_queue, forward_init, forward_fini },
+	{ "link_queue",    "[String] -> CInt -> SkBuff -> Action SkBuff",		link_queue,    link_init,    link_fini    },
+	{ "bridge_queue",  "String -> CInt -> SkBuff -> Action SkBuff",			bridge_queue,  forward_init, forward_fini },
+	{ "tee_queue",     "String -> CInt -> (SkBuff -> Bool) -> SkBuff -> Action SkBuff", tee_queue, forward_init, forward_fini },
+
+	{ "link_group",        "CInt -> SkBuff -> Action SkBuff",	link_group		},
+	{ "bridge_link_group", "CInt -> SkBuff -> Action SkBuff",	bridge_link_group	},
+
         { NULL }};
 
@@ -131,12 +131,12 @@ log_packet(arguments_t args, SkBuff skb)
 	if (!printk_ratelimit())
 		return Pass(skb);
 
-	if (eth_hdr(PFQ_SKB(skb))->h_proto == __constant_htons(ETH_P_IP))
+	if (PFQ_CB(skb)->l3_proto == __constant_htons(ETH_P_IP))
 	{
 		struct iphdr _iph;
 		const struct iphdr *ip;
 
-		ip = skb_header_pointer(PFQ_SKB(skb), skb->mac_len, sizeof(_iph), &_iph);
+		ip = skb_header_pointer(PFQ_SKB(skb), PFQ_CB(skb)->l3_off, sizeof(_iph), &_iph);
 		if (ip == NULL)
 			return Pass(skb);
 
@@ -144,7 +144,7 @@ log_packet(arguments_t args, SkBuff skb)
 		{
 		case IPPROTO_UDP: {
 			struct udphdr _udph; const struct udphdr *udp;
-			udp = skb_header_pointer(PFQ_SKB(skb), skb->mac_len + (ip->ihl<<2), sizeof(struct udphdr), &_udph);
+			udp = skb_header_pointer(PFQ_SKB(skb), PFQ_CB(skb)->l3_off + (ip->ihl<<2), sizeof(struct udphdr), &_udph);
 			if (udp == NULL)
 				return Pass(skb);
 
@@ -155,7 +155,7 @@ log_packet(arguments_t args, SkBuff skb)
 		}
 		case IPPROTO_TCP: {
 			struct tcphdr _tcph; const struct tcphdr *tcp;
-			tcp = skb_header_pointer(PFQ_SKB(skb), skb->mac_len + (ip->ihl<<2), sizeof(struct tcphdr), &_tcph);
+			tcp = skb_header_pointer(PFQ_SKB(skb), PFQ_CB(skb)->l3_off + (ip->ihl<<2), sizeof(struct tcphdr), &_tcph);
 			if (tcp == NULL)
 				return Pass(skb);
 
@@ -178,7 +178,7 @@ log_packet(arguments_t args, SkBuff skb)
 		}
 
 	} else
-		printk(KERN_INFO "[PFQ/lang] ETH proto %x\n", ntohs(eth_hdr(PFQ_SKB(skb))->h_proto));
+		printk(KERN_INFO "[PFQ/lang] ETH proto %x\n", ntohs(PFQ_CB(skb)->l3_proto));
 
         return Pass(skb);
 }
@@ -168,8 +168,8 @@ skb_header_available(struct sk_buff *skb, int offset, int len)
 static inline bool
 is_ip(SkBuff skb)
 {
-	if (eth_hdr(PFQ_SKB(skb))->h_proto == __constant_htons(ETH_P_IP))
-	        return skb_header_available(PFQ_SKB(skb), skb->mac_len, sizeof(struct iphdr));
+	if (PFQ_CB(skb)->l3_proto == __constant_htons(ETH_P_IP))
+	        return skb_header_available(PFQ_SKB(skb), PFQ_CB(skb)->l3_off, sizeof(struct iphdr));
 
         return false;
 }
@@ -177,8 +177,8 @@ is_ip(SkBuff skb)
 static inline bool
 is_ip6(SkBuff skb)
 {
-	if (eth_hdr(PFQ_SKB(skb))->h_proto == __constant_htons(ETH_P_IPV6))
-                return skb_header_available(PFQ_SKB(skb), skb->mac_len, sizeof(struct ipv6hdr));
+	if (PFQ_CB(skb)->l3_proto == __constant_htons(ETH_P_IPV6))
+                return skb_header_available(PFQ_SKB(skb), PFQ_CB(skb)->l3_off, sizeof(struct ipv6hdr));
 
         return false;
 }
@@ -186,19 +186,19 @@ is_ip6(SkBuff skb)
 static inline bool
 is_udp(SkBuff skb)
 {
-	if (eth_hdr(PFQ_SKB(skb))->h_proto == __constant_htons(ETH_P_IP))
+	if (PFQ_CB(skb)->l3_proto == __constant_htons(ETH_P_IP))
 	{
 		struct iphdr _iph;
 		const struct iphdr *ip;
 
-		ip = skb_header_pointer(PFQ_SKB(skb), skb->mac_len, sizeof(_iph), &_iph);
+		ip = skb_header_pointer(PFQ_SKB(skb), PFQ_CB(skb)->l3_off, sizeof(_iph), &_iph);
 		if (ip == NULL)
                         return false;
 
 		if (ip->protocol != IPPROTO_UDP)
                         return false;
 
-                return skb_header_available(PFQ_SKB(skb), skb->mac_len  + (ip->ihl<<2), sizeof(struct udphdr));
+                return skb_header_available(PFQ_SKB(skb), PFQ_CB(skb)->l3_off  + (ip->ihl<<2), sizeof(struct udphdr));
 	}
 
         return false;
@@ -208,19 +208,19 @@ is_udp(SkBuff skb)
 static inline bool
 is_udp6(SkBuff skb)
 {
-	if (eth_hdr(PFQ_SKB(skb))->h_proto == __constant_htons(ETH_P_IPV6))
+	if (PFQ_CB(skb)->l3_proto == __constant_htons(ETH_P_IPV6))
 	{
 		struct ipv6hdr _iph6;
 		const struct ipv6hdr *ip6;
 
-		ip6 = skb_header_pointer(PFQ_SKB(skb), skb->mac_len, sizeof(_iph6), &_iph6);
+		ip6 = skb_header_pointer(PFQ_SKB(skb), PFQ_CB(skb)->l3_off, sizeof(_iph6), &_iph6);
 		if (ip6 == NULL)
                         return false;
 
 		if (ip6->nexthdr != IPPROTO_UDP)
                         return false;
 
-                return skb_header_available(PFQ_SKB(skb), skb->mac_len  + sizeof(struct ipv6hdr), sizeof(struct udphdr));
+                return skb_header_available(PFQ_SKB(skb), PFQ_CB(skb)->l3_off  + sizeof(struct ipv6hdr), sizeof(struct udphdr));
 	}
 
         return false;
@@ -229,19 +229,19 @@ is_udp6(SkBuff skb)
 static inline bool
 is_tcp(SkBuff skb)
 {
-	if (eth_hdr(PFQ_SKB(skb))->h_proto == __constant_htons(ETH_P_IP))
+	if (PFQ_CB(skb)->l3_proto == __constant_htons(ETH_P_IP))
 	{
 		struct iphdr _iph;
 		const struct iphdr *ip;
 
-		ip = skb_header_pointer(PFQ_SKB(skb), skb->mac_len, sizeof(_iph), &_iph);
+		ip = skb_header_pointer(PFQ_SKB(skb), PFQ_CB(skb)->l3_off, sizeof(_iph), &_iph);
 		if (ip == NULL)
                         return false;
 
 		if (ip->protocol != IPPROTO_TCP)
                         return false;
 
-		return skb_header_available(PFQ_SKB(skb), skb->mac_len + (ip->ihl<<2), sizeof(struct tcphdr));
+		return skb_header_available(PFQ_SKB(skb), PFQ_CB(skb)->l3_off + (ip->ihl<<2), sizeof(struct tcphdr));
 	}
 
         return false;
@@ -251,19 +251,19 @@ is_tcp(SkBuff skb)
 static inline bool
 is_tcp6(SkBuff skb)
 {
-	if (eth_hdr(PFQ_SKB(skb))->h_proto == __constant_htons(ETH_P_IPV6))
+	if (PFQ_CB(skb)->l3_proto == __constant_htons(ETH_P_IPV6))
 	{
 		struct ipv6hdr _iph6;
 		const struct ipv6hdr *ip6;
 
-		ip6 = skb_header_pointer(PFQ_SKB(skb), skb->mac_len, sizeof(_iph6), &_iph6);
+		ip6 = skb_header_pointer(PFQ_SKB(skb), PFQ_CB(skb)->l3_off, sizeof(_iph6), &_iph6);
 		if (ip6 == NULL)
                         return false;
 
 		if (ip6->nexthdr != IPPROTO_TCP)
                         return false;
 
-                return skb_header_available(PFQ_SKB(skb), skb->mac_len  + sizeof(struct ipv6hdr), sizeof(struct tcphdr));
+                return skb_header_available(PFQ_SKB(skb), PFQ_CB(skb)->l3_off  + sizeof(struct ipv6hdr), sizeof(struct tcphdr));
 	}
 
         return false;
@@ -272,19 +272,19 @@ is_tcp6(SkBuff skb)
 static inline bool
 is_icmp(SkBuff skb)
 {
-	if (eth_hdr(PFQ_SKB(skb))->h_proto == __constant_htons(ETH_P_IP))
+	if (PFQ_CB(skb)->l3_proto == __constant_htons(ETH_P_IP))
 	{
 		struct iphdr _iph;
 		const struct iphdr *ip;
 
-		ip = skb_header_pointer(PFQ_SKB(skb), skb->mac_len, sizeof(_iph), &_iph);
+		ip = skb_header_pointer(PFQ_SKB(skb), PFQ_CB(skb)->l3_off, sizeof(_iph), &_iph);
 		if (ip == NULL)
                         return false;
 
 		if (ip->protocol != IPPROTO_ICMP)
                         return false;
 
-		return skb_header_available(PFQ_SKB(skb), skb->mac_len + (ip->ihl<<2), sizeof(struct icmphdr));
+		return skb_header_available(PFQ_SKB(skb), PFQ_CB(skb)->l3_off + (ip->ihl<<2), sizeof(struct icmphdr));
 	}
 
         return false;
@@ -294,12 +294,12 @@ is_icmp(SkBuff skb)
 static inline bool
 is_icmp6(SkBuff skb)
 {
-	if (eth_hdr(PFQ_SKB(skb))->h_proto == __constant_htons(ETH_P_IPV6))
+	if (PFQ_CB(skb)->l3_proto == __constant_htons(ETH_P_IPV6))
 	{
 		struct ipv6hdr _iph6;
 		const struct ipv6hdr *ip6;
 
-		ip6 = skb_header_pointer(PFQ_SKB(skb), skb->mac_len, sizeof(_iph6), &_iph6);
+		ip6 = skb_header_pointer(PFQ_SKB(skb), PFQ_CB(skb)->l3_off, sizeof(_iph6), &_iph6);
 		if (ip6 == NULL)
                         return false;
 
@@ -308,7 +308,7 @@ is_icmp6(SkBuff skb)
 
 		// ... the icmpv6 header is 32 bits long.
 
-                return skb_header_available(PFQ_SKB(skb), skb->mac_len  + sizeof(struct ipv6hdr), 32 >> 3);
+                return skb_header_available(PFQ_SKB(skb), PFQ_CB(skb)->l3_off  + sizeof(struct ipv6hdr), 32 >> 3);
 	}
 
         return false;
@@ -318,12 +318,12 @@ is_icmp6(SkBuff skb)
 static inline bool
 has_addr(SkBuff skb, __be32 addr, __be32 mask)
 {
-	if (eth_hdr(PFQ_SKB(skb))->h_proto == __constant_htons(ETH_P_IP))
+	if (PFQ_CB(skb)->l3_proto == __constant_htons(ETH_P_IP))
 	{
 		struct iphdr _iph;
 		const struct iphdr *ip;
 
-		ip = skb_header_pointer(PFQ_SKB(skb), skb->mac_len, sizeof(_iph), &_iph);
+		ip = skb_header_pointer(PFQ_SKB(skb), PFQ_CB(skb)->l3_off, sizeof(_iph), &_iph);
 		if (ip == NULL)
 			return false;
 
@@ -339,12 +339,12 @@ has_addr(SkBuff skb, __be32 addr, __be32 mask)
 static inline bool
 has_src_addr(SkBuff skb, __be32 addr, __be32 mask)
 {
-	if (eth_hdr(PFQ_SKB(skb))->h_proto == __constant_htons(ETH_P_IP))
+	if (PFQ_CB(skb)->l3_proto == __constant_htons(ETH_P_IP))
 	{
 		struct iphdr _iph;
 		const struct iphdr *ip;
 
-		ip = skb_header_pointer(PFQ_SKB(skb), skb->mac_len, sizeof(_iph), &_iph);
+		ip = skb_header_pointer(PFQ_SKB(skb), PFQ_CB(skb)->l3_off, sizeof(_iph), &_iph);
 		if (ip == NULL)
 			return false;
 
@@ -358,12 +358,12 @@ has_src_addr(SkBuff skb, __be32 addr, __be32 mask)
 static inline bool
 has_dst_addr(SkBuff skb, __be32 addr, __be32 mask)
 {
-	if (eth_hdr(PFQ_SKB(skb))->h_proto == __constant_htons(ETH_P_IP))
+	if (PFQ_CB(skb)->l3_proto == __constant_htons(ETH_P_IP))
 	{
 		struct iphdr _iph;
 		const struct iphdr *ip;
 
-		ip = skb_header_pointer(PFQ_SKB(skb), skb->mac_len, sizeof(_iph), &_iph);
+		ip = skb_header_pointer(PFQ_SKB(skb), PFQ_CB(skb)->l3_off, sizeof(_iph), &_iph);
 		if (ip == NULL)
 			return false;
 
@@ -378,12 +378,12 @@ has_dst_addr(SkBuff skb, __be32 addr, __be32 mask)
 static inline bool
 is_flow(SkBuff skb)
 {
-	if (eth_hdr(PFQ_SKB(skb))->h_proto == __constant_htons(ETH_P_IP))
+	if (PFQ_CB(skb)->l3_proto == __constant_htons(ETH_P_IP))
 	{
 		struct iphdr _iph;
 		const struct iphdr *ip;
 
-		ip = skb_header_pointer(PFQ_SKB(skb), skb->mac_len, sizeof(_iph), &_iph);
+		ip = skb_header_pointer(PFQ_SKB(skb), PFQ_CB(skb)->l3_off, sizeof(_iph), &_iph);
 		if (ip == NULL)
 			return false;
 
@@ -391,7 +391,7 @@ is_flow(SkBuff skb)
 		    ip->protocol != IPPROTO_TCP)
                         return false;
 
-		return skb_header_available(PFQ_SKB(skb), skb->mac_len + (ip->ihl<<2), ip->protocol == IPPROTO_UDP ?
+		return skb_header_available(PFQ_SKB(skb), PFQ_CB(skb)->l3_off + (ip->ihl<<2), ip->protocol == IPPROTO_UDP ?
 					    sizeof(struct udphdr) : sizeof(struct tcphdr));
 	}
 
@@ -402,19 +402,19 @@ is_flow(SkBuff skb)
 static inline bool
 is_l3_proto(SkBuff skb, u16 type)
 {
-	return eth_hdr(PFQ_SKB(skb))->h_proto == __constant_htons(type);
+	return PFQ_CB(skb)->l3_proto == __constant_htons(type);
 }
 
 
 static inline bool
 is_l4_proto(SkBuff skb, u8 protocol)
 {
-	if (eth_hdr(PFQ_SKB(skb))->h_proto == __constant_htons(ETH_P_IP))
+	if (PFQ_CB(skb)->l3_proto == __constant_htons(ETH_P_IP))
 	{
 		struct iphdr _iph;
 		const struct iphdr *ip;
 
-		ip = skb_header_pointer(PFQ_SKB(skb), skb->mac_len, sizeof(_iph), &_iph);
+		ip = skb_header_pointer(PFQ_SKB(skb), PFQ_CB(skb)->l3_off, sizeof(_iph), &_iph);
 		if (ip == NULL)
 			return false;
 
@@ -428,12 +428,12 @@ is_l4_proto(SkBuff skb, u8 protocol)
 static inline bool
 is_frag(SkBuff skb)
 {
-	if (eth_hdr(PFQ_SKB(skb))->h_proto == __constant_htons(ETH_P_IP))
+	if (PFQ_CB(skb)->l3_proto == __constant_htons(ETH_P_IP))
 	{
 		struct iphdr _iph;
 		const struct iphdr *ip;
 
-		ip = skb_header_pointer(PFQ_SKB(skb), skb->mac_len, sizeof(_iph), &_iph);
+		ip = skb_header_pointer(PFQ_SKB(skb), PFQ_CB(skb)->l3_off, sizeof(_iph), &_iph);
 		if (ip == NULL)
 			return false;
 
@@ -446,12 +446,12 @@ is_frag(SkBuff skb)
 static inline bool
 is_first_frag(SkBuff skb)
 {
-	if (eth_hdr(PFQ_SKB(skb))->h_proto == __constant_htons(ETH_P_IP))
+	if (PFQ_CB(skb)->l3_proto == __constant_htons(ETH_P_IP))
 	{
 		struct iphdr _iph;
 		const struct iphdr *ip;
 
-		ip = skb_header_pointer(PFQ_SKB(skb), skb->mac_len, sizeof(_iph), &_iph);
+		ip = skb_header_pointer(PFQ_SKB(skb), PFQ_CB(skb)->l3_off, sizeof(_iph), &_iph);
 		if (ip == NULL)
 			return false;
 
@@ -464,12 +464,12 @@ is_first_frag(SkBuff skb)
 static inline bool
 is_more_frag(SkBuff skb)
 {
-	if (eth_hdr(PFQ_SKB(skb))->h_proto == __constant_htons(ETH_P_IP))
+	if (PFQ_CB(skb)->l3_proto == __constant_htons(ETH_P_IP))
 	{
 		struct iphdr _iph;
 		const struct iphdr *ip;
 
-		ip = skb_header_pointer(PFQ_SKB(skb), skb->mac_len, sizeof(_iph), &_iph);
+		ip = skb_header_pointer(PFQ_SKB(skb), PFQ_CB(skb)->l3_off, sizeof(_iph), &_iph);
 		if (ip == NULL)
 			return false;
 
@@ -482,12 +482,12 @@ is_more_frag(SkBuff skb)
 static inline bool
 has_src_port(SkBuff skb, uint16_t port)
 {
-	if (eth_hdr(PFQ_SKB(skb))->h_proto == __constant_htons(ETH_P_IP))
+	if (PFQ_CB(skb)->l3_proto == __constant_htons(ETH_P_IP))
 	{
 		struct iphdr _iph;
 		const struct iphdr *ip;
 
-		ip = skb_header_pointer(PFQ_SKB(skb), skb->mac_len, sizeof(_iph), &_iph);
+		ip = skb_header_pointer(PFQ_SKB(skb), PFQ_CB(skb)->l3_off, sizeof(_iph), &_iph);
 		if (ip == NULL)
 			return false;
 
@@ -495,7 +495,7 @@ has_src_port(SkBuff skb, uint16_t port)
 		{
 		case IPPROTO_UDP: {
 			struct udphdr _udph; const struct udphdr *udp;
-			udp = skb_header_pointer(PFQ_SKB(skb), skb->mac_len + (ip->ihl<<2), sizeof(struct udphdr), &_udph);
+			udp = skb_header_pointer(PFQ_SKB(skb), PFQ_CB(skb)->l3_off + (ip->ihl<<2), sizeof(struct udphdr), &_udph);
 			if (udp == NULL)
 				return false;
 
@@ -503,7 +503,7 @@ has_src_port(SkBuff skb, uint16_t port)
 		}
 		case IPPROTO_TCP: {
 			struct tcphdr _tcph; const struct tcphdr *tcp;
-			tcp = skb_header_pointer(PFQ_SKB(skb), skb->mac_len + (ip->ihl<<2), sizeof(struct tcphdr), &_tcph);
+			tcp = skb_header_pointer(PFQ_SKB(skb), PFQ_CB(skb)->l3_off + (ip->ihl<<2), sizeof(struct tcphdr), &_tcph);
 			if (tcp == NULL)
 				return false;
 
@@ -521,12 +521,12 @@ has_src_port(SkBuff skb, uint16_t port)
 static inline bool
 has_dst_port(SkBuff skb, uint16_t port)
 {
-	if (eth_hdr(PFQ_SKB(skb))->h_proto == __constant_htons(ETH_P_IP))
+	if (PFQ_CB(skb)->l3_proto == __constant_htons(ETH_P_IP))
 	{
 		struct iphdr _iph;
 		const struct iphdr *ip;
 
-		ip = skb_header_pointer(PFQ_SKB(skb), skb->mac_len, sizeof(_iph), &_iph);
+		ip = skb_header_pointer(PFQ_SKB(skb), PFQ_CB(skb)->l3_off, sizeof(_iph), &_iph);
 		if (ip == NULL)
 			return false;
 
@@ -534,7 +534,7 @@ has_dst_port(SkBuff skb, uint16_t port)
 		{
 		case IPPROTO_UDP: {
 			struct udphdr _udph; const struct udphdr *udp;
-			udp = skb_header_pointer(PFQ_SKB(skb), skb->mac_len + (ip->ihl<<2), sizeof(struct udphdr), &_udph);
+			udp = skb_header_pointer(PFQ_SKB(skb), PFQ_CB(skb)->l3_off + (ip->ihl<<2), sizeof(struct udphdr), &_udph);
 			if (udp == NULL)
 				return false;
 
@@ -542,7 +542,7 @@ has_dst_port(SkBuff skb, uint16_t port)
 		}
 		case IPPROTO_TCP: {
 			struct tcphdr _tcph; const struct tcphdr *tcp;
-			tcp = skb_header_pointer(PFQ_SKB(skb), skb->mac_len + (ip->ihl<<2), sizeof(struct tcphdr), &_tcph);
+			tcp = skb_header_pointer(PFQ_SKB(skb), PFQ_CB(skb)->l3_off + (ip->ihl<<2), sizeof(struct tcphdr), &_tcph);
 			if (tcp == NULL)
 				return false;
 
@@ -568,13 +568,13 @@ has_port(SkBuff skb, uint16_t port)
 static inline bool
 has_vlan(SkBuff skb)
 {
-	return (skb->vlan_tci & VLAN_VID_MASK);
+	return (PFQ_CB(skb)->vlan_tci & VLAN_VID_MASK);
 }
 
 static inline bool
 has_vid(SkBuff skb, int vid)
 {
-	return (skb->vlan_tci & VLAN_VID_MASK) == vid;
+	return (PFQ_CB(skb)->vlan_tci & VLAN_VID_MASK) == vid;
 }
 
 
@@ -38,12 +38,12 @@
 static uint64_t
 ip_tos(arguments_t args, SkBuff skb)
 {
-	if (eth_hdr(PFQ_SKB(skb))->h_proto == __constant_htons(ETH_P_IP))
+	if (PFQ_CB(skb)->l3_proto == __constant_htons(ETH_P_IP))
 	{
 		struct iphdr _iph;
 		const struct iphdr *ip;
 
-		ip = skb_header_pointer(PFQ_SKB(skb), skb->mac_len, sizeof(_iph), &_iph);
+		ip = skb_header_pointer(PFQ_SKB(skb), PFQ_CB(skb)->l3_off, sizeof(_iph), &_iph);
 		if (ip == NULL)
 			return NOTHING;
 
@@ -57,12 +57,12 @@ ip_tos(arguments_t args, SkBuff skb)
 static uint64_t
 ip_tot_len(arguments_t args, SkBuff skb)
 {
-	if (eth_hdr(PFQ_SKB(skb))->h_proto == __constant_htons(ETH_P_IP))
+	if (PFQ_CB(skb)->l3_proto == __constant_htons(ETH_P_IP))
 	{
 		struct iphdr _iph;
 		const struct iphdr *ip;
 
-		ip = skb_header_pointer(PFQ_SKB(skb), skb->mac_len, sizeof(_iph), &_iph);
+		ip = skb_header_pointer(PFQ_SKB(skb), PFQ_CB(skb)->l3_off, sizeof(_iph), &_iph);
 		if (ip == NULL)
 			return NOTHING;
 
@@ -76,12 +76,12 @@ ip_tot_len(arguments_t args, SkBuff skb)
 static uint64_t
 ip_id(arguments_t args, SkBuff skb)
 {
-	if (eth_hdr(PFQ_SKB(skb))->h_proto == __constant_htons(ETH_P_IP))
+	if (PFQ_CB(skb)->l3_proto == __constant_htons(ETH_P_IP))
 	{
 		struct iphdr _iph;
 		const struct iphdr *ip;
 
-		ip = skb_header_pointer(PFQ_SKB(skb), skb->mac_len, sizeof(_iph), &_iph);
+		ip = skb_header_pointer(PFQ_SKB(skb), PFQ_CB(skb)->l3_off, sizeof(_iph), &_iph);
 		if (ip == NULL)
 			return NOTHING;
 
@@ -95,12 +95,12 @@ ip_id(arguments_t args, SkBuff skb)
 static uint64_t
 ip_ttl(arguments_t args, SkBuff skb)
 {
-	if (eth_hdr(PFQ_SKB(skb))->h_proto == __constant_htons(ETH_P_IP))
+	if (PFQ_CB(skb)->l3_proto == __constant_htons(ETH_P_IP))
 	{
 		struct iphdr _iph;
 		const struct iphdr *ip;
 
-		ip = skb_header_pointer(PFQ_SKB(skb), skb->mac_len, sizeof(_iph), &_iph);
+		ip = skb_header_pointer(PFQ_SKB(skb), PFQ_CB(skb)->l3_off, sizeof(_iph), &_iph);
 		if (ip == NULL)
 			return NOTHING;
 
@@ -113,12 +113,12 @@ ip_ttl(arguments_t args, SkBuff skb)
 static uint64_t
 ip_frag(arguments_t args, SkBuff skb)
 {
-	if (eth_hdr(PFQ_SKB(skb))->h_proto == __constant_htons(ETH_P_IP))
+	if (PFQ_CB(skb)->l3_proto == __constant_htons(ETH_P_IP))
 	{
 		struct iphdr _iph;
 		const struct iphdr *ip;
 
-		ip = skb_header_pointer(PFQ_SKB(skb), skb->mac_len, sizeof(_iph), &_iph);
+		ip = skb_header_pointer(PFQ_SKB(skb), PFQ_CB(skb)->l3_off, sizeof(_iph), &_iph);
 		if (ip == NULL)
 			return NOTHING;
 
@@ -136,7 +136,7 @@ ip_frag(arguments_t args, SkBuff skb)
 static uint64_t
 tcp_source(arguments_t args, SkBuff skb)
 {
-	if (eth_hdr(PFQ_SKB(skb))->h_proto == __constant_htons(ETH_P_IP))
+	if (PFQ_CB(skb)->l3_proto == __constant_htons(ETH_P_IP))
 	{
 		struct iphdr _iph;
 		const struct iphdr *ip;
@@ -144,14 +144,14 @@ tcp_source(arguments_t args, SkBuff skb)
 		struct tcphdr _tcp;
 		const struct tcphdr *tcp;
 
-		ip = skb_header_pointer(PFQ_SKB(skb), skb->mac_len, sizeof(_iph), &_iph);
+		ip = skb_header_pointer(PFQ_SKB(skb), PFQ_CB(skb)->l3_off, sizeof(_iph), &_iph);
 		if (ip == NULL)
 			return NOTHING;
 
 		if (ip->protocol != IPPROTO_TCP)
 			return NOTHING;
 
-		tcp = skb_header_pointer(PFQ_SKB(skb), skb->mac_len + (ip->ihl<<2), sizeof(_tcp), &_tcp);
+		tcp = skb_header_pointer(PFQ_SKB(skb), PFQ_CB(skb)->l3_off + (ip->ihl<<2), sizeof(_tcp), &_tcp);
 		if (tcp == NULL)
 			return NOTHING;
 
@@ -165,7 +165,7 @@ tcp_source(arguments_t args, SkBuff skb)
 static uint64_t
 tcp_dest(arguments_t args, SkBuff skb)
 {
-	if (eth_hdr(PFQ_SKB(skb))->h_proto == __constant_htons(ETH_P_IP))
+	if (PFQ_CB(skb)->l3_proto == __constant_htons(ETH_P_IP))
 	{
 		struct iphdr _iph;
 		const struct iphdr *ip;
@@ -173,14 +173,14 @@ tcp_dest(arguments_t args, SkBuff skb)
 		struct tcphdr _tcp;
 		const struct tcphdr *tcp;
 
-		ip = skb_header_pointer(PFQ_SKB(skb), skb->mac_len, sizeof(_iph), &_iph);
+		ip = skb_header_pointer(PFQ_SKB(skb), PFQ_CB(skb)->l3_off, sizeof(_iph), &_iph);
 		if (ip == NULL)
 			return NOTHING;
 
 		if (ip->protocol != IPPROTO_TCP)
 			return NOTHING;
 
-		tcp = skb_header_pointer(PFQ_SKB(skb), skb->mac_len + (ip->ihl<<2), sizeof(_tcp), &_tcp);
+		tcp = skb_header_pointer(PFQ_SKB(skb), PFQ_CB(skb)->l3_off + (ip->ihl<<2), sizeof(_tcp), &_tcp);
 		if (tcp == NULL)
 			return NOTHING;
 
@@ -193,7 +193,7 @@ tcp_dest(arguments_t args, SkBuff skb)
 static uint64_t
 tcp_hdrlen_(arguments_t args, SkBuff skb)
 {
-	if (eth_hdr(PFQ_SKB(skb))->h_proto == __constant_htons(ETH_P_IP))
+	if (PFQ_CB(skb)->l3_proto == __constant_htons(ETH_P_IP))
 	{
 		struct iphdr _iph;
 		const struct iphdr *ip;
@@ -201,14 +201,14 @@ tcp_hdrlen_(arguments_t args, SkBuff skb)
 		struct tcphdr _tcp;
 		const struct tcphdr *tcp;
 
-		ip = skb_header_pointer(PFQ_SKB(skb), skb->mac_len, sizeof(_iph), &_iph);
+		ip = skb_header_pointer(PFQ_SKB(skb), PFQ_CB(skb)->l3_off, sizeof(_iph), &_iph);
 		if (ip == NULL)
 			return NOTHING;
 
 		if (ip->protocol != IPPROTO_TCP)
 			return NOTHING;
 
-		tcp = skb_header_pointer(PFQ_SKB(skb), skb->mac_len + (ip->ihl<<2), sizeof(_tcp), &_tcp);
+		tcp = skb_header_pointer(PFQ_SKB(skb), PFQ_CB(skb)->l3_off + (ip->ihl<<2), sizeof(_tcp), &_tcp);
 		if (tcp == NULL)
 			return NOTHING;
 
@@ -225,7 +225,7 @@ tcp_hdrlen_(arguments_t args, SkBuff skb)
 static uint64_t
 udp_source(arguments_t args, SkBuff skb)
 {
-	if (eth_hdr(PFQ_SKB(skb))->h_proto == __constant_htons(ETH_P_IP))
+	if (PFQ_CB(skb)->l3_proto == __constant_htons(ETH_P_IP))
 	{
 		struct iphdr _iph;
 		const struct iphdr *ip;
@@ -233,14 +233,14 @@ udp_source(arguments_t args, SkBuff skb)
 		struct udphdr _udp;
 		const struct udphdr *udp;
 
-		ip = skb_header_pointer(PFQ_SKB(skb), skb->mac_len, sizeof(_iph), &_iph);
+		ip = skb_header_pointer(PFQ_SKB(skb), PFQ_CB(skb)->l3_off, sizeof(_iph), &_iph);
 		if (ip == NULL)
 			return NOTHING;
 
 		if (ip->protocol != IPPROTO_TCP)
 			return NOTHING;
 
-		udp = skb_header_pointer(PFQ_SKB(skb), skb->mac_len + (ip->ihl<<2), sizeof(_udp), &_udp);
+		udp = skb_header_pointer(PFQ_SKB(skb), PFQ_CB(skb)->l3_off + (ip->ihl<<2), sizeof(_udp), &_udp);
 		if (udp == NULL)
 			return NOTHING;
 
@@ -254,7 +254,7 @@ udp_source(arguments_t args, SkBuff skb)
 static uint64_t
 udp_dest(arguments_t args, SkBuff skb)
 {
-	if (eth_hdr(PFQ_SKB(skb))->h_proto == __constant_htons(ETH_P_IP))
+	if (PFQ_CB(skb)->l3_proto == __constant_htons(ETH_P_IP))
 	{
 		struct iphdr _iph;
 		const struct iphdr *ip;
@@ -262,14 +262,14 @@ udp_dest(arguments_t args, SkBuff skb)
 		struct udphdr _udp;
 		const struct udphdr *udp;
 
-		ip = skb_header_pointer(PFQ_SKB(skb), skb->mac_len, sizeof(_iph), &_iph);
+		ip = skb_header_pointer(PFQ_SKB(skb), PFQ_CB(skb)->l3_off, sizeof(_iph), &_iph);
 		if (ip == NULL)
 			return NOTHING;
 
 		if (ip->protocol != IPPROTO_TCP)
 			return NOTHING;
 
-		udp = skb_header_pointer(PFQ_SKB(skb), skb->mac_len + (ip->ihl<<2), sizeof(_udp), &_udp);
+		udp = skb_header_pointer(PFQ_SKB(skb), PFQ_CB(skb)->l3_off + (ip->ihl<<2), sizeof(_udp), &_udp);
 		if (udp == NULL)
 			return NOTHING;
 
@@ -282,7 +282,7 @@ udp_dest(arguments_t args, SkBuff skb)
 static uint64_t
 udp_len(arguments_t args, SkBuff skb)
 {
-	if (eth_hdr(PFQ_SKB(skb))->h_proto == __constant_htons(ETH_P_IP))
+	if (PFQ_CB(skb)->l3_proto == __constant_htons(ETH_P_IP))
 	{
 		struct iphdr _iph;
 		const struct iphdr *ip;
@@ -290,14 +290,14 @@ udp_len(arguments_t args, SkBuff skb)
 		struct udphdr _udp;
 		const struct udphdr *udp;
 
-		ip = skb_header_pointer(PFQ_SKB(skb), skb->mac_len, sizeof(_iph), &_iph);
+		ip = skb_header_pointer(PFQ_SKB(skb), PFQ_CB(skb)->l3_off, sizeof(_iph), &_iph);
 		if (ip == NULL)
 			return NOTHING;
 
 		if (ip->protocol != IPPROTO_TCP)
 			return NOTHING;
 
-		udp = skb_header_pointer(PFQ_SKB(skb), skb->mac_len + (ip->ihl<<2), sizeof(_udp), &_udp);
+		udp = skb_header_pointer(PFQ_SKB(skb), PFQ_CB(skb)->l3_off + (ip->ihl<<2), sizeof(_udp), &_udp);
 		if (udp == NULL)
 			return NOTHING;
 
@@ -311,7 +311,7 @@ udp_len(arguments_t args, SkBuff skb)
 static uint64_t
 icmp_type(arguments_t args, SkBuff skb)
 {
-	if (eth_hdr(PFQ_SKB(skb))->h_proto == __constant_htons(ETH_P_IP))
+	if (PFQ_CB(skb)->l3_proto == __constant_htons(ETH_P_IP))
 	{
 		struct iphdr _iph;
 		const struct iphdr *ip;
@@ -319,14 +319,14 @@ icmp_type(arguments_t args, SkBuff skb)
 		struct icmphdr _icmp;
 		const struct icmphdr *icmp;
 
-		ip = skb_header_pointer(PFQ_SKB(skb), skb->mac_len, sizeof(_iph), &_iph);
+		ip = skb_header_pointer(PFQ_SKB(skb), PFQ_CB(skb)->l3_off, sizeof(_iph), &_iph);
 		if (ip == NULL)
 			return NOTHING;
 
 		if (ip->protocol != IPPROTO_ICMP)
 			return NOTHING;
 
-		icmp = skb_header_pointer(PFQ_SKB(skb), skb->mac_len + (ip->ihl<<2), sizeof(_icmp), &_icmp);
+		icmp = skb_header_pointer(PFQ_SKB(skb), PFQ_CB(skb)->l3_off + (ip->ihl<<2), sizeof(_icmp), &_icmp);
 		if (icmp == NULL)
 			return NOTHING;
 
@@ -340,7 +340,7 @@ icmp_type(arguments_t args, SkBuff skb)
 static uint64_t
 icmp_code(arguments_t args, SkBuff skb)
 {
-	if (eth_hdr(PFQ_SKB(skb))->h_proto == __constant_htons(ETH_P_IP))
+	if (PFQ_CB(skb)->l3_proto == __constant_htons(ETH_P_IP))
 	{
 		struct iphdr _iph;
 		const struct iphdr *ip;
@@ -348,14 +348,14 @@ icmp_code(arguments_t args, SkBuff skb)
 		struct icmphdr _icmp;
 		const struct icmphdr *icmp;
 
-		ip = skb_header_pointer(PFQ_SKB(skb), skb->mac_len, sizeof(_iph), &_iph);
+		ip = skb_header_pointer(PFQ_SKB(skb), PFQ_CB(skb)->l3_off, sizeof(_iph), &_iph);
 		if (ip == NULL)
 			return NOTHING;
 
 		if (ip->protocol != IPPROTO_ICMP)
 			return NOTHING;
 
-		icmp = skb_header_pointer(PFQ_SKB(skb), skb->mac_len + (ip->ihl<<2), sizeof(_icmp), &_icmp);
+		icmp = skb_header_pointer(PFQ_SKB(skb), PFQ_CB(skb)->l3_off + (ip->ihl<<2), sizeof(_icmp), &_icmp);
 		if (icmp == NULL)
 			return NOTHING;
 
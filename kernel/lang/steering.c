@@ -74,8 +74,8 @@ steering_link(arguments_t args, SkBuff skb)
 static ActionSkBuff
 steering_vlan_id(arguments_t args, SkBuff skb)
 {
-	if (skb->vlan_tci & VLAN_VID_MASK)
-		return Steering(skb, skb->vlan_tci & VLAN_VID_MASK);
+	if (PFQ_CB(skb)->vlan_tci & VLAN_VID_MASK)
+		return Steering(skb, PFQ_CB(skb)->vlan_tci & VLAN_VID_MASK);
 	else
 		return Drop(skb);
 }
@@ -84,13 +84,13 @@ steering_vlan_id(arguments_t args, SkBuff skb)
 static ActionSkBuff
 steering_ip(arguments_t args, SkBuff skb)
 {
-	if (eth_hdr(PFQ_SKB(skb))->h_proto == __constant_htons(ETH_P_IP))
+	if (PFQ_CB(skb)->l3_proto == __constant_htons(ETH_P_IP))
 	{
 		struct iphdr _iph;
 		const struct iphdr *ip;
 		__be32 hash;
 
-		ip = skb_header_pointer(PFQ_SKB(skb), skb->mac_len, sizeof(_iph), &_iph);
+		ip = skb_header_pointer(PFQ_SKB(skb), PFQ_CB(skb)->l3_off, sizeof(_iph), &_iph);
 		if (ip == NULL)
 			return Drop(skb);
 
@@ -131,12 +131,12 @@ steering_net(arguments_t args, SkBuff skb)
 	__be32 mask    = GET_ARG_1(__be32, args);
 	__be32 submask = GET_ARG_2(__be32, args);
 
-	if (eth_hdr(PFQ_SKB(skb))->h_proto == __constant_htons(ETH_P_IP))
+	if (PFQ_CB(skb)->l3_proto == __constant_htons(ETH_P_IP))
 	{
 		struct iphdr _iph;
 		const struct iphdr *ip;
 
-		ip = skb_header_pointer(PFQ_SKB(skb), skb->mac_len, sizeof(_iph), &_iph);
+		ip = skb_header_pointer(PFQ_SKB(skb), PFQ_CB(skb)->l3_off, sizeof(_iph), &_iph);
 		if (ip == NULL)
 			return Drop(skb);
 
@@ -154,7 +154,7 @@ steering_net(arguments_t args, SkBuff skb)
 static ActionSkBuff
 steering_flow(arguments_t args, SkBuff skb)
 {
-	if (eth_hdr(PFQ_SKB(skb))->h_proto == __constant_htons(ETH_P_IP))
+	if (PFQ_CB(skb)->l3_proto == __constant_htons(ETH_P_IP))
 	{
 		struct iphdr _iph;
 		const struct iphdr *ip;
@@ -163,7 +163,7 @@ steering_flow(arguments_t args, SkBuff skb)
 		const struct udphdr *udp;
 		__be32 hash;
 
-		ip = skb_header_pointer(PFQ_SKB(skb), skb->mac_len, sizeof(_iph), &_iph);
+		ip = skb_header_pointer(PFQ_SKB(skb), PFQ_CB(skb)->l3_off, sizeof(_iph), &_iph);
 		if (ip == NULL)
 			return Drop(skb);
 
@@ -171,7 +171,7 @@ steering_flow(arguments_t args, SkBuff skb)
 		    ip->protocol != IPPROTO_TCP)
 			return Drop(skb);
 
-		udp = skb_header_pointer(PFQ_SKB(skb), skb->mac_len + (ip->ihl<<2), sizeof(_udp), &_udp);
+		udp = skb_header_pointer(PFQ_SKB(skb), PFQ_CB(skb)->l3_off + (ip->ihl<<2), sizeof(_udp), &_udp);
 		if (udp == NULL)
 			return Drop(skb);  /* broken */
 
@@ -187,13 +187,13 @@ steering_flow(arguments_t args, SkBuff skb)
 static ActionSkBuff
 steering_ip6(arguments_t args, SkBuff skb)
 {
-	if (eth_hdr(PFQ_SKB(skb))->h_proto == __constant_htons(ETH_P_IPV6))
+	if (PFQ_CB(skb)->l3_proto == __constant_htons(ETH_P_IPV6))
 	{
 		struct ipv6hdr _ip6h;
 		const struct ipv6hdr *ip6;
 		__be32 hash;
 
-		ip6 = skb_header_pointer(PFQ_SKB(skb), skb->mac_len, sizeof(_ip6h), &_ip6h);
+		ip6 = skb_header_pointer(PFQ_SKB(skb), PFQ_CB(skb)->l3_off, sizeof(_ip6h), &_ip6h);
 		if (ip6 == NULL)
 			return Drop(skb);
 
@@ -35,7 +35,7 @@ static bool
 vlan_id(arguments_t args, SkBuff skb)
 {
 	char *mem = GET_ARG_1(char *, args);
-	return mem[ skb->vlan_tci & VLAN_VID_MASK ];
+	return mem[ PFQ_CB(skb)->vlan_tci & VLAN_VID_MASK ];
 }
 
 
@@ -31,6 +31,12 @@ extern  int pfq_netif_rx(struct sk_buff *);
 extern  int pfq_netif_receive_skb(struct sk_buff *);
 extern  gro_result_t pfq_gro_receive(struct napi_struct *, struct sk_buff *);
 
+/* batched entry point: drivers can collect the skbs of a NAPI poll
+ * (e.g. with __skb_queue_tail) and hand them to PFQ at once.
+ */
+
+extern  int pfq_netif_receive_list(struct sk_buff_head *);
+
 extern struct sk_buff * __pfq_alloc_skb(unsigned int size, gfp_t priority, int fclone, int node);
 extern struct sk_buff * pfq_dev_alloc_skb(unsigned int length);
 extern struct sk_buff * __pfq_netdev_alloc_skb(struct net_device *dev, unsigned int length, gfp_t gfp);
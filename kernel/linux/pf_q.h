@@ -100,8 +100,10 @@ static inline void smp_wmb() { barrier(); }
 #define Q_SO_SET_RX_CAPLEN		3
 #define Q_SO_SET_RX_SLOTS		4
 #define Q_SO_SET_RX_OFFSET		5
+#define Q_SO_SET_TX_ASYNC_QUEUES	6	/* number of async Tx queues (before enable) */
 #define Q_SO_SET_TX_SLOTS		7
 #define Q_SO_SET_WEIGHT			8
+#define Q_SO_SET_TX_ZEROCOPY		9	/* 1 = Tx skbs refer to the mmapped memory */
 
 #define Q_SO_GROUP_BIND			10
 #define Q_SO_GROUP_UNBIND		11
@@ -129,10 +131,31 @@ static inline void smp_wmb() { barrier(); }
 #define Q_SO_GET_GROUP_STATS		31
 #define Q_SO_GET_GROUP_COUNTERS		32
 #define Q_SO_GET_WEIGHT			33
+#define Q_SO_GET_NETQ_STATS		34
+#define Q_SO_GET_DROP_STATS		35	/* socket drop reasons */
+#define Q_SO_GET_GROUP_DROP_STATS	36	/* group drop reasons */
+#define Q_SO_GET_GLOBAL_DROP_STATS	37	/* global drop reasons */
+#define Q_SO_GET_COPY_STATS		38	/* socket linear/paged copies */
+#define Q_SO_GET_TX_ZEROCOPY		39
 
 #define Q_SO_TX_BIND			40
 #define Q_SO_TX_UNBIND			41
 #define Q_SO_TX_QUEUE			42
+#define Q_SO_TX_RATE			43	/* token-bucket pacing of a Tx queue */
+#define Q_SO_TX_THREAD_ADD		44	/* start a Tx kthread on the given cpu */
+#define Q_SO_TX_THREAD_DEL		45	/* stop the last Tx kthread (if unbound) */
+#define Q_SO_TX_DOORBELL		48	/* wake the Tx kthread of an async queue */
+#define Q_SO_TX_BIND_RSVD		49	/* Tx bind, reserving the hw queue among PFQ sockets */
+#define Q_SO_TX_REPLAY			50	/* replay a memory-mapped pcap file from an async queue */
+#define Q_SO_GET_TX_REPLAY		51	/* progress of the replay */
+#define Q_SO_TX_TSTAMP			52	/* Tx timestamps ring (Q_TX_TSTAMP_*) */
+#define Q_SO_GET_TX_TSTAMP		53
+#define Q_SO_TX_SCHED			54	/* priority and weight of an async Tx queue */
+#define Q_SO_GROUP_LINKS		55	/* set a link group of the group (pfq-lang link_group) */
+#define Q_SO_GET_SHMEM_PAGE_SIZE	56	/* size of the pages backing the shared memory (bytes) */
+
+#define Q_SO_GET_TX_ASYNC_QUEUES	46
+#define Q_SO_GET_TX_THREADS		47	/* number of running Tx kthreads */
 
 
 /* general placeholders */
@@ -179,7 +202,12 @@ static inline void smp_wmb() { barrier(); }
 /*additional constants*/
 
 #define Q_MAX_COUNTERS			64
-#define Q_MAX_TX_QUEUES			4
+#define Q_MAX_TX_QUEUES			16
+#define Q_DEF_TX_QUEUES			4	/* async Tx queues allocated by default */
+#define Q_TX_MAX_PRIO			8	/* priority levels of the async Tx queues */
+#define Q_MAX_LINK_GROUPS		8	/* link groups per group */
+#define Q_MAX_LINKS			8	/* devices per link group */
+#define Q_MAX_NETQ_STATS		256	/* max hw queues per device in Q_SO_GET_NETQ_STATS */
 
 
 /* PFQ socket queue */
@@ -196,33 +224,114 @@ struct pfq_rx_queue
 
 
 
+/* zero-copy Tx completions: the slot of a packet is not released to the
+ * producer (cons.pos) until the driver frees all its skbs; then an entry is
+ * pushed to the completion ring of the queue. off is the offset of the slot
+ * from the base of the Tx queue memory, seq is the position + 1 in the ring,
+ * written last. User-space publishes the position it has read up to in tail:
+ * entries pushed while the ring is full overwrite the oldest ones and are
+ * counted in overflow.
+ */
+
+#define Q_TX_COMPLETION_LEN		1024	/* power of 2 */
+
+struct pfq_tx_completion
+{
+	uint32_t			seq;
+	uint32_t			off;
+};
+
+
+struct pfq_tx_completion_ring
+{
+	unsigned int			head;
+	unsigned int			overflow;
+
+	unsigned int			tail __attribute__((aligned(64)));	/* written by user-space */
+
+	struct pfq_tx_completion	ring[Q_TX_COMPLETION_LEN] __attribute__((aligned(64)));
+};
+
+
+/* Tx queues are SPSC rings of variable length records (pfq_pkthdr + packet).
+ * prod.pos and cons.pos are free running byte cursors: the record at pos is at
+ * offset (pos % size). A record never straddles the end of the ring: the
+ * producer skips the tail, marking it with a header with commit = Q_TX_SLOT_SKIP
+ * if there is room for one (see Q_TX_RING_SKIP). Records with caplen = 0 are
+ * ordinary (empty) packets.
+ */
+
+#define Q_TX_SLOT_SKIP		2
+
+#define Q_TX_RING_SKIP(hdr, rem)	((rem) < sizeof(struct pfq_pkthdr) || (hdr)->commit == Q_TX_SLOT_SKIP)
+
+
 struct pfq_tx_queue
 {
-        size_t				size;	    /* queue size in bytes */
+        size_t				size;	    /* ring size in bytes */
+	size_t				completion; /* offset of the pfq_tx_completion_ring in the
+						       shared memory, 0 unless zero-copy Tx is enabled */
 
 	struct
 	{
-		unsigned int		index;
-		ptrdiff_t		off0;
-		ptrdiff_t	        off1;
+		size_t			pos;	    /* bytes published by the producer */
 
 	} prod __attribute__((aligned(64)));
 
 	struct
 	{
-		unsigned int		index;
-		ptrdiff_t		off;
+		size_t			pos;	    /* bytes consumed by the kernel */
+		unsigned int		sleeping;   /* Tx thread asleep: ring Q_SO_TX_DOORBELL */
 
 	} cons __attribute__((aligned(64)));
 
 } __attribute__((aligned(64)));
 
 
+/* Tx timestamps of the socket (Q_SO_TX_TSTAMP): with Q_TX_TSTAMP_SW an entry
+ * with the time the packet was handed to the driver (sw) is written for every
+ * transmitted skb; with Q_TX_TSTAMP_HW a second entry with the same id carries
+ * the hardware transmit time (hw), if the driver supports SKBTX_HW_TSTAMP and
+ * hw timestamping is enabled on the device (SIOCSHWTSTAMP). id is the index of
+ * the record in its Tx queue (modulo 2^24) since the socket was enabled; queue
+ * is -1 for the synchronous queue. seq is the position + 1 in the ring, written
+ * last. The ring is part of the shared memory only if the timestamps are
+ * enabled before the socket.
+ */
+
+#define Q_TX_TSTAMP_SW          (1 << 0)
+#define Q_TX_TSTAMP_HW          (1 << 1)
+
+#define Q_TX_TSTAMP_LEN         4096    /* power of 2 */
+#define Q_TX_TSTAMP_ID_MASK     0xffffff
+
+struct pfq_tx_tstamp
+{
+        uint32_t                seq;
+        int16_t                 queue;
+        uint16_t                reserved;
+        uint32_t                id;
+        uint32_t                reserved2;
+        uint64_t                sw;     /* ns */
+        uint64_t                hw;     /* ns */
+};
+
+
+struct pfq_tx_tstamp_ring
+{
+        unsigned int            head;
+        struct pfq_tx_tstamp    ring[Q_TX_TSTAMP_LEN] __attribute__((aligned(64)));
+};
+
+
 struct pfq_shared_queue
 {
         struct pfq_rx_queue rx;
         struct pfq_tx_queue tx;
         struct pfq_tx_queue tx_async[Q_MAX_TX_QUEUES];
+
+        size_t              tx_tstamp;  /* offset of the pfq_tx_tstamp_ring in the shared
+                                           memory, 0 unless Tx timestamps are enabled */
 };
 
 
@@ -366,6 +475,125 @@ struct pfq_vlan_toggle
         int toggle;
 };
 
+/* Tx pacing: queue is -1 for the sync Tx queue, or the index of the
+ * async queue. pps = bps = 0 disables pacing; burst is in packets.
+ */
+
+struct pfq_tx_rate
+{
+        int             queue;
+        unsigned int    burst;
+        unsigned long   pps;
+        unsigned long   bps;
+};
+
+/* pfq-lang forwarders (forward_queue, bridge_queue, tee_queue...): the Tx
+ * queue of the egress device is a fixed queue (>= 0, modulo the number of
+ * Tx queues of the device), or one of the following policies.
+ */
+
+#define Q_FWD_QUEUE_ANY         -1      /* picked by the driver (ndo_select_queue), or queue 0 */
+#define Q_FWD_QUEUE_INGRESS     -2      /* the Rx queue the packet was received from */
+#define Q_FWD_QUEUE_HASH        -3      /* the hash of the steering function (fanout) */
+
+/* link groups: the egress devices of the pfq-lang link_group functions. A
+ * flow (the hash of the steering function, or the flow hash of the packet)
+ * is forwarded to one of the devices with carrier, chosen in proportion to
+ * their weight. Devices with weight 0 are backups, used only when no
+ * weighted device has carrier. num = 0 removes the link group. Link groups
+ * are updated at runtime, without reloading the computation of the group.
+ */
+
+struct pfq_group_links
+{
+        int             gid;
+        int             id;             /* 0 ... Q_MAX_LINK_GROUPS-1 */
+        int             num;
+        int             ifindex[Q_MAX_LINKS];
+        unsigned int    weight[Q_MAX_LINKS];
+};
+
+/* Tx scheduling: a Tx kthread serves the async queues bound to it in strict
+ * priority order (0 ... Q_TX_MAX_PRIO-1, higher first): a lower priority queue
+ * is served only when no higher one has packets pending. Queues of the same
+ * priority share the kthread by deficit round robin, in bytes: each is granted
+ * 'weight' frames of the MTU of its device per round, the credit left unused
+ * is carried over to the next one (0 = the whole ring, the default).
+ */
+
+struct pfq_tx_sched
+{
+        int             queue;
+        int             prio;
+        unsigned int    weight;
+};
+
+/* pcap replay: the Tx kthread of the async 'queue' transmits the records of
+ * the pcap file mapped at 'addr' (addr = NULL stops the replay). 'loops' = 0
+ * replays forever; with 'tstamp' the inter-packet gaps of the file are
+ * honoured, scaled by 'speed' (1000 = original pace, 2000 = twice as fast),
+ * otherwise packets are sent back-to-back (subject to the pacing of the queue).
+ */
+
+struct pfq_tx_replay
+{
+        int             queue;
+        const void      *addr;
+        size_t          len;
+        unsigned int    loops;
+        unsigned int    speed;
+        int             tstamp;
+};
+
+struct pfq_tx_replay_stats
+{
+        int             queue;          /* in: async queue */
+        int             active;
+        unsigned long   loops;          /* completed loops */
+        unsigned long   sent;
+};
+
+
+/* Tx templates: a record whose header has commit = Q_TX_SLOT_TEMPLATE carries a
+ * pfq_tx_template followed by the packet (caplen includes both). Each of the
+ * 'copies' of the packet is a distinct skb, mutated by the operations of the
+ * template: copy i of an Q_TX_MUT_INC field is min + (i * step) % (max - min + 1),
+ * a Q_TX_MUT_RAND field is random in [min, max]. Fields are 1, 2 or 4 bytes
+ * wide, in network byte order. The IPv4 header and TCP/UDP checksums of the
+ * header at l3_offset are fixed incrementally, if requested.
+ */
+
+#define Q_TX_SLOT_TEMPLATE      1
+
+#define Q_TX_TEMPLATE_MAX_OPS   8
+
+#define Q_TX_MUT_INC            1
+#define Q_TX_MUT_RAND           2
+
+#define Q_TX_CSUM_IP4           (1 << 0)
+#define Q_TX_CSUM_L4            (1 << 1)
+
+struct pfq_tx_mutation
+{
+        uint16_t        offset;         /* offset of the field in the packet */
+        uint8_t         size;           /* 1, 2 or 4 bytes */
+        uint8_t         op;             /* Q_TX_MUT_INC, Q_TX_MUT_RAND */
+        uint32_t        min;
+        uint32_t        max;
+        uint32_t        step;
+};
+
+struct pfq_tx_template
+{
+        uint8_t         num_ops;
+        uint8_t         csum;           /* Q_TX_CSUM_IP4 | Q_TX_CSUM_L4 */
+        uint16_t        l3_offset;      /* offset of the IPv4 header */
+        uint32_t        reserved;
+
+        struct pfq_tx_mutation op[Q_TX_TEMPLATE_MAX_OPS];
+};
+
+
 struct pfq_binding
 {
         union
@@ -426,6 +654,56 @@ struct pfq_stats
 };
 
 
+/* pfq statistics of a device hw queue (Q_SO_GET_NETQ_STATS).
+ * optval is an array of entries, one per hw queue: on input the recv
+ * field of the first entry holds the ifindex of the device.
+ */
+
+struct pfq_queue_stats
+{
+        unsigned long int recv;		/* received from the hw queue */
+        unsigned long int frwd;		/* forwarded to devices */
+        unsigned long int drop;		/* not delivered to any endpoint */
+};
+
+
+/* pfq drop reasons */
+
+#define Q_DROP_NO_SOCKET		0	/* no socket open */
+#define Q_DROP_GC_FULL			1	/* GC pool exhausted */
+#define Q_DROP_DEVMAP			2	/* device/queue not bound to any group */
+#define Q_DROP_BPF			3	/* rejected by the BPF filter */
+#define Q_DROP_VLAN			4	/* rejected by the vlan filter */
+#define Q_DROP_LANG			5	/* dropped by the computation */
+#define Q_DROP_QUEUE_FULL		6	/* socket Rx queue full */
+#define Q_DROP_QUEUE_OFF		7	/* socket Rx queue not enabled */
+#define Q_DROP_FWD_FULL			8	/* too many forward annotations */
+#define Q_DROP_NOMEM			9	/* skb allocation failure */
+#define Q_DROP_POOL_EMPTY		10	/* skb allocation failure, the skb pool was empty */
+
+#define Q_DROP_MAX			16
+
+
+/* pfq drop statistics (Q_SO_GET_*DROP_STATS).
+ * For groups, reason[0] holds the group id on input.
+ */
+
+struct pfq_drop_stats
+{
+        unsigned long int reason[Q_DROP_MAX];
+};
+
+
+/* pfq copy statistics of a socket (Q_SO_GET_COPY_STATS).
+ */
+
+struct pfq_copy_stats
+{
+        unsigned long int linear;	/* packets copied from linear skbs */
+        unsigned long int paged;	/* packets copied from paged skbs */
+};
+
+
 /* pfq counters for groups */
 
 struct pfq_counters
@@ -90,7 +90,7 @@ heuristic_rtp(SkBuff skb, bool steer)
 {
 	struct hret ret = { 0, 0 };
 
-	if (eth_hdr(PFQ_SKB(skb))->h_proto == __constant_htons(ETH_P_IP))
+	if (PFQ_CB(skb)->l3_proto == __constant_htons(ETH_P_IP))
 	{
 		struct iphdr _iph;
 		const struct iphdr *ip;
@@ -100,14 +100,14 @@ heuristic_rtp(SkBuff skb, bool steer)
 
                 uint16_t source,dest;
 
-		ip = skb_header_pointer(PFQ_SKB(skb), skb->mac_len, sizeof(_iph), &_iph);
+		ip = skb_header_pointer(PFQ_SKB(skb), PFQ_CB(skb)->l3_off, sizeof(_iph), &_iph);
 		if (ip == NULL)
 			return ret;
 
 		if (ip->protocol != IPPROTO_UDP)
 			return ret;
 
-		hdr = skb_header_pointer(PFQ_SKB(skb), skb->mac_len + (ip->ihl<<2), sizeof(_hdr), &_hdr);
+		hdr = skb_header_pointer(PFQ_SKB(skb), PFQ_CB(skb)->l3_off + (ip->ihl<<2), sizeof(_hdr), &_hdr);
 		if (hdr == NULL)
 			return ret;
 
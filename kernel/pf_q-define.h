@@ -30,16 +30,20 @@
 #define Q_MAX_GID		((int)sizeof(long)<<3)
 #define Q_SKBUFF_BATCH		((int)sizeof(long)<<3)
 
-#define Q_GC_LOG_QUEUE_LEN	16
 #define Q_GC_POOL_QUEUE_LEN	512
+#define Q_GC_XMIT_DEVICES	64				/* devices forwarded per batch */
+#define Q_GC_XMIT_QUEUE_LEN	(Q_GC_POOL_QUEUE_LEN * 4)	/* forwards per batch */
 
 #define Q_MAX_SOCK_MASK		1024
 #define Q_MAX_DEVICE		1024
 #define Q_MAX_HW_QUEUE          256
 
 #define Q_MAX_TX_SKB_COPY	256
+#define Q_TX_ZEROCOPY_HEAD	128	/* bytes copied in the linear part of zero-copy skbs */
+#define Q_TX_SPIN_NS		20000	/* busy-wait before a Tx deadline, the rest is slept */
 
 #define Q_GRACE_PERIOD		50 /* msec */
+#define Q_TX_ZEROCOPY_TIMEOUT	5000 /* msec: skbs in flight waited for on disable */
 
 #define Q_SLOT_ALIGN(s, n)      ((s+(n-1)) & ~(n-1))
 
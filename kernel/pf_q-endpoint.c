@@ -35,30 +35,19 @@
 #include <pf_q-sparse.h>
 #include <pf_q-transmit.h>
 #include <pf_q-endpoint.h>
+#include <pf_q-global.h>
+#include <pf_q-group.h>
 
 
-void
-add_dev_to_endpoints(struct net_device *dev, struct pfq_endpoint_info *ts)
+static inline
+void pfq_endpoint_drop(struct pfq_sock *so, pfq_gid_t gid, int why, size_t n, int cpu)
 {
-	size_t n = 0;
+	struct pfq_group *group = pfq_get_group(gid);
 
-	for(; n < ts->num; ++n)
-	{
-		if (dev == ts->dev[n]) {
-			ts->cnt[n]++;
-			ts->cnt_total++;
-			return;
-		}
-	}
-
-	if (n < Q_GC_LOG_QUEUE_LEN) {
-		ts->dev[n] = dev;
-		ts->cnt[n] = 1;
-		ts->cnt_total++;
-		ts->num++;
-	}
-	else
-		pr_devel("[PFQ] GC: forward pool exhausted!\n");
+	__sparse_add(so->drops, reason[why], n, cpu);
+	if (group)
+		__sparse_add(group->drops, reason[why], n, cpu);
+	__sparse_add(&global_drops, reason[why], n, cpu);
 }
 
 
@@ -73,17 +62,21 @@ size_t copy_to_user_skbs(struct pfq_sock *so, struct pfq_skbuff_GC_queue *skbs,
 
 		smp_rmb();
 
-                cpy = pfq_sk_rx_queue_recv(&so->opt, skbs, mask, len, gid);
+                cpy = pfq_sk_rx_queue_recv(so, skbs, mask, len, gid, cpu);
 
 		__sparse_add(so->stats, recv, cpy, cpu);
 
-		if (len > cpy)
+		if (len > cpy) {
 			__sparse_add(so->stats, drop, len - cpy, cpu);
+			pfq_endpoint_drop(so, gid, Q_DROP_QUEUE_FULL, len - cpy, cpu);
+		}
 
 		return cpy;
         }
-	else
+	else {
 		__sparse_add(so->stats, lost, len, cpu);
+		pfq_endpoint_drop(so, gid, Q_DROP_QUEUE_OFF, len, cpu);
+	}
 
         return cpy;
 }
@@ -38,18 +38,6 @@ enum pfq_endpoint_type
 };
 
 
-struct pfq_endpoint_info
-{
-	struct net_device * dev[Q_GC_LOG_QUEUE_LEN];
-	size_t cnt [Q_GC_LOG_QUEUE_LEN];
-	size_t cnt_total;
-	size_t num;
-};
-
-
-void add_dev_to_endpoints(struct net_device *dev, struct pfq_endpoint_info *ts);
-
-
 extern size_t copy_to_endpoint_skbs(struct pfq_sock *so,
 				    struct pfq_skbuff_GC_queue *pool,
 				    unsigned long long mask,
@@ -45,13 +45,17 @@ int capt_batch_len	= 1;
 int vl_untag		= 0;
 
 int skb_pool_size	= 1024;
+int skb_pool_low	= 64;
+int skb_pool_high	= 0;
 
 int tx_affinity[Q_MAX_CPU] = {0};
 int tx_thread_nr;
+int tx_poll_budget	= 100;
 
 
 DEFINE_PER_CPU(struct pfq_global_stats, global_stats);
 DEFINE_PER_CPU(struct pfq_memory_stats, memory_stats);
+DEFINE_PER_CPU(struct pfq_drop_counters, global_drops);
 
 
 module_param(capture_incoming,  int, 0644);
@@ -64,8 +68,11 @@ module_param(capt_batch_len,	int, 0644);
 module_param(xmit_batch_len,	int, 0644);
 
 module_param(skb_pool_size,	int, 0644);
+module_param(skb_pool_low,	int, 0644);
+module_param(skb_pool_high,	int, 0644);
 module_param(vl_untag,		int, 0644);
 module_param_array(tx_affinity, int, &tx_thread_nr, 0644);
+module_param(tx_poll_budget,	int, 0644);
 
 MODULE_PARM_DESC(capture_incoming," Capture incoming packets: (1 default)");
 MODULE_PARM_DESC(capture_outgoing," Capture outgoing packets: (0 default)");
@@ -76,11 +83,14 @@ MODULE_PARM_DESC(xmit_slot_size, " Maximum transmission length (default=1514 byt
 MODULE_PARM_DESC(capt_batch_len, " Capture batch queue length");
 MODULE_PARM_DESC(xmit_batch_len, " Transmit batch queue length");
 
-MODULE_PARM_DESC(vl_untag, " Enable vlan untagging (default=0)");
+MODULE_PARM_DESC(vl_untag, " Enable parsing of sw vlan tags (packets are not modified, default=0)");
 
 #ifdef PFQ_USE_SKB_POOL
 MODULE_PARM_DESC(skb_pool_size, " Socket buffer pool size (default=1024)");
+MODULE_PARM_DESC(skb_pool_low,  " Socket buffer pool low watermark (default=64)");
+MODULE_PARM_DESC(skb_pool_high, " Socket buffer pool high watermark (default=skb_pool_size)");
 #endif
 
 MODULE_PARM_DESC(tx_affinity, " Tx threads cpus' affinity");
+MODULE_PARM_DESC(tx_poll_budget, " Tx threads idle polling before sleeping on the doorbell (default=100 usec)");
 
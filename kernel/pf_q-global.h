@@ -45,12 +45,16 @@ extern int capt_batch_len;
 extern int vl_untag;
 
 extern int skb_pool_size;
+extern int skb_pool_low;
+extern int skb_pool_high;
 
 extern int tx_affinity[Q_MAX_CPU];
 extern int tx_thread_nr;
+extern int tx_poll_budget;
 
 DECLARE_PER_CPU(struct pfq_global_stats, global_stats);
 DECLARE_PER_CPU(struct pfq_memory_stats, memory_stats);
+DECLARE_PER_CPU(struct pfq_drop_counters, global_drops);
 
 
 #endif /* PF_Q_GLOBAL_H */
@@ -29,6 +29,8 @@
 #include <linux/module.h>
 #include <linux/semaphore.h>
 #include <linux/sched.h>
+#include <linux/slab.h>
+#include <linux/netdevice.h>
 
 #include <pragma/diagnostic_pop>
 
@@ -65,8 +67,14 @@ pfq_groups_init(void)
 			goto err;
 		}
 
+		pfq_groups[n].drops = alloc_percpu(struct pfq_drop_counters);
+		if (pfq_groups[n].drops == NULL) {
+			goto err;
+		}
+
 		pfq_group_stats_reset(pfq_groups[n].stats);
 		pfq_group_counters_reset(pfq_groups[n].counters);
+		pfq_drop_counters_reset(pfq_groups[n].drops);
 	}
 
 	return 0;
@@ -84,8 +92,10 @@ pfq_groups_destruct(void)
 	{
 		free_percpu(pfq_groups[n].stats);
 		free_percpu(pfq_groups[n].counters);
+		free_percpu(pfq_groups[n].drops);
 		pfq_groups[n].stats = NULL;
 		pfq_groups[n].counters = NULL;
+		pfq_groups[n].drops = NULL;
 	}
 }
 
@@ -176,18 +186,44 @@ __pfq_group_init(pfq_gid_t gid)
         atomic_long_set(&group->comp,     0L);
         atomic_long_set(&group->comp_ctx, 0L);
 
+        for(i = 0; i < Q_MAX_LINK_GROUPS; i++)
+        {
+                atomic_long_set(&group->links[i], 0L);
+        }
+
 	pfq_group_stats_reset(group->stats);
 	pfq_group_counters_reset(group->counters);
+	pfq_drop_counters_reset(group->drops);
+}
+
+
+static void
+pfq_link_group_free(struct pfq_link_group *lg)
+{
+	int n;
+
+	if (lg == NULL)
+		return;
+
+	for(n = 0; n < lg->num; n++)
+	{
+		if (lg->dev[n])
+			dev_put(lg->dev[n]);
+	}
+
+	kfree(lg);
 }
 
 
 static void
 __pfq_group_free(pfq_gid_t gid)
 {
+        struct pfq_link_group *old_links[Q_MAX_LINK_GROUPS];
         struct pfq_group * group;
         struct sk_filter *filter;
         struct pfq_lang_computation_tree *old_comp;
         void *old_ctx;
+        int n;
 
 	group = pfq_get_group(gid);
         if (group == NULL)
@@ -205,8 +241,18 @@ __pfq_group_free(pfq_gid_t gid)
         old_comp = (struct pfq_lang_computation_tree *)atomic_long_xchg(&group->comp, 0L);
         old_ctx  = (void *)atomic_long_xchg(&group->comp_ctx, 0L);
 
+        for(n = 0; n < Q_MAX_LINK_GROUPS; n++)
+        {
+                old_links[n] = (struct pfq_link_group *)atomic_long_xchg(&group->links[n], 0L);
+        }
+
         msleep(Q_GRACE_PERIOD);   /* sleeping is possible here: user-context */
 
+        for(n = 0; n < Q_MAX_LINK_GROUPS; n++)
+        {
+                pfq_link_group_free(old_links[n]);
+        }
+
 	/* finalize old computation */
 
 	if (old_comp)
@@ -372,6 +418,57 @@ pfq_set_group_prog(pfq_gid_t gid, struct pfq_lang_computation_tree *comp, void *
 }
 
 
+int
+pfq_set_group_links(pfq_gid_t gid, struct net *net, struct pfq_group_links const *links)
+{
+        struct pfq_link_group *lg = NULL, *old;
+        struct pfq_group * group;
+        int n;
+
+	group = pfq_get_group(gid);
+        if (group == NULL)
+                return -EINVAL;
+
+        if (links->id < 0 || links->id >= Q_MAX_LINK_GROUPS ||
+            links->num < 0 || links->num > Q_MAX_LINKS)
+                return -EINVAL;
+
+        if (links->num) {
+
+                lg = kzalloc(sizeof(*lg), GFP_KERNEL);
+                if (lg == NULL)
+                        return -ENOMEM;
+
+                for(n = 0; n < links->num; n++)
+                {
+                        lg->dev[n] = dev_get_by_index(net, links->ifindex[n]);
+                        if (lg->dev[n] == NULL) {
+                                printk(KERN_INFO "[PFQ] group gid=%d links: ifindex=%d no such device!\n",
+                                       gid, links->ifindex[n]);
+                                pfq_link_group_free(lg);
+                                return -ENODEV;
+                        }
+
+                        lg->weight[n] = links->weight[n];
+                        lg->num++;
+                }
+        }
+
+        down(&group_sem);
+
+        old = (struct pfq_link_group *)atomic_long_xchg(&group->links[links->id], (long)lg);
+
+        msleep(Q_GRACE_PERIOD);   /* sleeping is possible here: user-context */
+
+        pfq_link_group_free(old);
+
+        up(&group_sem);
+
+        pr_devel("[PFQ] group gid=%d link group %d: %d devices\n", gid, links->id, links->num);
+        return 0;
+}
+
+
 int
 pfq_join_group(pfq_gid_t gid, pfq_id_t id, unsigned long class_mask, int policy)
 {
@@ -42,6 +42,14 @@
 
 
 
+struct pfq_link_group
+{
+	int			num;
+	struct net_device	*dev[Q_MAX_LINKS];
+	unsigned int		weight[Q_MAX_LINKS];
+};
+
+
 struct pfq_group
 {
         int policy;                                     /* policy for the group */
@@ -59,8 +67,11 @@ struct pfq_group
         atomic_long_t comp;                             /* struct pfq_lang_computation_tree *  (new functional program) */
         atomic_long_t comp_ctx;                         /* void *: storage context (new functional program) */
 
+        atomic_long_t links[Q_MAX_LINK_GROUPS];         /* struct pfq_link_group * */
+
 	struct pfq_group_stats __percpu *stats;
 	struct pfq_group_counters __percpu *counters;
+	struct pfq_drop_counters __percpu *drops;
 };
 
 
@@ -72,6 +83,7 @@ extern int  pfq_join_free_group(pfq_id_t id, unsigned long class_mask, int polic
 extern int  pfq_join_group(pfq_gid_t gid, pfq_id_t id, unsigned long class_mask, int policy);
 extern int  pfq_leave_group(pfq_gid_t gid, pfq_id_t id);
 extern int  pfq_set_group_prog(pfq_gid_t gid, struct pfq_lang_computation_tree *prog, void *ctx);
+extern int  pfq_set_group_links(pfq_gid_t gid, struct net *net, struct pfq_group_links const *links);
 extern void pfq_leave_all_groups(pfq_id_t id);
 
 extern unsigned long pfq_get_groups(pfq_id_t id);
@@ -175,18 +175,47 @@ struct sk_buff * pfq_netdev_alloc_skb_ip_align(struct net_device *dev,
 }
 
 
+/* the home pool of an skb is recorded in the destructor_arg of its shared
+ * info (see pfq_skb_pool_set_home).
+ */
+
+static inline
+struct pfq_skb_pool *pfq_skb_pool_home(struct sk_buff *skb)
+{
+	struct skb_shared_info *shinfo = skb_shinfo(skb);
+	unsigned long tag = (unsigned long)shinfo->destructor_arg;
+	struct pfq_percpu_pool *pool;
+
+	if (tag == 0 || tag > ((unsigned long)nr_cpu_ids << 1))
+		return NULL;
+
+	if (shinfo->tx_flags & SKBTX_DEV_ZEROCOPY)
+		return NULL;
+
+	tag--;
+	pool = per_cpu_ptr(percpu_pool, tag >> 1);
+	return (tag & 1) ? &pool->tx_pool : &pool->rx_pool;
+}
+
+
 static inline
 struct sk_buff *
 ____pfq_alloc_skb_pool(unsigned int size, gfp_t priority, int fclone, int node, struct pfq_skb_pool *skb_pool)
 {
+	struct sk_buff *skb;
 #ifdef PFQ_USE_SKB_POOL
-	struct sk_buff *skb = pfq_skb_pool_pop(skb_pool);
+	skb = pfq_skb_pool_pop(skb_pool);
 	if (likely(skb != NULL)) {
 		sparse_inc(&memory_stats, pool_pop);
 
 		if (likely(pfq_skb_is_recycleable(skb, size))) {
 			sparse_inc(&memory_stats, pool_alloc);
-			return pfq_skb_recycle(skb);
+			if (unlikely(size > skb_pool->len))
+				skb_pool->len = size;
+			skb_pool->hit++;
+			skb = pfq_skb_recycle(skb);
+			pfq_skb_pool_set_home(skb, skb_pool);
+			return skb;
 		} else {
 			sparse_inc(&memory_stats, err_norecyl);
 			sparse_inc(&memory_stats, os_free);
@@ -196,10 +225,45 @@ ____pfq_alloc_skb_pool(unsigned int size, gfp_t priority, int fclone, int node,
 	else {
 		sparse_inc(&memory_stats, err_pop);
 	}
+
+	if (unlikely(size > skb_pool->len))
+		skb_pool->len = size;
+	skb_pool->miss++;
 #endif
 
 	sparse_inc(&memory_stats, os_alloc);
-	return  __alloc_skb(size, priority, fclone, node);
+	skb = __alloc_skb(size, priority, fclone, node);
+#ifdef PFQ_USE_SKB_POOL
+	if (likely(skb))
+		pfq_skb_pool_set_home(skb, skb_pool);
+#endif
+	return skb;
+}
+
+
+/* the pool of the skbs allocated by pfq_alloc_skb, or NULL */
+
+static inline
+struct pfq_skb_pool * pfq_rx_skb_pool(void)
+{
+#ifdef PFQ_USE_SKB_POOL
+	struct pfq_percpu_pool *pool = this_cpu_ptr(percpu_pool);
+
+	if (likely(atomic_read(&pool->enable)))
+		return &pool->rx_pool;
+#endif
+	return NULL;
+}
+
+
+/* drop reason of a failed allocation from the given pool (Q_DROP_*) */
+
+static inline
+int pfq_skb_pool_drop_reason(struct pfq_skb_pool const *skb_pool)
+{
+	if (skb_pool && skb_pool->skbs && skb_pool->count == 0)
+		return Q_DROP_POOL_EMPTY;
+	return Q_DROP_NOMEM;
 }
 
 
@@ -249,7 +313,21 @@ void pfq_kfree_skb_pool(struct sk_buff *skb, struct pfq_skb_pool *skb_pool)
 {
 #ifdef PFQ_USE_SKB_POOL
 	if (likely(skb_pool)) {
-		bool ret = pfq_skb_pool_push(skb_pool, skb);
+
+		/* skbs allocated on a different CPU go back to their home pool */
+
+		struct pfq_skb_pool *home = pfq_skb_pool_home(skb);
+		bool ret;
+
+		if (home && home != skb_pool) {
+			if (pfq_skb_pool_push_return(home, skb))
+				sparse_inc(&memory_stats, pool_return);
+			else
+				sparse_inc(&memory_stats, err_return);
+			return;
+		}
+
+		ret = pfq_skb_pool_push(skb_pool, skb);
 		if (ret)
 			sparse_inc(&memory_stats, pool_push);
 		else
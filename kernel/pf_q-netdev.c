@@ -25,22 +25,102 @@
  *
  */
 
+#include <pragma/diagnostic_push>
+#include <linux/mutex.h>
+#include <pragma/diagnostic_pop>
+
 #include <pf_q-netdev.h>
 
+
+atomic_t pfq_txq_owner [Q_MAX_DEVICE][Q_MAX_HW_QUEUE];
+atomic_t pfq_txq_owned [Q_MAX_DEVICE];
+
+static DEFINE_MUTEX(txq_owner_lock);
+
+
 int dev_queue_get(struct net *net, struct net_device_cache const *default_dev, devq_id_t id,
-		  struct net_dev_queue *dq)
+		  int owner, struct net_dev_queue *dq)
 {
 	struct net_device *dev = __fast_dev_get_by_index(net, default_dev, PFQ_NETQ_IFINDEX(id));
+	int queue;
+
 	if (dev == NULL) {
 		dq->dev = NULL;
 		dq->queue = NULL;
 		dq->queue_mapping = 0;
+		dq->reserved = false;
 		return -1;
 	}
 
+	queue = __pfq_dev_cap_txqueue(dev, PFQ_NETQ_QUEUE(id));
+
+	dq->reserved = owner && pfq_txq_owner_of(dev, queue) == owner;
+	if (!dq->reserved)
+		queue = pfq_txq_shared(dev, queue, owner);
+
 	dq->dev = dev;
-	dq->queue_mapping = __pfq_dev_cap_txqueue(dev, PFQ_NETQ_QUEUE(id));
+	dq->queue_mapping = queue;
 	dq->queue = netdev_get_tx_queue(dev, dq->queue_mapping);
 	return 0;
 }
 
+
+/* return the given queue, or the next one not owned by others */
+
+int pfq_txq_shared(struct net_device *dev, int queue, int owner)
+{
+	int n, q;
+
+	for(n = 0, q = queue; n < dev->real_num_tx_queues; n++, q = (q + 1) % dev->real_num_tx_queues)
+	{
+		int o = pfq_txq_owner_of(dev, q);
+		if (o == 0 || o == owner)
+			return q;
+	}
+
+	return queue;
+}
+
+
+int pfq_txq_claim(struct net_device *dev, int queue, int owner)
+{
+	int err = 0;
+
+	if (dev->ifindex >= Q_MAX_DEVICE || queue < 0 ||
+	    queue >= Q_MAX_HW_QUEUE || queue >= dev->real_num_tx_queues)
+		return -EINVAL;
+
+	mutex_lock(&txq_owner_lock);
+
+	/* leave at least one shared queue to the rest of the world */
+
+	if (atomic_read(&pfq_txq_owned[dev->ifindex]) + 1 >= dev->real_num_tx_queues) {
+		err = -EBUSY;
+		goto out;
+	}
+
+	if (atomic_cmpxchg(&pfq_txq_owner[dev->ifindex][queue], 0, owner) != 0) {
+		err = -EBUSY;
+		goto out;
+	}
+
+	atomic_inc(&pfq_txq_owned[dev->ifindex]);
+out:
+	mutex_unlock(&txq_owner_lock);
+	return err;
+}
+
+
+void pfq_txq_release(struct net_device *dev, int queue, int owner)
+{
+	if (dev->ifindex >= Q_MAX_DEVICE || queue < 0 || queue >= Q_MAX_HW_QUEUE)
+		return;
+
+	mutex_lock(&txq_owner_lock);
+
+	if (atomic_cmpxchg(&pfq_txq_owner[dev->ifindex][queue], owner, 0) == owner)
+		atomic_dec(&pfq_txq_owned[dev->ifindex]);
+
+	mutex_unlock(&txq_owner_lock);
+}
+
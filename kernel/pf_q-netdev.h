@@ -31,8 +31,11 @@
 
 #include <pragma/diagnostic_push>
 #include <linux/netdevice.h>
+#include <linux/pf_q.h>
 #include <pragma/diagnostic_pop>
 
+#include <pf_q-define.h>
+
 
 typedef uint64_t devq_id_t;
 
@@ -41,6 +44,7 @@ struct net_dev_queue
 	struct net_device   *dev;
 	struct netdev_queue *queue;
 	u16		     queue_mapping;
+	bool		     reserved;		/* reserved: no other PFQ transmission uses it */
 
 };
 
@@ -115,6 +119,34 @@ void pfq_hard_tx_unlock(struct net_dev_queue *dq)
 }
 
 
+/* reserved hw Tx queues: a queue claimed by a PFQ Tx queue (sync or async)
+ * is not used by any other PFQ transmission, which is moved to a shared queue
+ * of the device, so that its HARD_TX_LOCK is not contended by PFQ. This is a
+ * reservation among PFQ sockets only: the stack is not steered and its packets
+ * may still use the queue, so the owner takes the lock as any other sender.
+ */
+
+extern atomic_t pfq_txq_owner [Q_MAX_DEVICE][Q_MAX_HW_QUEUE];
+extern atomic_t pfq_txq_owned [Q_MAX_DEVICE];
+
+#define PFQ_TXQ_OWNER(id, queue)	((int)(id) * (Q_MAX_TX_QUEUES + 1) + (queue) + 2)
+
+
+static inline
+int pfq_txq_owner_of(struct net_device *dev, int queue)
+{
+	if (likely(dev->ifindex >= Q_MAX_DEVICE || queue >= Q_MAX_HW_QUEUE ||
+		   atomic_read(&pfq_txq_owned[dev->ifindex]) == 0))
+		return 0;
+	return atomic_read(&pfq_txq_owner[dev->ifindex][queue]);
+}
+
+
+extern int  pfq_txq_claim(struct net_device *dev, int queue, int owner);
+extern void pfq_txq_release(struct net_device *dev, int queue, int owner);
+extern int  pfq_txq_shared(struct net_device *dev, int queue, int owner);
+
+
 static inline
 int dev_put_by_index(struct net *net, int ifindex)
 {
@@ -131,7 +163,7 @@ int dev_put_by_index(struct net *net, int ifindex)
 }
 
 
-extern int dev_queue_get(struct net *net, struct net_device_cache const *default_dev, devq_id_t id, struct net_dev_queue *dq);
+extern int dev_queue_get(struct net *net, struct net_device_cache const *default_dev, devq_id_t id, int owner, struct net_dev_queue *dq);
 
 
 #endif /* PF_Q_NETDEV_H */
@@ -44,7 +44,7 @@ void pfq_skb_pool_enable(bool value)
 
 int pfq_skb_pool_init_all(void)
 {
-	int cpu;
+	int cpu, high;
 	for_each_online_cpu(cpu)
 	{
 		struct pfq_percpu_pool *pool = per_cpu_ptr(percpu_pool, cpu);
@@ -52,9 +52,13 @@ int pfq_skb_pool_init_all(void)
 			return -ENOMEM;
 		if (pfq_skb_pool_init(&pool->rx_pool, skb_pool_size) != 0)
 			return -ENOMEM;
+
+		pool->rx_pool.tag = PFQ_SKB_POOL_TAG(cpu, 0);
+		pool->tx_pool.tag = PFQ_SKB_POOL_TAG(cpu, 1);
 	}
 
-	return 0;
+	high = skb_pool_high ? skb_pool_high : skb_pool_size;
+	return pfq_skb_pool_set_watermarks(-1, min(skb_pool_low, high), high);
 }
 
 
@@ -94,18 +98,38 @@ int pfq_skb_pool_init (struct pfq_skb_pool *pool, size_t size)
 {
 	if (size > 0) {
 		pool->skbs = kzalloc(sizeof(struct skb *) * size, GFP_KERNEL);
-		if (pool->skbs == NULL) {
+		pool->ret  = kzalloc(sizeof(struct skb *) * size, GFP_KERNEL);
+		if (pool->skbs == NULL || pool->ret == NULL) {
+			kfree(pool->skbs);
+			kfree(pool->ret);
+			pool->skbs = NULL;
+			pool->ret  = NULL;
 			printk(KERN_ERR "[PFQ] pfq_skb_pool_init: out of memory!\n");
 			return -ENOMEM;
 		}
 	}
 	else {
 		pool->skbs = NULL;
+		pool->ret  = NULL;
 	}
 
 	pool->size  = size;
 	pool->p_idx = 0;
 	pool->c_idx = 0;
+	pool->ret_p_idx = 0;
+	pool->ret_c_idx = 0;
+	pool->tag = 0;
+	pool->count = 0;
+	pool->low = 0;
+	pool->high = size;
+	pool->target = 0;
+	pool->len = 0;
+	pool->last_hit = 0;
+	pool->last_miss = 0;
+	pool->refill = 0;
+	pool->hit = 0;
+	pool->miss = 0;
+	pool->returned = 0;
 	return 0;
 }
 
@@ -116,16 +140,27 @@ pfq_skb_pool_flush(struct pfq_skb_pool *pool)
 	size_t n, total = 0;
 	for(n = 0; n < pool->size; n++)
 	{
+		struct sk_buff *skb;
+
 		if (pool->skbs[n]) {
 			total++;
 			sparse_inc(&memory_stats, os_free);
 			kfree_skb(pool->skbs[n]);
 			pool->skbs[n] = NULL;
 		}
+
+		skb = __atomic_exchange_n(&pool->ret[n], NULL, __ATOMIC_ACQUIRE);
+		if (skb) {
+			total++;
+			sparse_inc(&memory_stats, os_free);
+			kfree_skb(skb);
+		}
 	}
 
 	pool->p_idx = 0;
 	pool->c_idx = 0;
+	pool->count = 0;
+	pool->ret_c_idx = pool->ret_p_idx % (pool->size ? pool->size : 1);
 	return total;
 }
 
@@ -134,7 +169,9 @@ size_t pfq_skb_pool_free(struct pfq_skb_pool *pool)
 {
 	size_t total = pfq_skb_pool_flush(pool);
 	kfree(pool->skbs);
+	kfree(pool->ret);
 	pool->skbs = NULL;
+	pool->ret  = NULL;
 	pool->size = 0;
 	return total;
 }
@@ -152,10 +189,12 @@ pfq_get_skb_pool_stats(void)
 		sparse_read(&memory_stats, pool_free),
 		sparse_read(&memory_stats, pool_push),
 		sparse_read(&memory_stats, pool_pop),
+		sparse_read(&memory_stats, pool_return),
 
                 sparse_read(&memory_stats, err_norecyl),
                 sparse_read(&memory_stats, err_pop),
                 sparse_read(&memory_stats, err_push),
+                sparse_read(&memory_stats, err_return),
                 sparse_read(&memory_stats, err_intdis),
                 sparse_read(&memory_stats, err_shared),
                 sparse_read(&memory_stats, err_cloned),
@@ -164,3 +203,104 @@ pfq_get_skb_pool_stats(void)
 	return ret;
 }
 
+
+static void
+__pfq_skb_pool_set_watermarks(struct pfq_skb_pool *pool, size_t low, size_t high)
+{
+	pool->high = min(high, pool->size);
+	pool->low  = min(low, pool->high);
+}
+
+
+int pfq_skb_pool_set_watermarks(int cpu, size_t low, size_t high)
+{
+	if (low > high) {
+		printk(KERN_INFO "[PFQ] skb pool: low watermark (%zu) above high watermark (%zu)!\n", low, high);
+		return -EINVAL;
+	}
+
+	if (cpu < 0) {
+		for_each_online_cpu(cpu)
+		{
+			struct pfq_percpu_pool *pool = per_cpu_ptr(percpu_pool, cpu);
+			__pfq_skb_pool_set_watermarks(&pool->rx_pool, low, high);
+			__pfq_skb_pool_set_watermarks(&pool->tx_pool, low, high);
+		}
+	}
+	else {
+		struct pfq_percpu_pool *pool;
+
+		if (cpu >= nr_cpu_ids || !cpu_online(cpu)) {
+			printk(KERN_INFO "[PFQ] skb pool: cpu %d not online!\n", cpu);
+			return -EINVAL;
+		}
+
+		pool = per_cpu_ptr(percpu_pool, cpu);
+		__pfq_skb_pool_set_watermarks(&pool->rx_pool, low, high);
+		__pfq_skb_pool_set_watermarks(&pool->tx_pool, low, high);
+	}
+
+	return 0;
+}
+
+
+/* called by the owner CPU, out of the fast path (per-CPU timer):
+ * adapt the target of the pool to the recent misses and bring the
+ * number of skbs held toward it.
+ */
+
+void pfq_skb_pool_refill(struct pfq_skb_pool *pool, int node)
+{
+	unsigned long hit, miss;
+	size_t target, n;
+
+	if (unlikely(!pool->skbs))
+		return;
+
+	hit  = pool->hit  - pool->last_hit;
+	miss = pool->miss - pool->last_miss;
+
+	pool->last_hit  = pool->hit;
+	pool->last_miss = pool->miss;
+
+	target = pool->target;
+
+	if (miss)
+		target = max_t(size_t, target * 2, target + miss);
+	else if (!hit)
+		target = target / 2;
+
+	target = clamp_t(size_t, target, pool->low, pool->high);
+	pool->target = target;
+
+	/* shrink */
+
+	for(n = 0; pool->count > target && n < PFQ_SKB_POOL_REFILL; n++)
+	{
+		struct sk_buff *skb = pfq_skb_pool_pop(pool);
+		if (skb) {
+			sparse_inc(&memory_stats, os_free);
+			kfree_skb(skb);
+		}
+	}
+
+	/* grow: skbs are sized after the largest allocation served */
+
+	if (pool->len == 0)
+		return;
+
+	for(n = 0; pool->count < target && n < PFQ_SKB_POOL_REFILL; n++)
+	{
+		struct sk_buff *skb = __alloc_skb(pool->len + NET_SKB_PAD, GFP_ATOMIC | __GFP_NOWARN, 0, node);
+		if (unlikely(!skb))
+			break;
+
+		sparse_inc(&memory_stats, os_alloc);
+		pfq_skb_pool_set_home(skb, pool);
+
+		if (!pfq_skb_pool_push(pool, skb))
+			break;
+
+		pool->refill++;
+	}
+}
@@ -31,12 +31,52 @@
 #include <pf_q-global.h>
 #include <pf_q-stats.h>
 
+/* tag stored in the shared info of the skbs allocated from a pool:
+ * 0 means no pool, (cpu << 1 | tx) + 1 otherwise. */
+
+#define PFQ_SKB_POOL_TAG(cpu, tx)	((((unsigned long)(cpu) << 1) | (tx)) + 1)
+
+
+/* max number of skbs allocated (or released) by a pool refill */
+
+#define PFQ_SKB_POOL_REFILL		256
+
+
+/* per-CPU skb pool: a ring filled and drained by the owner CPU, and a
+ * return queue where the other CPUs put back the skbs allocated from this
+ * pool (multiple producers, the owner CPU is the only consumer).
+ *
+ * The number of skbs held in the ring is elastic: the target grows toward
+ * the high watermark while allocations miss the pool and shrinks toward the
+ * low watermark when the pool is idle. The refill runs in the per-CPU timer.
+ */
+
 struct pfq_skb_pool
 {
 	struct sk_buff ** skbs;
 	size_t size;
 	size_t p_idx;
 	size_t c_idx;
+
+	struct sk_buff ** ret;		/* return queue (same size) */
+	size_t ret_p_idx;		/* shared among the producers */
+	size_t ret_c_idx;
+
+	unsigned long tag;		/* tag of the skbs allocated from this pool */
+
+	size_t count;			/* skbs held in the ring */
+	size_t low;			/* watermarks (<= size) */
+	size_t high;
+	size_t target;
+	unsigned int len;		/* largest allocation served */
+
+	unsigned long last_hit;
+	unsigned long last_miss;
+	unsigned long refill;		/* skbs allocated by the refill */
+
+	unsigned long hit;		/* allocations served by the pool */
+	unsigned long miss;		/* allocations served by the slab allocator */
+	unsigned long returned;		/* skbs got back from the return queue */
 };
 
 
@@ -50,9 +90,59 @@ int	pfq_skb_pool_init (struct pfq_skb_pool *pool, size_t size);
 size_t	pfq_skb_pool_free (struct pfq_skb_pool *pool);
 size_t	pfq_skb_pool_flush(struct pfq_skb_pool *pool);
 
+void	pfq_skb_pool_refill(struct pfq_skb_pool *pool, int node);
+int	pfq_skb_pool_set_watermarks(int cpu, size_t low, size_t high);
+
+
+/* the home pool of an skb is recorded in the destructor_arg of its shared
+ * info, which is neither cleared by pfq_skb_recycle nor by __alloc_skb.
+ */
+
+static inline
+void pfq_skb_pool_set_home(struct sk_buff *skb, struct pfq_skb_pool *pool)
+{
+	skb_shinfo(skb)->destructor_arg = (void *)pool->tag;
+}
+
 struct  pfq_pool_stat pfq_get_skb_pool_stats(void);
 
 
+/* return queue: called by the owner CPU only */
+
+static inline
+struct sk_buff *pfq_skb_pool_pop_return(struct pfq_skb_pool *pool)
+{
+	struct sk_buff *skb = __atomic_exchange_n(&pool->ret[pool->ret_c_idx], NULL, __ATOMIC_ACQUIRE);
+	if (skb) {
+		if (++pool->ret_c_idx >= pool->size)
+			pool->ret_c_idx = 0;
+		pool->returned++;
+	}
+	return skb;
+}
+
+
+/* return queue: called by any CPU but the owner (lock-free). The skb is
+ * released if the slot is still busy (the queue is full). */
+
+static inline
+bool pfq_skb_pool_push_return(struct pfq_skb_pool *pool, struct sk_buff *skb)
+{
+	struct sk_buff *expected = NULL;
+	size_t idx;
+
+	if (likely(pool->ret)) {
+		idx = __atomic_fetch_add(&pool->ret_p_idx, 1, __ATOMIC_RELAXED) % pool->size;
+		if (__atomic_compare_exchange_n(&pool->ret[idx], &expected, skb, false,
+						__ATOMIC_RELEASE, __ATOMIC_RELAXED))
+			return true;
+	}
+
+	kfree_skb(skb);
+	return false;
+}
+
+
 static inline
 struct sk_buff *pfq_skb_pool_pop(struct pfq_skb_pool *pool)
 {
@@ -61,11 +151,17 @@ struct sk_buff *pfq_skb_pool_pop(struct pfq_skb_pool *pool)
 		struct sk_buff *skb = __atomic_load_n(&pool->skbs[pool->c_idx], __ATOMIC_RELAXED);
 		if (likely(skb)) {
 			__atomic_store_n(&pool->skbs[pool->c_idx], NULL, __ATOMIC_RELAXED);
+			pool->count--;
 		}
 
 		if (++pool->c_idx >= pool->size)
 			pool->c_idx = 0;
 
+		/* the local ring is empty: try the skbs returned by the other CPUs */
+
+		if (skb == NULL)
+			skb = pfq_skb_pool_pop_return(pool);
+
 		return skb;
 	}
 	return NULL;
@@ -76,11 +172,12 @@ static inline
 bool pfq_skb_pool_push(struct pfq_skb_pool *pool, struct sk_buff *nskb)
 {
 	bool ret = false;
-	if (likely(pool->skbs)) {
+	if (likely(pool->skbs && pool->count < pool->high)) {
 
 		struct sk_buff *skb = __atomic_load_n(&pool->skbs[pool->p_idx], __ATOMIC_RELAXED);
 		if (likely(!skb)) {
 			__atomic_store_n(&pool->skbs[pool->p_idx], nskb, __ATOMIC_RELAXED);
+			pool->count++;
 			ret = true;
 		}
 		else {
@@ -27,6 +27,8 @@
 #include <linux/module.h>
 #include <linux/proc_fs.h>
 #include <linux/seq_file.h>
+#include <linux/netdevice.h>
+#include <linux/uaccess.h>
 #include <linux/pf_q.h>
 
 #include <net/net_namespace.h>
@@ -55,6 +57,25 @@ static const char proc_computations[] = "computations";
 static const char proc_groups[]       = "groups";
 static const char proc_stats[]        = "stats";
 static const char proc_memory[]       = "memory";
+static const char proc_netq[]         = "netq";
+static const char proc_drops[]        = "drops";
+static const char proc_pool[]         = "pool";
+
+
+static const char *drop_reason_name[Q_DROP_MAX] =
+{
+	[Q_DROP_NO_SOCKET]  = "no socket",
+	[Q_DROP_GC_FULL]    = "GC full",
+	[Q_DROP_DEVMAP]     = "devmap",
+	[Q_DROP_BPF]        = "bpf filter",
+	[Q_DROP_VLAN]       = "vlan filter",
+	[Q_DROP_LANG]       = "computation",
+	[Q_DROP_QUEUE_FULL] = "queue full",
+	[Q_DROP_QUEUE_OFF]  = "queue off",
+	[Q_DROP_FWD_FULL]   = "fwd full",
+	[Q_DROP_NOMEM]      = "no memory",
+	[Q_DROP_POOL_EMPTY] = "pool empty",
+};
 
 
 static void
@@ -172,6 +193,7 @@ static int pfq_proc_memory(struct seq_file *m, void *v)
 {
 	long int push = sparse_read(&memory_stats, pool_push);
 	long int pop  = sparse_read(&memory_stats, pool_pop);
+	int cpu;
 
 	seq_printf(m, "OS:\n");
 	seq_printf(m, "  alloc          : %ld\n", sparse_read(&memory_stats, os_alloc));
@@ -181,18 +203,200 @@ static int pfq_proc_memory(struct seq_file *m, void *v)
 	seq_printf(m, "  free           : %ld\n", sparse_read(&memory_stats, pool_free));
 	seq_printf(m, "  push           : %ld\n", push);
 	seq_printf(m, "  pop            : %ld\n", pop);
+	seq_printf(m, "  return         : %ld\n", sparse_read(&memory_stats, pool_return));
 	seq_printf(m, "  size           : %ld\n", push - pop);
 	seq_printf(m, "ERROR:\n");
 	seq_printf(m, "  error norecyl  : %ld\n", sparse_read(&memory_stats, err_norecyl));
 	seq_printf(m, "  error pop      : %ld\n", sparse_read(&memory_stats, err_pop));
 	seq_printf(m, "  error push     : %ld\n", sparse_read(&memory_stats, err_push));
+	seq_printf(m, "  error return   : %ld\n", sparse_read(&memory_stats, err_return));
 	seq_printf(m, "  error intdisab : %ld\n", sparse_read(&memory_stats, err_intdis));
 	seq_printf(m, "  error shared   : %ld\n", sparse_read(&memory_stats, err_shared));
 	seq_printf(m, "  error cloned   : %ld\n", sparse_read(&memory_stats, err_cloned));
 	seq_printf(m, "  error memory   : %ld\n", sparse_read(&memory_stats, err_memory));
+	seq_printf(m, "PER-CPU:\n");
+	seq_printf(m, "  cpu   rx-hit      rx-miss     rx-ret      tx-hit      tx-miss     tx-ret\n");
+	for_each_online_cpu(cpu)
+	{
+		struct pfq_percpu_pool *pool = per_cpu_ptr(percpu_pool, cpu);
+		seq_printf(m, "  %-5d %-11lu %-11lu %-11lu %-11lu %-11lu %-11lu\n", cpu,
+			   pool->rx_pool.hit, pool->rx_pool.miss, pool->rx_pool.returned,
+			   pool->tx_pool.hit, pool->tx_pool.miss, pool->tx_pool.returned);
+	}
+	return 0;
+}
+
+static int pfq_proc_pool(struct seq_file *m, void *v)
+{
+	int cpu;
+
+	seq_printf(m, "cpu   pool  count    target   low      high     len      refill\n");
+	for_each_online_cpu(cpu)
+	{
+		struct pfq_percpu_pool *pool = per_cpu_ptr(percpu_pool, cpu);
+		seq_printf(m, "%-5d rx    %-8zu %-8zu %-8zu %-8zu %-8u %lu\n", cpu,
+			   pool->rx_pool.count, pool->rx_pool.target, pool->rx_pool.low,
+			   pool->rx_pool.high, pool->rx_pool.len, pool->rx_pool.refill);
+		seq_printf(m, "%-5d tx    %-8zu %-8zu %-8zu %-8zu %-8u %lu\n", cpu,
+			   pool->tx_pool.count, pool->tx_pool.target, pool->tx_pool.low,
+			   pool->tx_pool.high, pool->tx_pool.len, pool->tx_pool.refill);
+	}
+	return 0;
+}
+
+
+static void
+seq_printf_drops(struct seq_file *m, struct pfq_drop_counters __percpu *drops)
+{
+	int n;
+	for(n = 0; n < Q_DROP_MAX; n++)
+	{
+		if (drop_reason_name[n])
+			seq_printf(m, "%-11lu ", sparse_read(drops, reason[n]));
+	}
+	seq_printf(m, "\n");
+}
+
+
+static int pfq_proc_drops(struct seq_file *m, void *v)
+{
+	size_t n;
+
+	seq_printf(m, "       ");
+	for(n = 0; n < Q_DROP_MAX; n++)
+	{
+		if (drop_reason_name[n])
+			seq_printf(m, "%-11s ", drop_reason_name[n]);
+	}
+	seq_printf(m, "\n");
+
+	seq_printf(m, "total: ");
+	seq_printf_drops(m, &global_drops);
+
+	down(&group_sem);
+
+	for(n = 0; n < Q_MAX_GID; n++)
+	{
+		pfq_gid_t gid = (__force pfq_gid_t)n;
+
+		struct pfq_group *this_group = pfq_get_group(gid);
+		if (!this_group->policy)
+			continue;
+
+		seq_printf(m, "g%-4zu: ", n);
+		seq_printf_drops(m, this_group->drops);
+	}
+
+	up(&group_sem);
 	return 0;
 }
 
+
+static int pfq_proc_drops_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, pfq_proc_drops, PDE_DATA(inode));
+}
+
+
+static ssize_t
+pfq_proc_drops_reset(struct file *file, const char __user *buf, size_t length, loff_t *ppos)
+{
+	size_t n;
+
+	pfq_drop_counters_reset(&global_drops);
+
+	down(&group_sem);
+
+	for(n = 0; n < Q_MAX_GID; n++)
+	{
+		struct pfq_group *this_group = pfq_get_group((__force pfq_gid_t)n);
+		if (this_group->policy)
+			pfq_drop_counters_reset(this_group->drops);
+	}
+
+	up(&group_sem);
+	return (ssize_t)length;
+}
+
+
+static const struct file_operations pfq_proc_drops_fops = {
+	.owner   = THIS_MODULE,
+	.open    = pfq_proc_drops_open,
+	.read    = seq_read,
+	.write   = pfq_proc_drops_reset,
+	.llseek  = seq_lseek,
+	.release = single_release,
+};
+
+
+static int pfq_proc_netq(struct seq_file *m, void *v)
+{
+	int n, q, i;
+
+	seq_printf(m, "dev              queue recv         forward      drop\n");
+
+	rcu_read_lock_bh();
+
+	for(n = 0; n < Q_MAX_DEVICE; n++)
+	{
+		struct pfq_dev_stats *ds = rcu_dereference_bh(dev_stats[n]);
+		struct net_device *dev;
+
+		if (ds == NULL)
+			continue;
+
+		dev = dev_get_by_index_rcu(&init_net, n);
+		if (dev == NULL)
+			continue;
+
+		for(q = 0; q < ds->num_queues; q++)
+		{
+			long recv = 0, frwd = 0, drop = 0;
+
+			for_each_possible_cpu(i)
+			{
+				struct pfq_netq_stats *netq = per_cpu_ptr(ds->netq, i) + q;
+				recv += local_read(&netq->recv);
+				frwd += local_read(&netq->frwd);
+				drop += local_read(&netq->drop);
+			}
+
+			if (!recv && !frwd && !drop)
+				continue;
+
+			seq_printf(m, "%-16s %-5d %-12ld %-12ld %-12ld\n", dev->name, q, recv, frwd, drop);
+		}
+	}
+
+	rcu_read_unlock_bh();
+	return 0;
+}
+
+
+static int pfq_proc_netq_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, pfq_proc_netq, PDE_DATA(inode));
+}
+
+
+static ssize_t
+pfq_proc_netq_reset(struct file *file, const char __user *buf, size_t length, loff_t *ppos)
+{
+	pfq_dev_stats_reset_all();
+	return 1;
+}
+
+
+static const struct file_operations pfq_proc_netq_fops = {
+	.owner   = THIS_MODULE,
+	.open    = pfq_proc_netq_open,
+	.read    = seq_read,
+	.write   = pfq_proc_netq_reset,
+	.llseek  = seq_lseek,
+	.release = single_release,
+};
+
+
 static int pfq_proc_memory_open(struct inode *inode, struct file *file)
 {
 	return single_open(file, pfq_proc_memory, PDE_DATA(inode));
@@ -217,6 +421,48 @@ static const struct file_operations pfq_proc_memory_fops = {
 };
 
 
+static int pfq_proc_pool_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, pfq_proc_pool, PDE_DATA(inode));
+}
+
+/* "low high" sets the watermarks of every cpu, "cpu low high" those of a
+ * single cpu. */
+
+static ssize_t
+pfq_proc_pool_write(struct file *file, const char __user *buf, size_t length, loff_t *ppos)
+{
+	char tmp[64];
+	unsigned long low, high;
+	int cpu, err;
+
+	if (length >= sizeof(tmp))
+		return -EINVAL;
+	if (copy_from_user(tmp, buf, length))
+		return -EFAULT;
+	tmp[length] = '\0';
+
+	if (sscanf(tmp, "%d %lu %lu", &cpu, &low, &high) == 3)
+		err = pfq_skb_pool_set_watermarks(cpu, low, high);
+	else if (sscanf(tmp, "%lu %lu", &low, &high) == 2)
+		err = pfq_skb_pool_set_watermarks(-1, low, high);
+	else
+		err = -EINVAL;
+
+	return err < 0 ? err : length;
+}
+
+
+static const struct file_operations pfq_proc_pool_fops = {
+	.owner   = THIS_MODULE,
+	.open    = pfq_proc_pool_open,
+	.read    = seq_read,
+	.write   = pfq_proc_pool_write,
+	.llseek  = seq_lseek,
+	.release = single_release,
+};
+
+
 static int pfq_proc_groups_open(struct inode *inode, struct file *file)
 {
 	return single_open(file, pfq_proc_groups, PDE_DATA(inode));
@@ -278,6 +524,9 @@ int pfq_proc_init(void)
 	proc_create(proc_groups,	0644, pfq_proc_dir, &pfq_proc_groups_fops);
 	proc_create(proc_stats,		0644, pfq_proc_dir, &pfq_proc_stats_fops);
 	proc_create(proc_memory,	0644, pfq_proc_dir, &pfq_proc_memory_fops);
+	proc_create(proc_netq,		0644, pfq_proc_dir, &pfq_proc_netq_fops);
+	proc_create(proc_drops,		0644, pfq_proc_dir, &pfq_proc_drops_fops);
+	proc_create(proc_pool,		0644, pfq_proc_dir, &pfq_proc_pool_fops);
 
 	return 0;
 }
@@ -289,6 +538,9 @@ int pfq_proc_destruct(void)
 	remove_proc_entry(proc_groups,		pfq_proc_dir);
 	remove_proc_entry(proc_stats,		pfq_proc_dir);
 	remove_proc_entry(proc_memory,		pfq_proc_dir);
+	remove_proc_entry(proc_netq,		pfq_proc_dir);
+	remove_proc_entry(proc_drops,		pfq_proc_dir);
+	remove_proc_entry(proc_pool,		pfq_proc_dir);
 	remove_proc_entry("pfq", init_net.proc_net);
 
 	return 0;
@@ -53,18 +53,57 @@ void *pfq_skb_copy_from_linear_data(const struct sk_buff *skb, void *to, size_t
 }
 
 
+/* fast copy of a paged skb: the linear head first, then the page frags.
+ * The slot is bounded by len (<= skb->len), so the loop never needs the
+ * offset bookkeeping of skb_copy_bits. Returns -1 if a frag can't be
+ * addressed directly (highmem) or the skb carries a frag_list: the caller
+ * falls back to skb_copy_bits.
+ */
 
-size_t pfq_sk_rx_queue_recv(struct pfq_sock_opt *opt,
+static inline
+int pfq_skb_copy_paged_data(const struct sk_buff *skb, char *to, size_t len)
+{
+	const struct skb_shared_info *shinfo = skb_shinfo(skb);
+	size_t n = min_t(size_t, skb_headlen(skb), len);
+	int i;
+
+	if (unlikely(skb_has_frag_list(skb)))
+		return -1;
+
+	memcpy(to, skb->data, n);
+	to += n; len -= n;
+
+	for(i = 0; len && i < shinfo->nr_frags; i++)
+	{
+		const skb_frag_t *frag = &shinfo->frags[i];
+		const void *vaddr = skb_frag_address_safe(frag);
+
+		if (unlikely(vaddr == NULL))
+			return -1;
+
+		n = min_t(size_t, skb_frag_size(frag), len);
+		memcpy(to, vaddr, n);
+		to += n; len -= n;
+	}
+
+	return len == 0 ? 0 : -1;
+}
+
+
+
+size_t pfq_sk_rx_queue_recv(struct pfq_sock *so,
 			    struct pfq_skbuff_GC_queue *skbs,
 			    unsigned long long mask,
 			    int burst_len,
-			    pfq_gid_t gid)
+			    pfq_gid_t gid,
+			    int cpu)
 {
+	struct pfq_sock_opt *opt = &so->opt;
 	struct pfq_rx_queue *rx_queue = pfq_get_rx_queue(opt);
 	struct pfq_pkthdr *hdr;
 	int data, qlen, qindex;
 	struct sk_buff __GC *skb;
-	size_t n, sent = 0;
+	size_t n, sent = 0, paged = 0;
 
 	if (unlikely(rx_queue == NULL))
 		return 0;
@@ -96,7 +135,7 @@ size_t pfq_sk_rx_queue_recv(struct pfq_sock_opt *opt,
 				wake_up_interruptible(&opt->waitqueue);
 			}
 
-			return sent;
+			break;
 		}
 
 		/* copy bytes of packet */
@@ -107,11 +146,13 @@ size_t pfq_sk_rx_queue_recv(struct pfq_sock_opt *opt,
 		if (skb_is_nonlinear(PFQ_SKB(skb)))
 #endif
 		{
-			if (skb_copy_bits(PFQ_SKB(skb), 0, pkt, bytes) != 0) {
+			if (pfq_skb_copy_paged_data(PFQ_SKB(skb), pkt, bytes) != 0 &&
+			    skb_copy_bits(PFQ_SKB(skb), 0, pkt, bytes) != 0) {
 				printk(KERN_WARNING "[PFQ] BUG! skb_copy_bits failed (bytes=%zu, skb_len=%d mac_len=%d)!\n",
 				       bytes, skb->len, skb->mac_len);
 				return 0;
 			}
+			paged++;
 		}
 		else {
 			pfq_skb_copy_from_linear_data(PFQ_SKB(skb), pkt, bytes);
@@ -135,7 +176,7 @@ size_t pfq_sk_rx_queue_recv(struct pfq_sock_opt *opt,
 		hdr->gid      = (__force int)gid;
 		hdr->len      = (uint16_t)skb->len;
 		hdr->caplen   = (uint16_t)bytes;
-		hdr->vlan.tci = skb->vlan_tci & ~VLAN_TAG_PRESENT;
+		hdr->vlan.tci = PFQ_CB(skb)->vlan_tci & ~VLAN_TAG_PRESENT;
 		hdr->queue    = skb_rx_queue_recorded(PFQ_SKB(skb)) ? (uint8_t)(skb_get_rx_queue(PFQ_SKB(skb)) & 0xff) : 0;
 
 		/* commit the slot (release semantic) */
@@ -155,6 +196,9 @@ size_t pfq_sk_rx_queue_recv(struct pfq_sock_opt *opt,
 		hdr = Q_NEXT_PKTHDR(hdr, opt->rx_slot_size);
 	}
 
+	__sparse_add(so->stats, lcpy, sent - paged, cpu);
+	__sparse_add(so->stats, pcpy, paged, cpu);
+
 	return sent;
 }
 
@@ -37,6 +37,17 @@
 #include <pf_q-memory.h>
 #include <pf_q-shared-queue.h>
 #include <pf_q-shmem.h>
+#include <pf_q-transmit.h>
+
+
+static void
+pfq_shared_queue_zc_disable(struct pfq_sock *so, unsigned long deadline)
+{
+	int n;
+
+	for(n = -1; n < Q_MAX_TX_QUEUES; n++)
+		pfq_tx_zc_disable(so, pfq_get_tx_queue_info(&so->opt, n), deadline);
+}
 
 
 int
@@ -85,32 +96,75 @@ pfq_shared_queue_enable(struct pfq_sock *so, unsigned long user_addr)
 
 		/* initialize TX queues */
 
-		mapped_queue->tx.size  = pfq_spsc_queue_mem(so)/2;
+		mapped_queue->tx.size  = pfq_spsc_queue_mem(so);
 
-		mapped_queue->tx.prod.index = 0;
-		mapped_queue->tx.prod.off0  = 0;
-		mapped_queue->tx.prod.off1  = 0;
-		mapped_queue->tx.cons.index = 0;
-		mapped_queue->tx.cons.off   = 0;
+		mapped_queue->tx.prod.pos   = 0;
+		mapped_queue->tx.cons.pos   = 0;
+		mapped_queue->tx.cons.sleeping = 0;
+		mapped_queue->tx.completion = 0;
 
 		so->opt.txq.base_addr = so->shmem.addr + sizeof(struct pfq_shared_queue) + pfq_mpsc_queue_mem(so);
+		so->opt.txq.tstamp_id = 0;
 
 
 		/* initialize TX async queues */
 
 		for(n = 0; n < Q_MAX_TX_QUEUES; n++)
 		{
-			mapped_queue->tx_async[n].size  = pfq_spsc_queue_mem(so)/2;
+			mapped_queue->tx_async[n].size  = pfq_spsc_queue_mem(so);
+
+			mapped_queue->tx_async[n].prod.pos   = 0;
+			mapped_queue->tx_async[n].cons.pos   = 0;
+			mapped_queue->tx_async[n].cons.sleeping = 0;
+			mapped_queue->tx_async[n].completion = 0;
 
-			mapped_queue->tx_async[n].prod.index = 0;
-			mapped_queue->tx_async[n].prod.off0  = 0;
-			mapped_queue->tx_async[n].prod.off1  = 0;
-			mapped_queue->tx_async[n].cons.index = 0;
-			mapped_queue->tx_async[n].cons.off   = 0;
+			so->opt.txq_async[n].tstamp_id = 0;
 
-			so->opt.txq_async[n].base_addr = so->shmem.addr + sizeof(struct pfq_shared_queue)
+			/* only the negotiated queues have memory */
+
+			so->opt.txq_async[n].base_addr = n < so->opt.tx_max_async_queues ?
+				so->shmem.addr + sizeof(struct pfq_shared_queue)
 				+ pfq_mpsc_queue_mem(so)
-				+ pfq_spsc_queue_mem(so) * (1 + n);
+				+ pfq_spsc_queue_mem(so) * (1 + n) : NULL;
+		}
+
+		/* zero-copy Tx: the completion rings of the negotiated queues follow the Tx memory */
+
+		if (so->opt.tx_zerocopy) {
+
+			size_t off = sizeof(struct pfq_shared_queue) + pfq_mpsc_queue_mem(so)
+				   + pfq_spsc_queue_mem(so) * (1 + so->opt.tx_max_async_queues);
+
+			for(i = -1; i < (int)so->opt.tx_max_async_queues; i++, off += sizeof(struct pfq_tx_completion_ring))
+			{
+				struct pfq_tx_queue *txm = i == -1 ? &mapped_queue->tx : &mapped_queue->tx_async[i];
+				struct pfq_tx_completion_ring *ring = (struct pfq_tx_completion_ring *)(so->shmem.addr + off);
+
+				memset(ring, 0, sizeof(*ring));
+				txm->completion = off;
+
+				if (pfq_tx_zc_enable(pfq_get_tx_queue_info(&so->opt, i), txm, ring, numa_node_id()) < 0) {
+					printk(KERN_INFO "[PFQ|%d] Tx zerocopy: out of memory!\n", so->id);
+					pfq_shared_queue_zc_disable(so, jiffies);
+					pfq_shared_memory_free(&so->shmem);
+					return -ENOMEM;
+				}
+			}
+		}
+
+		/* the Tx timestamps ring follows, if enabled */
+
+		mapped_queue->tx_tstamp = 0;
+
+		if (so->opt.tx_tstamp) {
+
+			size_t off = sizeof(struct pfq_shared_queue) + pfq_mpsc_queue_mem(so)
+				   + pfq_spsc_queue_mem(so) * (1 + so->opt.tx_max_async_queues)
+				   + pfq_tx_completion_mem(so);
+
+			so->opt.tx_tstamp_ring = (struct pfq_tx_tstamp_ring *)(so->shmem.addr + off);
+			memset(so->opt.tx_tstamp_ring, 0, sizeof(struct pfq_tx_tstamp_ring));
+			mapped_queue->tx_tstamp = off;
 		}
 
 		/* commit queues */
@@ -120,7 +174,7 @@ pfq_shared_queue_enable(struct pfq_sock *so, unsigned long user_addr)
 		atomic_long_set(&so->opt.rxq.addr, (long)&mapped_queue->rx);
 		atomic_long_set(&so->opt.txq.addr, (long)&mapped_queue->tx);
 
-		for(n = 0; n < Q_MAX_TX_QUEUES; n++)
+		for(n = 0; n < so->opt.tx_max_async_queues; n++)
 		{
 			atomic_long_set(&so->opt.txq_async[n].addr, (long)&mapped_queue->tx_async[n]);
 		}
@@ -139,12 +193,12 @@ pfq_shared_queue_enable(struct pfq_sock *so, unsigned long user_addr)
 			 xmit_slot_size,
 			 pfq_spsc_queue_mem(so));
 
-		pr_devel("[PFQ|%d] Tx async queues: len=%zu slot_size=%zu maxlen=%d, mem=%zu bytes (%d queues)\n",
+		pr_devel("[PFQ|%d] Tx async queues: len=%zu slot_size=%zu maxlen=%d, mem=%zu bytes (%zu queues)\n",
 			 so->id,
 			 so->opt.tx_queue_len,
 			 so->opt.tx_slot_size,
 			 xmit_slot_size,
-			 pfq_spsc_queue_mem(so) * Q_MAX_TX_QUEUES, Q_MAX_TX_QUEUES);
+			 pfq_spsc_queue_mem(so) * so->opt.tx_max_async_queues, so->opt.tx_max_async_queues);
 	}
 
 	return 0;
@@ -167,6 +221,12 @@ pfq_shared_queue_disable(struct pfq_sock *so)
 
 		msleep(Q_GRACE_PERIOD);
 
+		so->opt.tx_tstamp_ring = NULL;
+
+		/* zero-copy skbs still in flight refer to the Tx memory */
+
+		pfq_shared_queue_zc_disable(so, jiffies + msecs_to_jiffies(Q_TX_ZEROCOPY_TIMEOUT));
+
 		pfq_shared_memory_free(&so->shmem);
 
 		so->shmem.addr = NULL;
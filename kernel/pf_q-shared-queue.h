@@ -55,6 +55,20 @@ static inline size_t pfq_spsc_queue_mem(struct pfq_sock *so)
         return so->opt.tx_queue_len * so->opt.tx_slot_size * 2;
 }
 
+/* completion rings of the Tx queues, only with zero-copy Tx */
+
+static inline size_t pfq_tx_completion_mem(struct pfq_sock *so)
+{
+	return so->opt.tx_zerocopy ? sizeof(struct pfq_tx_completion_ring) * (1 + so->opt.tx_max_async_queues) : 0;
+}
+
+/* Tx timestamps ring, only with Tx timestamps */
+
+static inline size_t pfq_tx_tstamp_mem(struct pfq_sock *so)
+{
+	return so->opt.tx_tstamp ? sizeof(struct pfq_tx_tstamp_ring) : 0;
+}
+
 
 static inline
 size_t pfq_mpsc_queue_len(struct pfq_sock *p)
@@ -92,15 +92,59 @@ pfq_mmap(struct file *file, struct socket *sock, struct vm_area_struct *vma)
 }
 
 
+/* true if the pages are physically contiguous and in the kernel linear
+ * mapping (e.g. a single 1GB hugepage, or adjacent 2MB ones).
+ */
+
+static bool
+pfq_pages_contiguous(struct page **pages, size_t npages)
+{
+	unsigned long pfn = page_to_pfn(pages[0]);
+	size_t n;
+
+	if (PageHighMem(pages[0]))
+		return false;
+
+	for(n = 1; n < npages; n++)
+	{
+		if (page_to_pfn(pages[n]) != pfn + n)
+			return false;
+	}
+
+	return true;
+}
+
+
+static void
+pfq_user_pages_release(struct page **pages, size_t npages)
+{
+	size_t i;
+
+	for(i = 0; i < npages; i++)
+	{
+		if (!PageReserved(pages[i]))
+		    SetPageDirty(pages[i]);
+
+		page_cache_release(pages[i]);
+	}
+}
+
+
 int
 pfq_hugepage_map(struct pfq_shmem_descr *shmem, unsigned long addr, size_t size)
 {
+	struct page *head;
 	int nid;
 
 	printk(KERN_INFO "[PFQ] mapping user memory (HugePages): %zu bytes...\n", size);
 
 	shmem->npages = PAGE_ALIGN(size) / PAGE_SIZE;
 	shmem->hugepages = vmalloc(shmem->npages * sizeof(struct page *));
+	if (!shmem->hugepages) {
+		printk(KERN_WARNING "[PFQ] error: out of memory (%zu user pages)!\n", shmem->npages);
+		shmem->npages = 0;
+		return -ENOMEM;
+	}
 
 	if ((size_t)get_user_pages_fast(addr, shmem->npages, 1, shmem->hugepages) != shmem->npages) {
 		vfree(shmem->hugepages);
@@ -110,10 +154,30 @@ pfq_hugepage_map(struct pfq_shmem_descr *shmem, unsigned long addr, size_t size)
 		return -EPERM;
 	}
 
-	nid = page_to_nid(shmem->hugepages[0]);
+	/* the page size actually backing the user memory (2MB, 1GB...) */
+
+	head = compound_head(shmem->hugepages[0]);
+	shmem->page_size = PageCompound(head) ? (PAGE_SIZE << compound_order(head)) : PAGE_SIZE;
+
+	/* physically contiguous memory is accessed through the linear mapping,
+	 * which the kernel maps with large pages, rather than through 4K
+	 * vm_map_ram ptes */
+
+	if (pfq_pages_contiguous(shmem->hugepages, shmem->npages)) {
+		shmem->addr = page_address(shmem->hugepages[0]);
+		shmem->vmapped = false;
+	}
+	else {
+		nid = page_to_nid(shmem->hugepages[0]);
+		shmem->addr = vm_map_ram(shmem->hugepages, shmem->npages, nid, PAGE_KERNEL);
+		shmem->vmapped = true;
+	}
 
-	shmem->addr = vm_map_ram(shmem->hugepages, shmem->npages, nid, PAGE_KERNEL);
 	if (!shmem->addr) {
+		pfq_user_pages_release(shmem->hugepages, shmem->npages);
+		vfree(shmem->hugepages);
+		shmem->npages = 0;
+		shmem->hugepages = NULL;
 		printk(KERN_INFO "[PFQ] mapping memory failure.\n");
 		return -EPERM;
 	}
@@ -121,7 +185,8 @@ pfq_hugepage_map(struct pfq_shmem_descr *shmem, unsigned long addr, size_t size)
 	shmem->kind = pfq_shmem_user;
         shmem->size = size;
 
-	pr_devel("[PFQ] total mapped memory: %zu bytes.\n", size);
+	printk(KERN_INFO "[PFQ] mapped %zu bytes (page size %zu kB, %s).\n", size, shmem->page_size >> 10,
+	       shmem->vmapped ? "vmapped" : "contiguous");
 	return 0;
 }
 
@@ -129,18 +194,13 @@ pfq_hugepage_map(struct pfq_shmem_descr *shmem, unsigned long addr, size_t size)
 int
 pfq_hugepage_unmap(struct pfq_shmem_descr *shmem)
 {
-	size_t i;
+	if (shmem->vmapped)
+		vm_unmap_ram(shmem->addr, shmem->npages);
 
 	if (current->mm)
 		down_read(&current->mm->mmap_sem);
 
-	for(i = 0; i < shmem->npages; i++)
-	{
-		if (!PageReserved(shmem->hugepages[i]))
-		    SetPageDirty(shmem->hugepages[i]);
-
-		page_cache_release(shmem->hugepages[i]);
-	}
+	pfq_user_pages_release(shmem->hugepages, shmem->npages);
 
 	if (current->mm)
 		up_read(&current->mm->mmap_sem);
@@ -149,6 +209,8 @@ pfq_hugepage_unmap(struct pfq_shmem_descr *shmem)
 
 	shmem->hugepages = NULL;
 	shmem->npages = 0;
+	shmem->page_size = 0;
+	shmem->vmapped = false;
 
 	return 0;
 }
@@ -164,6 +226,7 @@ pfq_shared_memory_alloc(struct pfq_shmem_descr *shmem, size_t mem_size)
         shmem->addr = vmalloc_user(tot_mem);
         shmem->size = tot_mem;
 	shmem->kind = pfq_shmem_virt;
+	shmem->page_size = PAGE_SIZE;
 
 	if (shmem->addr == NULL) {
 		printk(KERN_WARNING "[PFQ] shmem: out of memory (vmalloc %zu bytes)!", tot_mem);
@@ -188,6 +251,7 @@ pfq_shared_memory_free(struct pfq_shmem_descr *shmem)
 
 		shmem->addr = NULL;
 		shmem->size = 0;
+		shmem->page_size = 0;
 
 		pr_devel("[PFQ] shared memory freed.\n");
 	}
@@ -196,18 +260,18 @@ pfq_shared_memory_free(struct pfq_shmem_descr *shmem)
 
 size_t pfq_total_queue_mem(struct pfq_sock *so)
 {
-        return sizeof(struct pfq_shared_queue) + pfq_mpsc_queue_mem(so) + pfq_spsc_queue_mem(so) * (1 + Q_MAX_TX_QUEUES);
+        return sizeof(struct pfq_shared_queue) + pfq_mpsc_queue_mem(so) + pfq_spsc_queue_mem(so) * (1 + so->opt.tx_max_async_queues)
+		+ pfq_tx_completion_mem(so) + pfq_tx_tstamp_mem(so);
 }
 
 
 
-#define HUGEPAGE_SIZE  (2*1024*1024)
+/* exact (page aligned) size of the shared memory: user space rounds it up
+ * to the size of the hugepages it maps. */
 
 size_t pfq_shared_memory_size(struct pfq_sock *so)
 {
-	size_t tot_mem = pfq_total_queue_mem(so);
-
-	return (1 + tot_mem/HUGEPAGE_SIZE) * HUGEPAGE_SIZE;
+	return PAGE_ALIGN(pfq_total_queue_mem(so));
 }
 
 
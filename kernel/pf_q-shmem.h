@@ -46,6 +46,8 @@ struct pfq_shmem_descr
 
 	struct page**		hugepages;
 	size_t			npages;
+	size_t			page_size;	/* size of the pages backing the memory */
+	bool			vmapped;	/* mapped with vm_map_ram */
 };
 
 
@@ -62,4 +64,16 @@ int pfq_hugepage_map(struct pfq_shmem_descr *shmem, unsigned long addr, size_t s
 int pfq_hugepage_unmap(struct pfq_shmem_descr *shmem);
 
 
+/* page backing an address of the shared memory: user memory may be
+ * accessed through the linear mapping (contiguous), not vmalloc'd */
+
+static inline
+struct page *pfq_shared_memory_page(struct pfq_shmem_descr *shmem, void *addr)
+{
+	if (shmem->kind == pfq_shmem_user)
+		return shmem->hugepages[((char *)addr - (char *)shmem->addr) >> PAGE_SHIFT];
+	return vmalloc_to_page(addr);
+}
+
+
 #endif /* PF_Q_SHMEM_H */
@@ -49,6 +49,9 @@ struct pfq_cb
 	struct pfq_lang_monad *monad;
         unsigned long	  group_mask;
         uint32_t	  state;
+	uint16_t	  vlan_tci;	/* parsed 802.1q tci (VLAN_TAG_PRESENT if tagged) */
+	__be16		  l3_proto;	/* ethertype of the layer 3 (past a sw 802.1q tag) */
+	uint16_t	  l3_off;	/* offset of the layer 3 header */
 	bool		  direct;
 };
 
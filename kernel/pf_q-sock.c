@@ -27,6 +27,12 @@
 #include <linux/module.h>
 #include <linux/version.h>
 #include <linux/types.h>
+#include <linux/math64.h>
+#include <linux/mm.h>
+#include <linux/vmalloc.h>
+#include <linux/slab.h>
+#include <linux/delay.h>
+#include <linux/swab.h>
 #include <pragma/diagnostic_pop>
 
 #include <pf_q-thread.h>
@@ -136,7 +142,11 @@ void pfq_sock_opt_init(struct pfq_sock_opt *that, size_t caplen, size_t maxlen)
 
         that->tx_queue_len  = 0;
         that->tx_slot_size  = Q_QUEUE_SLOT_SIZE(maxlen);
+	that->tx_zerocopy   = 0;
+	that->tx_tstamp     = 0;
+	that->tx_tstamp_ring = NULL;
 	that->tx_num_async_queues = 0;
+	that->tx_max_async_queues = Q_DEF_TX_QUEUES;
 
 	/* Tx async queues setup */
 
@@ -166,8 +176,19 @@ int pfq_sock_init(struct pfq_sock *so, int id)
 		local_set(&stat->drop, 0);
 		local_set(&stat->sent, 0);
 		local_set(&stat->disc, 0);
+		local_set(&stat->lcpy, 0);
+		local_set(&stat->pcpy, 0);
 	}
 
+	so->drops = alloc_percpu(struct pfq_drop_counters);
+	if (!so->drops) {
+		free_percpu(so->stats);
+		so->stats = NULL;
+		return -ENOMEM;
+	}
+
+	pfq_drop_counters_reset(so->drops);
+
 	/* setup id */
 
 	so->id = id;
@@ -187,6 +208,8 @@ int pfq_sock_init(struct pfq_sock *so, int id)
         so->shmem.kind = 0;
         so->shmem.hugepages = NULL;
         so->shmem.npages = 0;
+        so->shmem.page_size = 0;
+        so->shmem.vmapped = false;
 
         return 0;
 }
@@ -199,6 +222,9 @@ void pfq_sock_destruct(struct sock *sk)
 	free_percpu(so->stats);
         so->stats = NULL;
 
+	free_percpu(so->drops);
+        so->drops = NULL;
+
         skb_queue_purge(&sk->sk_error_queue);
 
         WARN_ON(atomic_read(&sk->sk_rmem_alloc));
@@ -208,14 +234,53 @@ void pfq_sock_destruct(struct sock *sk)
 }
 
 
+/* reserve (among PFQ sockets) the default hw queue of the
+ * given Tx queue (-1 = sync queue)
+ */
+
+int
+pfq_sock_tx_claim(struct pfq_sock *so, int index)
+{
+	struct pfq_tx_info *info = pfq_get_tx_queue_info(&so->opt, index);
+	int err;
+
+	if (info->def_dev == NULL || info->def_queue < 0) {
+		printk(KERN_INFO "[PFQ|%d] Tx[%d] reserved bind: explicit device and hw queue required!\n", so->id, index);
+		return -EINVAL;
+	}
+
+	err = pfq_txq_claim(info->def_dev, info->def_queue, PFQ_TXQ_OWNER(so->id, index));
+	if (err < 0) {
+		printk(KERN_INFO "[PFQ|%d] Tx[%d] reserved bind: %s hw queue %d not available (%d)!\n",
+		       so->id, index, info->def_dev->name, info->def_queue, err);
+		return err;
+	}
+
+	info->reserved = true;
+	return 0;
+}
+
+
+void
+pfq_sock_tx_release(struct pfq_sock *so, int index)
+{
+	struct pfq_tx_info *info = pfq_get_tx_queue_info(&so->opt, index);
+
+	if (info->reserved && info->def_dev)
+		pfq_txq_release(info->def_dev, info->def_queue, PFQ_TXQ_OWNER(so->id, index));
+
+	info->reserved = false;
+}
+
+
 int
 pfq_sock_tx_bind(struct pfq_sock *so, int tid, int ifindex, int qindex, struct
-		 net_device *dev)
+		 net_device *dev, bool reserved)
 {
 	size_t queue = so->opt.tx_num_async_queues;
 	int err = 0;
 
-	if (queue >= Q_MAX_TX_QUEUES) {
+	if (queue >= so->opt.tx_max_async_queues) {
 		printk(KERN_INFO "[PFQ|%d] could not bind Tx[%d] thread to queue %zu (out of range)!\n", so->id, tid, queue);
 		return -EPERM;
 	}
@@ -223,20 +288,27 @@ pfq_sock_tx_bind(struct pfq_sock *so, int tid, int ifindex, int qindex, struct
 	so->opt.txq_async[queue].def_ifindex = ifindex;
 	so->opt.txq_async[queue].def_queue = qindex;
 	so->opt.txq_async[queue].def_dev = dev;
+
+	if (reserved && (err = pfq_sock_tx_claim(so, (int)queue)) < 0)
+		goto err;
+
 	so->opt.tx_num_async_queues++;
 
 	smp_wmb();
 
 	if ((err = pfq_bind_tx_thread(tid, so, queue)) < 0)
 	{
-		so->opt.txq_async[queue].def_ifindex = -1;
-		so->opt.txq_async[queue].def_queue = -1;
-		so->opt.txq_async[queue].def_dev = NULL;
 		so->opt.tx_num_async_queues--;
-		return err;
+		pfq_sock_tx_release(so, (int)queue);
+		goto err;
 	}
 
 	return 0;
+err:
+	so->opt.txq_async[queue].def_ifindex = -1;
+	so->opt.txq_async[queue].def_queue = -1;
+	so->opt.txq_async[queue].def_dev = NULL;
+	return err;
 }
 
 
@@ -247,6 +319,8 @@ pfq_sock_tx_unbind(struct pfq_sock *so)
 
 	/* unbind sync Tx queue */
 
+	pfq_sock_tx_release(so, -1);
+
 	if (so->opt.txq.def_ifindex != -1) {
 		dev_put_by_index(sock_net(&so->sk), so->opt.txq.def_ifindex);
 	}
@@ -255,21 +329,245 @@ pfq_sock_tx_unbind(struct pfq_sock *so)
 	so->opt.txq.def_queue = -1;
 	so->opt.txq.def_dev = NULL;
 
-	/* unbind async Tx queue */
+	/* unbind async Tx queue (interrupting the replays in progress) */
+
+	for(n = 0; n < Q_MAX_TX_QUEUES; ++n)
+	{
+		struct pfq_tx_replay_state *st;
+		st = (struct pfq_tx_replay_state *)atomic_long_read(&so->opt.txq_async[n].replay);
+		if (st)
+			atomic_set(&st->stop, -1);
+	}
 
 	if (pfq_unbind_tx_thread(so) < 0)
 		return -EPERM;
 
 	for(n = 0; n < Q_MAX_TX_QUEUES; ++n)
 	{
+		struct pfq_tx_replay_state *st;
+
+		/* the Tx thread is gone: release the replay, if any */
+
+		st = (struct pfq_tx_replay_state *)atomic_long_xchg(&so->opt.txq_async[n].replay, 0);
+		if (st) {
+			synchronize_rcu();
+			pfq_tx_replay_free(st);
+		}
+
+		pfq_sock_tx_release(so, (int)n);
+
 		if (so->opt.txq_async[n].def_ifindex != -1)
 			dev_put_by_index(sock_net(&so->sk), so->opt.txq_async[n].def_ifindex);
 
 		so->opt.txq_async[n].def_ifindex = -1;
 		so->opt.txq_async[n].def_queue = -1;
 		so->opt.txq_async[n].def_dev = NULL;
+
+		pfq_tx_pacer_set(&so->opt.txq_async[n].pacer, 0, 0, 1);
 	}
 
 	return 0;
 }
 
+
+void
+pfq_tx_replay_free(struct pfq_tx_replay_state *st)
+{
+	size_t n;
+
+	if (st->vaddr)
+		vunmap(st->vaddr);
+
+	if (st->pages) {
+		for(n = 0; n < st->npages; n++)
+		{
+			if (st->pages[n])
+				put_page(st->pages[n]);
+		}
+		vfree(st->pages);
+	}
+
+	kfree(st);
+}
+
+
+void
+pfq_sock_tx_replay_stop(struct pfq_sock *so, int index)
+{
+	struct pfq_tx_info *info = &so->opt.txq_async[index];
+	struct pfq_tx_replay_state *st;
+
+	st = (struct pfq_tx_replay_state *)atomic_long_xchg(&info->replay, 0);
+	if (st == NULL)
+		return;
+
+	/* interrupt the Tx thread (possibly waiting for a timestamp)... */
+
+	atomic_set(&st->stop, -1);
+
+	if (info->task)
+		wake_up_process(info->task);
+
+	/* ...and wait for it to leave the replay, and for the readers of the stats */
+
+	msleep(Q_GRACE_PERIOD);
+	synchronize_rcu();
+
+	pfq_tx_replay_free(st);
+}
+
+
+int
+pfq_sock_tx_replay(struct pfq_sock *so, struct pfq_tx_replay const *replay)
+{
+	struct pfq_tx_info *info;
+	struct pfq_tx_replay_state *st;
+	unsigned long start;
+	uint32_t magic;
+	int pinned, err;
+
+	if (replay->queue < 0 || replay->queue >= (int)so->opt.tx_num_async_queues) {
+		printk(KERN_INFO "[PFQ|%d] Tx replay: bad async queue %d!\n", so->id, replay->queue);
+		return -EINVAL;
+	}
+
+	info = &so->opt.txq_async[replay->queue];
+
+	pfq_sock_tx_replay_stop(so, replay->queue);
+
+	if (replay->addr == NULL)
+		return 0;
+
+	if (info->def_dev == NULL) {
+		printk(KERN_INFO "[PFQ|%d] Tx replay: async queue %d not bound to a device!\n", so->id, replay->queue);
+		return -EPERM;
+	}
+
+	if (replay->len < Q_PCAP_HDR_LEN) {
+		printk(KERN_INFO "[PFQ|%d] Tx replay: pcap file too short!\n", so->id);
+		return -EINVAL;
+	}
+
+	st = kzalloc(sizeof(*st), GFP_KERNEL);
+	if (st == NULL)
+		return -ENOMEM;
+
+	/* pin the pages of the pcap file and map them in the kernel */
+
+	start = (unsigned long)replay->addr & PAGE_MASK;
+	st->npages = (PAGE_ALIGN((unsigned long)replay->addr + replay->len) - start) >> PAGE_SHIFT;
+
+	st->pages = vzalloc(st->npages * sizeof(struct page *));
+	if (st->pages == NULL) {
+		err = -ENOMEM;
+		goto err;
+	}
+
+	pinned = get_user_pages_fast(start, (int)st->npages, 0, st->pages);
+	if (pinned < 0 || (size_t)pinned != st->npages) {
+		printk(KERN_INFO "[PFQ|%d] Tx replay: could not pin the pcap file (%d/%zu pages)!\n",
+		       so->id, pinned, st->npages);
+		err = -EFAULT;
+		goto err;
+	}
+
+	st->vaddr = vmap(st->pages, st->npages, VM_MAP, PAGE_KERNEL);
+	if (st->vaddr == NULL) {
+		err = -ENOMEM;
+		goto err;
+	}
+
+	st->base = (const char *)st->vaddr + offset_in_page(replay->addr);
+	st->len = replay->len;
+
+	magic = *(const uint32_t *)st->base;
+
+	switch(magic)
+	{
+	case Q_PCAP_MAGIC:		st->nsec = false; st->swapped = false; break;
+	case Q_PCAP_MAGIC_NSEC:		st->nsec = true;  st->swapped = false; break;
+	case ___constant_swab32(Q_PCAP_MAGIC):      st->nsec = false; st->swapped = true; break;
+	case ___constant_swab32(Q_PCAP_MAGIC_NSEC): st->nsec = true;  st->swapped = true; break;
+	default:
+		printk(KERN_INFO "[PFQ|%d] Tx replay: not a pcap file (magic %x)!\n", so->id, magic);
+		err = -EINVAL;
+		goto err;
+	}
+
+	st->off = Q_PCAP_HDR_LEN;
+	st->loops = replay->loops;
+	st->speed = replay->speed ? replay->speed : 1000;
+	st->tstamp = replay->tstamp != 0;
+	st->active = true;
+	atomic_set(&st->stop, 0);
+
+	smp_wmb();
+
+	atomic_long_set(&info->replay, (long)st);
+
+	if (info->task)
+		wake_up_process(info->task);
+
+	pr_devel("[PFQ|%d] Tx[%d] replay: %zu bytes, loops=%u speed=%u tstamp=%d\n", so->id,
+		 replay->queue, replay->len, replay->loops, st->speed, replay->tstamp);
+	return 0;
+err:
+	pfq_tx_replay_free(st);
+	return err;
+}
+
+
+int
+pfq_sock_tx_rate(struct pfq_sock *so, struct pfq_tx_rate const *rate)
+{
+	uint64_t pkt_ns, byte_ps;
+
+	if (rate->queue < -1 || rate->queue >= (int)so->opt.tx_max_async_queues) {
+		printk(KERN_INFO "[PFQ|%d] Tx rate: bad queue %d!\n", so->id, rate->queue);
+		return -EINVAL;
+	}
+
+	pkt_ns  = rate->pps ? div64_u64(NSEC_PER_SEC, rate->pps) : 0;
+	byte_ps = rate->bps ? div64_u64(8ULL * NSEC_PER_SEC * 1000, rate->bps) : 0;
+
+	/* a rate beyond the clock resolution is not a rate */
+
+	if (rate->pps && pkt_ns == 0)
+		pkt_ns = 1;
+	if (rate->bps && byte_ps == 0)
+		byte_ps = 1;
+
+	pfq_tx_pacer_set(&pfq_get_tx_queue_info(&so->opt, rate->queue)->pacer,
+			 pkt_ns, byte_ps, rate->burst ? rate->burst : 1);
+
+	pr_devel("[PFQ|%d] Tx[%d] rate: pps=%lu bps=%lu burst=%u\n", so->id, rate->queue,
+		 rate->pps, rate->bps, rate->burst);
+	return 0;
+}
+
+
+int
+pfq_sock_tx_sched(struct pfq_sock *so, struct pfq_tx_sched const *sched)
+{
+	struct pfq_tx_info *txinfo;
+
+	if (sched->queue < 0 || sched->queue >= (int)so->opt.tx_max_async_queues) {
+		printk(KERN_INFO "[PFQ|%d] Tx sched: bad queue %d (async queues only)!\n", so->id, sched->queue);
+		return -EINVAL;
+	}
+
+	if (sched->prio < 0 || sched->prio >= Q_TX_MAX_PRIO) {
+		printk(KERN_INFO "[PFQ|%d] Tx sched: bad priority %d!\n", so->id, sched->prio);
+		return -EINVAL;
+	}
+
+	txinfo = pfq_get_tx_queue_info(&so->opt, sched->queue);
+
+	txinfo->weight = sched->weight;
+	smp_wmb();
+	txinfo->prio = sched->prio;
+
+	pr_devel("[PFQ|%d] Tx[%d] sched: prio=%d weight=%u\n", so->id, sched->queue,
+		 sched->prio, sched->weight);
+	return 0;
+}
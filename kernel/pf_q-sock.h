@@ -48,6 +48,141 @@
 extern atomic_long_t pfq_sock_vector[Q_MAX_ID];
 
 
+/* token-bucket pacer of a Tx queue, in the form of a GCRA:
+ * a packet conforms if now >= tat - (burst-1) * cost.
+ * The pacer is owned by the transmitter of the queue: new settings are
+ * staged under the lock and applied by it (see pfq_tx_pacer_update).
+ */
+
+struct pfq_tx_pacer
+{
+	uint64_t		pkt_ns;			/* ns per packet (pps) */
+	uint64_t		byte_ps;		/* ps per byte (bps) */
+	uint64_t		burst;			/* back-to-back packets */
+	uint64_t		tat;			/* theoretical arrival time (ns) */
+
+	spinlock_t		lock;
+	atomic_t		pending;		/* staged settings not yet applied */
+	uint64_t		next_pkt_ns;
+	uint64_t		next_byte_ps;
+	uint64_t		next_burst;
+};
+
+
+static inline
+void pfq_tx_pacer_init(struct pfq_tx_pacer *p)
+{
+	p->pkt_ns = 0;
+	p->byte_ps = 0;
+	p->burst = 1;
+	p->tat = 0;
+
+	spin_lock_init(&p->lock);
+	atomic_set(&p->pending, 0);
+	p->next_pkt_ns = 0;
+	p->next_byte_ps = 0;
+	p->next_burst = 1;
+}
+
+
+static inline
+void pfq_tx_pacer_set(struct pfq_tx_pacer *p, uint64_t pkt_ns, uint64_t byte_ps, uint64_t burst)
+{
+	spin_lock(&p->lock);
+	p->next_pkt_ns = pkt_ns;
+	p->next_byte_ps = byte_ps;
+	p->next_burst = burst;
+	atomic_set(&p->pending, 1);
+	spin_unlock(&p->lock);
+}
+
+
+static inline
+void pfq_tx_pacer_update(struct pfq_tx_pacer *p)
+{
+	if (likely(atomic_read(&p->pending) == 0))
+		return;
+
+	spin_lock(&p->lock);
+	p->pkt_ns = p->next_pkt_ns;
+	p->byte_ps = p->next_byte_ps;
+	p->burst = p->next_burst;
+	p->tat = 0;
+	atomic_set(&p->pending, 0);
+	spin_unlock(&p->lock);
+}
+
+
+static inline
+bool pfq_tx_pacer_enabled(struct pfq_tx_pacer const *p)
+{
+	return (p->pkt_ns | p->byte_ps) != 0;
+}
+
+
+/* in-kernel pcap replay of an async Tx queue: the state is released in
+ * user-context, after a grace period (the Tx thread only reads it) and an
+ * RCU grace period (Q_SO_GET_TX_REPLAY reads it under rcu_read_lock).
+ */
+
+#define Q_PCAP_MAGIC		0xa1b2c3d4
+#define Q_PCAP_MAGIC_NSEC	0xa1b23c4d
+#define Q_PCAP_HDR_LEN		24
+#define Q_PCAP_REC_LEN		16
+
+struct pfq_tx_replay_state
+{
+	struct page		**pages;		/* pinned pages of the pcap file */
+	size_t			npages;
+	void			*vaddr;			/* kernel mapping of the pages */
+	const char		*base;			/* pcap file */
+	size_t			len;
+	size_t			off;			/* next record */
+
+	bool			nsec;			/* nanosecond timestamps */
+	bool			swapped;		/* foreign byte order */
+
+	unsigned int		loops;
+	unsigned int		speed;
+	bool			tstamp;
+
+	uint64_t		t0_file;		/* first record of the file (ns) */
+	uint64_t		t0;			/* start of the current loop (ns) */
+
+	unsigned long		done_loops;
+	unsigned long		sent;
+	bool			active;
+	atomic_t		stop;			/* -1: stop requested */
+};
+
+
+extern void pfq_tx_replay_free(struct pfq_tx_replay_state *st);
+
+
+/* zero-copy Tx of a queue: the records referenced by skbs still owned by
+ * drivers, in ring order. The producer is released up to the oldest of them.
+ * The state is freed by its last user, the socket or a late completion.
+ */
+
+struct pfq_tx_zc_record
+{
+	size_t			pos;			/* position of the record in the ring */
+	bool			done;
+};
+
+struct pfq_tx_zc_queue
+{
+	spinlock_t		lock;
+	atomic_t		refcnt;			/* socket + skbs in flight */
+	struct pfq_tx_queue	*txm;			/* NULL: detached from the socket */
+	struct pfq_tx_completion_ring *ring;
+	size_t			cons;			/* bytes consumed by the Tx thread */
+	unsigned int		head;			/* records in flight: [tail, head) */
+	unsigned int		tail;
+	struct pfq_tx_zc_record	rec[Q_TX_COMPLETION_LEN];
+};
+
+
 struct pfq_tx_info
 {
 	atomic_long_t		addr;			/* (pfq_tx_queue *) */
@@ -55,6 +190,14 @@ struct pfq_tx_info
 	int			def_ifindex;		/* default ifindex */
 	int			def_queue;		/* default queue */
 	struct net_device	*def_dev;		/* default dev */
+	struct pfq_tx_pacer	pacer;
+	struct task_struct	*task;			/* Tx thread (async queues) */
+	bool			reserved;		/* owner of the default hw queue */
+	atomic_long_t		replay;			/* (pfq_tx_replay_state *) */
+	uint32_t		tstamp_id;		/* index of the next record (Tx timestamps) */
+	struct pfq_tx_zc_queue	*zc;			/* zero-copy Tx, or NULL */
+	int			prio;			/* Tx scheduling (async queues) */
+	unsigned int		weight;
 };
 
 
@@ -66,6 +209,14 @@ void pfq_tx_info_init(struct pfq_tx_info *info)
 	info->def_ifindex = -1;
 	info->def_queue = -1;
 	info->def_dev = NULL;
+	pfq_tx_pacer_init(&info->pacer);
+	info->task = NULL;
+	info->reserved = false;
+	atomic_long_set(&info->replay, 0);
+	info->tstamp_id = 0;
+	info->zc = NULL;
+	info->prio = 0;
+	info->weight = 0;
 }
 
 
@@ -93,10 +244,14 @@ struct pfq_sock_opt
 
 	size_t			tx_queue_len;
 	size_t			tx_slot_size;
+	int			tx_zerocopy;
+	int			tx_tstamp;		/* Q_TX_TSTAMP_* */
+	struct pfq_tx_tstamp_ring *tx_tstamp_ring;	/* in the shared memory, if enabled */
 
 	wait_queue_head_t	waitqueue;
 
         size_t			tx_num_async_queues;
+        size_t			tx_max_async_queues;	/* negotiated before enable */
 
 	struct pfq_tx_info	txq_async[Q_MAX_TX_QUEUES];
 	struct pfq_tx_info	txq;
@@ -121,6 +276,7 @@ struct pfq_sock
         struct pfq_sock_opt	opt;
 
         struct pfq_sock_stats __percpu *stats;
+        struct pfq_drop_counters __percpu *drops;
 
 } ____cacheline_aligned_in_smp;
 
@@ -161,6 +317,17 @@ pfq_get_tx_queue(struct pfq_sock_opt *that, int index)
 	return (struct pfq_tx_queue *)atomic_long_read(&that->txq_async[index].addr);
 }
 
+
+/* position of the Tx thread in the ring: with zero-copy Tx cons.pos lags
+ * behind, the records in flight are not released to the producer */
+
+static inline
+size_t pfq_tx_queue_cons(struct pfq_sock_opt *that, int index, struct pfq_tx_queue *txm)
+{
+	struct pfq_tx_info *info = pfq_get_tx_queue_info(that, index);
+	return info->zc ? info->zc->cons : txm->cons.pos;
+}
+
 /* memory mapped queues */
 
 static inline
@@ -189,7 +356,13 @@ int     pfq_get_sock_count(void);
 struct	pfq_sock * pfq_get_sock_by_id(pfq_id_t id);
 void	pfq_release_sock_id(pfq_id_t id);
 
-int	pfq_sock_tx_bind(struct pfq_sock *so, int tid, int if_index, int queue, struct net_device *default_dev);
+int	pfq_sock_tx_bind(struct pfq_sock *so, int tid, int if_index, int queue, struct net_device *default_dev, bool reserved);
+int	pfq_sock_tx_claim(struct pfq_sock *so, int index);
+void	pfq_sock_tx_release(struct pfq_sock *so, int index);
+int	pfq_sock_tx_replay(struct pfq_sock *so, struct pfq_tx_replay const *replay);
+void	pfq_sock_tx_replay_stop(struct pfq_sock *so, int index);
 int	pfq_sock_tx_unbind(struct pfq_sock *so);
+int	pfq_sock_tx_rate(struct pfq_sock *so, struct pfq_tx_rate const *rate);
+int	pfq_sock_tx_sched(struct pfq_sock *so, struct pfq_tx_sched const *sched);
 
 #endif /* PF_Q_SOCK_H */
@@ -27,6 +27,8 @@
 #include <linux/module.h>
 #include <linux/version.h>
 #include <linux/kthread.h>
+#include <linux/slab.h>
+#include <linux/net_tstamp.h>
 #include <linux/pf_q.h>
 
 #include <pragma/diagnostic_pop>
@@ -191,6 +193,17 @@ int pfq_getsockopt(struct socket *sock,
                         return -EFAULT;
         } break;
 
+        case Q_SO_GET_SHMEM_PAGE_SIZE:
+	{
+		size_t size = so->shmem.page_size;
+
+                if (len != sizeof(size))
+                        return -EINVAL;
+
+                if (copy_to_user(optval, &size, sizeof(size)))
+                        return -EFAULT;
+        } break;
+
         case Q_SO_GET_RX_CAPLEN:
         {
                 if (len != sizeof(so->opt.caplen))
@@ -233,6 +246,38 @@ int pfq_getsockopt(struct socket *sock,
                         return -EFAULT;
         } break;
 
+        case Q_SO_GET_TX_REPLAY:
+        {
+                struct pfq_tx_replay_stats stat;
+                struct pfq_tx_replay_state *st;
+
+                if (len != sizeof(stat))
+                        return -EINVAL;
+
+                if (copy_from_user(&stat, optval, sizeof(stat)))
+                        return -EFAULT;
+
+                if (stat.queue < 0 || stat.queue >= (int)so->opt.tx_num_async_queues) {
+                        printk(KERN_INFO "[PFQ|%d] Tx replay stats: bad async queue %d!\n", so->id, stat.queue);
+                        return -EINVAL;
+                }
+
+                /* the state is freed after an RCU grace period (see pfq_sock_tx_replay_stop) */
+
+                rcu_read_lock();
+
+                st = (struct pfq_tx_replay_state *)atomic_long_read(&so->opt.txq_async[stat.queue].replay);
+
+                stat.active = st ? st->active : 0;
+                stat.loops  = st ? st->done_loops : 0;
+                stat.sent   = st ? st->sent : 0;
+
+                rcu_read_unlock();
+
+                if (copy_to_user(optval, &stat, sizeof(stat)))
+                        return -EFAULT;
+        } break;
+
         case Q_SO_GET_GROUP_STATS:
         {
                 struct pfq_group *group;
@@ -326,6 +371,179 @@ int pfq_getsockopt(struct socket *sock,
                         return -EFAULT;
         } break;
 
+        case Q_SO_GET_TX_ASYNC_QUEUES:
+        {
+                if (len != sizeof(so->opt.tx_max_async_queues))
+                        return -EINVAL;
+
+                if (copy_to_user(optval, &so->opt.tx_max_async_queues, sizeof(so->opt.tx_max_async_queues)))
+                        return -EFAULT;
+        } break;
+
+        case Q_SO_GET_TX_THREADS:
+        {
+                int nr = pfq_get_tx_thread_nr();
+
+                if (len != sizeof(nr))
+                        return -EINVAL;
+
+                if (copy_to_user(optval, &nr, sizeof(nr)))
+                        return -EFAULT;
+        } break;
+
+        case Q_SO_GET_TX_ZEROCOPY:
+        {
+                if (len != sizeof(so->opt.tx_zerocopy))
+                        return -EINVAL;
+
+                if (copy_to_user(optval, &so->opt.tx_zerocopy, sizeof(so->opt.tx_zerocopy)))
+                        return -EFAULT;
+        } break;
+
+        case Q_SO_GET_TX_TSTAMP:
+        {
+                if (len != sizeof(so->opt.tx_tstamp))
+                        return -EINVAL;
+
+		/* collect the pending hw timestamps */
+
+		if (so->opt.tx_tstamp & Q_TX_TSTAMP_HW)
+			pfq_tx_tstamp_drain(so);
+
+                if (copy_to_user(optval, &so->opt.tx_tstamp, sizeof(so->opt.tx_tstamp)))
+                        return -EFAULT;
+        } break;
+
+        case Q_SO_GET_DROP_STATS:
+        {
+                struct pfq_drop_stats stat;
+
+                if (len != sizeof(stat))
+                        return -EINVAL;
+
+                pfq_drop_counters_read(so->drops, &stat);
+
+                if (copy_to_user(optval, &stat, sizeof(stat)))
+                        return -EFAULT;
+        } break;
+
+        case Q_SO_GET_GROUP_DROP_STATS:
+        {
+                struct pfq_group *group;
+                struct pfq_drop_stats stat;
+                pfq_gid_t gid;
+
+                if (len != sizeof(stat))
+                        return -EINVAL;
+
+                if (copy_from_user(&stat, optval, sizeof(stat)))
+                        return -EFAULT;
+
+                gid = (__force pfq_gid_t)stat.reason[0];
+
+                group = pfq_get_group(gid);
+                if (group == NULL) {
+                        printk(KERN_INFO "[PFQ|%d] group error: invalid group id %d!\n", so->id, gid);
+                        return -EFAULT;
+                }
+
+                if (!pfq_group_access(gid, so->id)) {
+                        printk(KERN_INFO "[PFQ|%d] group drop stats error: gid=%d permission denied!\n",
+                               so->id, gid);
+                        return -EACCES;
+                }
+
+                pfq_drop_counters_read(group->drops, &stat);
+
+                if (copy_to_user(optval, &stat, sizeof(stat)))
+                        return -EFAULT;
+        } break;
+
+        case Q_SO_GET_GLOBAL_DROP_STATS:
+        {
+                struct pfq_drop_stats stat;
+
+                if (len != sizeof(stat))
+                        return -EINVAL;
+
+                pfq_drop_counters_read(&global_drops, &stat);
+
+                if (copy_to_user(optval, &stat, sizeof(stat)))
+                        return -EFAULT;
+        } break;
+
+        case Q_SO_GET_COPY_STATS:
+        {
+                struct pfq_copy_stats stat;
+
+                if (len != sizeof(stat))
+                        return -EINVAL;
+
+                stat.linear = sparse_read(so->stats, lcpy);
+                stat.paged  = sparse_read(so->stats, pcpy);
+
+                if (copy_to_user(optval, &stat, sizeof(stat)))
+                        return -EFAULT;
+        } break;
+
+        case Q_SO_GET_NETQ_STATS:
+        {
+                struct pfq_queue_stats *stat;
+                struct pfq_dev_stats *ds;
+                int ifindex, max, n, i, num = 0;
+                unsigned long value;
+
+                if (len < (int)sizeof(*stat) || (len % (int)sizeof(*stat)))
+                        return -EINVAL;
+
+                if (get_user(value, (unsigned long __user *)optval))
+                        return -EFAULT;
+
+                ifindex = (int)value;
+                if (ifindex <= 0 || ifindex >= Q_MAX_DEVICE) {
+                        printk(KERN_INFO "[PFQ|%d] netq stats error: bad ifindex %d!\n", so->id, ifindex);
+                        return -EINVAL;
+                }
+
+                max = min_t(int, len / (int)sizeof(*stat), Q_MAX_NETQ_STATS);
+
+                stat = kcalloc((size_t)max, sizeof(*stat), GFP_KERNEL);
+                if (stat == NULL)
+                        return -ENOMEM;
+
+                rcu_read_lock_bh();
+
+                ds = rcu_dereference_bh(dev_stats[ifindex]);
+                if (ds)
+                        num = min_t(int, ds->num_queues, max);
+
+                for(n = 0; n < num; n++)
+                {
+                        for_each_possible_cpu(i)
+                        {
+                                struct pfq_netq_stats *netq = per_cpu_ptr(ds->netq, i) + n;
+
+                                stat[n].recv += (unsigned long)local_read(&netq->recv);
+                                stat[n].frwd += (unsigned long)local_read(&netq->frwd);
+                                stat[n].drop += (unsigned long)local_read(&netq->drop);
+                        }
+                }
+
+                rcu_read_unlock_bh();
+
+                if (copy_to_user(optval, stat, sizeof(*stat) * (size_t)num)) {
+                        kfree(stat);
+                        return -EFAULT;
+                }
+
+                kfree(stat);
+
+                /* the number of hw queues is returned by means of optlen */
+
+                if (put_user(num * (int)sizeof(*stat), optlen))
+                        return -EFAULT;
+        } break;
+
         default:
                 return -EFAULT;
         }
@@ -570,6 +788,51 @@ int pfq_setsockopt(struct socket *sock,
                 pr_devel("[PFQ|%d] tx_queue slots=%zu\n", so->id, so->opt.tx_queue_len);
         } break;
 
+        case Q_SO_SET_TX_ASYNC_QUEUES:
+        {
+                typeof (so->opt.tx_max_async_queues) queues;
+
+                if (optlen != sizeof(queues))
+                        return -EINVAL;
+                if (copy_from_user(&queues, optval, optlen))
+                        return -EFAULT;
+
+		if (so->shmem.addr) {
+                        printk(KERN_INFO "[PFQ|%d] Tx async queues: socket already enabled!\n", so->id);
+                        return -EPERM;
+		}
+
+                if (queues > Q_MAX_TX_QUEUES) {
+                        printk(KERN_INFO "[PFQ|%d] invalid Tx async queues=%zu (max %d)\n",
+                               so->id, queues, Q_MAX_TX_QUEUES);
+                        return -EPERM;
+                }
+
+                so->opt.tx_max_async_queues = queues;
+
+                pr_devel("[PFQ|%d] Tx async queues=%zu\n", so->id, so->opt.tx_max_async_queues);
+        } break;
+
+        case Q_SO_SET_TX_ZEROCOPY:
+        {
+                int zerocopy;
+
+                if (optlen != sizeof(zerocopy))
+                        return -EINVAL;
+
+                if (copy_from_user(&zerocopy, optval, optlen))
+                        return -EFAULT;
+
+		if (so->shmem.addr) {
+                        printk(KERN_INFO "[PFQ|%d] Tx zerocopy: socket already enabled!\n", so->id);
+                        return -EPERM;
+		}
+
+                so->opt.tx_zerocopy = zerocopy ? 1 : 0;
+
+                pr_devel("[PFQ|%d] Tx zerocopy=%d\n", so->id, so->opt.tx_zerocopy);
+        } break;
+
         case Q_SO_SET_WEIGHT:
         {
                 int weight;
@@ -738,9 +1001,11 @@ int pfq_setsockopt(struct socket *sock,
         } break;
 
         case Q_SO_TX_BIND:
+        case Q_SO_TX_BIND_RSVD:
         {
                 struct pfq_binding bind;
                 struct net_device *dev = NULL;
+                bool reserved = optname == Q_SO_TX_BIND_RSVD;
 
                 if (optlen != sizeof(bind))
                         return -EINVAL;
@@ -754,7 +1019,7 @@ int pfq_setsockopt(struct socket *sock,
 		}
 
 		if (bind.tid >= 0 &&
-		    so->opt.tx_num_async_queues >= Q_MAX_TX_QUEUES) {
+		    so->opt.tx_num_async_queues >= so->opt.tx_max_async_queues) {
 			printk(KERN_INFO "[PFQ|%d] Tx thread: max number of sock queues exceeded!\n", so->id);
 			return -EPERM;
 		}
@@ -776,7 +1041,7 @@ int pfq_setsockopt(struct socket *sock,
 
 		if (bind.tid >= 0) /* async queues */
 		{
-			int err = pfq_sock_tx_bind(so, bind.tid, bind.ifindex, bind.qindex, dev);
+			int err = pfq_sock_tx_bind(so, bind.tid, bind.ifindex, bind.qindex, dev, reserved);
 			if (err < 0) {
 				if (bind.ifindex != -1)
 					dev_put_by_index(sock_net(&so->sk), bind.ifindex);
@@ -788,9 +1053,25 @@ int pfq_setsockopt(struct socket *sock,
 		}
 		else /* sync queue */
 		{
+			pfq_sock_tx_release(so, -1);
+
 			so->opt.txq.def_ifindex = bind.ifindex;
 			so->opt.txq.def_queue = bind.qindex;
 			so->opt.txq.def_dev = dev;
+
+			if (reserved) {
+				int err = pfq_sock_tx_claim(so, -1);
+				if (err < 0) {
+					if (bind.ifindex != -1)
+						dev_put_by_index(sock_net(&so->sk), bind.ifindex);
+
+					so->opt.txq.def_ifindex = -1;
+					so->opt.txq.def_queue = -1;
+					so->opt.txq.def_dev = NULL;
+					return err;
+				}
+			}
+
 			pr_devel("[PFQ|%d] Tx bind: if_index=%d qindex=%d\n", so->id,
 				so->opt.txq.def_ifindex,
 				so->opt.txq.def_queue);
@@ -803,6 +1084,67 @@ int pfq_setsockopt(struct socket *sock,
 		pfq_sock_tx_unbind(so);
         } break;
 
+        case Q_SO_TX_TSTAMP:
+        {
+		int tstamp;
+
+		if (optlen != sizeof(tstamp))
+			return -EINVAL;
+
+		if (copy_from_user(&tstamp, optval, optlen))
+			return -EFAULT;
+
+		if (tstamp & ~(Q_TX_TSTAMP_SW | Q_TX_TSTAMP_HW)) {
+			printk(KERN_INFO "[PFQ|%d] Tx tstamp: bad flags %x!\n", so->id, tstamp);
+			return -EINVAL;
+		}
+
+		/* the ring is sized in when the socket is enabled */
+
+		if (tstamp && so->shmem.addr && so->opt.tx_tstamp_ring == NULL) {
+			printk(KERN_INFO "[PFQ|%d] Tx tstamp: socket enabled without timestamps!\n", so->id);
+			return -EPERM;
+		}
+
+		if (tstamp & Q_TX_TSTAMP_HW) {
+#if(LINUX_VERSION_CODE >= KERNEL_VERSION(4,0,0))
+			/* hw timestamps of the skbs owned by this socket are
+			 * queued to its error queue, keyed by tskey */
+			so->sk.sk_tsflags |= SOF_TIMESTAMPING_TX_HARDWARE | SOF_TIMESTAMPING_RAW_HARDWARE |
+					     SOF_TIMESTAMPING_OPT_ID | SOF_TIMESTAMPING_OPT_TSONLY;
+#else
+			printk(KERN_INFO "[PFQ|%d] Tx tstamp: hw timestamps not supported by this kernel!\n", so->id);
+			return -EOPNOTSUPP;
+#endif
+		}
+
+		so->opt.tx_tstamp = tstamp;
+
+		pr_devel("[PFQ|%d] Tx tstamp=%x\n", so->id, tstamp);
+        } break;
+
+        case Q_SO_TX_REPLAY:
+        {
+		struct pfq_tx_replay replay;
+		int err;
+
+		if (optlen != sizeof(replay))
+			return -EINVAL;
+
+		if (copy_from_user(&replay, optval, optlen))
+			return -EFAULT;
+
+		if (replay.addr != NULL && pfq_get_tx_queue(&so->opt, -1) == NULL) {
+			printk(KERN_INFO "[PFQ|%d] Tx replay: socket not enabled!\n", so->id);
+			return -EPERM;
+		}
+
+		err = pfq_sock_tx_replay(so, &replay);
+		if (err < 0)
+			return err;
+
+        } break;
+
         case Q_SO_TX_QUEUE:
         {
 		int queue;
@@ -820,7 +1162,7 @@ int pfq_setsockopt(struct socket *sock,
 
 		if (queue == 0) { /* transmit Tx queue */
 			atomic_t stop = {0};
-			pfq_sk_queue_xmit(so, -1, Q_NO_KTHREAD, NUMA_NO_NODE, &stop);
+			pfq_sk_queue_xmit(so, -1, Q_NO_KTHREAD, NUMA_NO_NODE, &stop, NULL, NULL);
 			return 0;
 		}
 
@@ -829,6 +1171,99 @@ int pfq_setsockopt(struct socket *sock,
 
         } break;
 
+        case Q_SO_TX_DOORBELL:
+        {
+		struct task_struct *task;
+		int queue;
+
+		if (optlen != sizeof(queue))
+			return -EINVAL;
+
+		if (copy_from_user(&queue, optval, optlen))
+			return -EFAULT;
+
+		if (queue < 0 || queue >= (int)so->opt.tx_num_async_queues) {
+			printk(KERN_INFO "[PFQ|%d] Tx doorbell: bad queue %d!\n", so->id, queue);
+			return -EINVAL;
+		}
+
+		task = so->opt.txq_async[queue].task;
+		if (task)
+			wake_up_process(task);
+
+        } break;
+
+        case Q_SO_TX_THREAD_ADD:
+        {
+		int cpu, err;
+
+		if (optlen != sizeof(cpu))
+			return -EINVAL;
+
+		if (copy_from_user(&cpu, optval, optlen))
+			return -EFAULT;
+
+		err = pfq_add_tx_thread(cpu);
+		return err < 0 ? err : 0;
+
+        } break;
+
+        case Q_SO_TX_THREAD_DEL:
+        {
+		return pfq_del_tx_thread();
+
+        } break;
+
+        case Q_SO_TX_SCHED:
+        {
+		struct pfq_tx_sched sched;
+
+		if (optlen != sizeof(sched))
+			return -EINVAL;
+
+		if (copy_from_user(&sched, optval, optlen))
+			return -EFAULT;
+
+		return pfq_sock_tx_sched(so, &sched);
+
+        } break;
+
+        case Q_SO_TX_RATE:
+        {
+		struct pfq_tx_rate rate;
+
+		if (optlen != sizeof(rate))
+			return -EINVAL;
+
+		if (copy_from_user(&rate, optval, optlen))
+			return -EFAULT;
+
+		return pfq_sock_tx_rate(so, &rate);
+
+        } break;
+
+        case Q_SO_GROUP_LINKS:
+        {
+		struct pfq_group_links links;
+		pfq_gid_t gid;
+
+		if (optlen != sizeof(links))
+			return -EINVAL;
+
+		if (copy_from_user(&links, optval, optlen))
+			return -EFAULT;
+
+		gid = (__force pfq_gid_t)links.gid;
+
+		if (!pfq_has_joined_group(gid, so->id)) {
+                        printk(KERN_INFO "[PFQ|%d] group links: gid=%d not joined!\n", so->id, links.gid);
+			return -EACCES;
+		}
+
+		return pfq_set_group_links(gid, sock_net(&so->sk), &links);
+
+        } break;
+
         case Q_SO_GROUP_FUNCTION:
         {
                 struct pfq_lang_computation_descr *descr = NULL;
@@ -23,6 +23,9 @@
 
 #include <pragma/diagnostic_push>
 #include <linux/kernel.h>
+#include <linux/percpu.h>
+#include <linux/slab.h>
+#include <linux/rtnetlink.h>
 #include <pragma/diagnostic_pop>
 
 #include <pf_q-stats.h>
@@ -40,6 +43,8 @@ void pfq_sock_stats_reset(struct pfq_sock_stats __percpu *stats)
 		local_set(&stat->drop, 0);
 		local_set(&stat->sent, 0);
 		local_set(&stat->disc, 0);
+		local_set(&stat->lcpy, 0);
+		local_set(&stat->pcpy, 0);
 	}
 }
 
@@ -74,6 +79,26 @@ void pfq_group_counters_reset(struct pfq_group_counters __percpu *counters)
 }
 
 
+void pfq_drop_counters_reset(struct pfq_drop_counters __percpu *drops)
+{
+	int i, n;
+	for_each_possible_cpu(i)
+	{
+		struct pfq_drop_counters * ctr = per_cpu_ptr(drops, i);
+		for(n = 0; n < Q_DROP_MAX; n++)
+			local_set(&ctr->reason[n], 0);
+	}
+}
+
+
+void pfq_drop_counters_read(struct pfq_drop_counters __percpu *drops, struct pfq_drop_stats *stat)
+{
+	int n;
+	for(n = 0; n < Q_DROP_MAX; n++)
+		stat->reason[n] = (unsigned long)sparse_read(drops, reason[n]);
+}
+
+
 void pfq_global_stats_reset(struct pfq_global_stats __percpu *stats)
 {
 	int i;
@@ -107,9 +132,11 @@ void pfq_memory_stats_reset(struct pfq_memory_stats __percpu *stats)
 		local_set(&stat->pool_free,  0);
 		local_set(&stat->pool_push,  0);
 		local_set(&stat->pool_pop,   0);
+		local_set(&stat->pool_return,0);
 		local_set(&stat->err_norecyl,0);
 		local_set(&stat->err_pop,    0);
 		local_set(&stat->err_push,   0);
+		local_set(&stat->err_return, 0);
 		local_set(&stat->err_intdis, 0);
 		local_set(&stat->err_shared, 0);
 		local_set(&stat->err_cloned, 0);
@@ -117,3 +144,110 @@ void pfq_memory_stats_reset(struct pfq_memory_stats __percpu *stats)
 	}
 }
 
+
+struct pfq_dev_stats __rcu *dev_stats[Q_MAX_DEVICE];
+
+
+static void
+pfq_dev_stats_free(struct pfq_dev_stats *ds)
+{
+	free_percpu(ds->netq);
+	kfree(ds);
+}
+
+
+static void
+pfq_dev_stats_free_rcu(struct rcu_head *head)
+{
+	pfq_dev_stats_free(container_of(head, struct pfq_dev_stats, rcu));
+}
+
+
+static void
+pfq_dev_stats_reset(struct pfq_dev_stats *ds)
+{
+	int i, n;
+	for_each_possible_cpu(i)
+	{
+		struct pfq_netq_stats * stat = per_cpu_ptr(ds->netq, i);
+		for(n = 0; n < ds->num_queues; n++)
+		{
+			local_set(&stat[n].recv, 0);
+			local_set(&stat[n].frwd, 0);
+			local_set(&stat[n].drop, 0);
+		}
+	}
+}
+
+
+/* called from the netdev notifier (rtnl held) */
+
+int pfq_dev_stats_register(struct net_device *dev)
+{
+	struct pfq_dev_stats *ds, *old;
+	int num_queues = min_t(int, dev->num_rx_queues, Q_MAX_HW_QUEUE);
+
+	if (dev->ifindex >= Q_MAX_DEVICE)
+		return -EINVAL;
+
+	old = rtnl_dereference(dev_stats[dev->ifindex]);
+	if (old && old->num_queues >= num_queues) {
+		pfq_dev_stats_reset(old);
+		return 0;
+	}
+
+	ds = kzalloc(sizeof(*ds), GFP_KERNEL);
+	if (ds == NULL)
+		return -ENOMEM;
+
+	ds->num_queues = num_queues;
+	ds->netq = __alloc_percpu(sizeof(struct pfq_netq_stats) * (size_t)num_queues,
+				  __alignof__(struct pfq_netq_stats));
+	if (ds->netq == NULL) {
+		kfree(ds);
+		return -ENOMEM;
+	}
+
+	pfq_dev_stats_reset(ds);
+
+	rcu_assign_pointer(dev_stats[dev->ifindex], ds);
+	if (old)
+		call_rcu_bh(&old->rcu, pfq_dev_stats_free_rcu);
+
+	return 0;
+}
+
+
+void pfq_dev_stats_reset_all(void)
+{
+	int n;
+
+	rcu_read_lock_bh();
+	for(n = 0; n < Q_MAX_DEVICE; n++)
+	{
+		struct pfq_dev_stats *ds = rcu_dereference_bh(dev_stats[n]);
+		if (ds)
+			pfq_dev_stats_reset(ds);
+	}
+	rcu_read_unlock_bh();
+}
+
+
+/* called at module exit, once the netdev notifier is unregistered */
+
+void pfq_dev_stats_free_all(void)
+{
+	int n;
+
+	for(n = 0; n < Q_MAX_DEVICE; n++)
+	{
+		struct pfq_dev_stats *ds = rcu_dereference_protected(dev_stats[n], 1);
+		if (ds) {
+			RCU_INIT_POINTER(dev_stats[n], NULL);
+			call_rcu_bh(&ds->rcu, pfq_dev_stats_free_rcu);
+		}
+	}
+
+	rcu_barrier_bh();
+}
+
@@ -28,10 +28,13 @@
 #include <linux/kernel.h>
 #include <linux/cpumask.h>
 #include <linux/percpu-defs.h>
+#include <linux/rcupdate.h>
+#include <linux/netdevice.h>
 #include <linux/pf_q.h>
 #include <pragma/diagnostic_pop>
 
 #include <pf_q-sparse.h>
+#include <pf_q-define.h>
 
 
 struct pfq_sock_stats
@@ -41,6 +44,8 @@ struct pfq_sock_stats
         local_t drop;		/* dropped by filters */
         local_t sent;		/* sent by the driver */
         local_t disc;		/* discarded by the driver */
+        local_t lcpy;		/* packets copied from a linear skb */
+        local_t pcpy;		/* packets copied from a paged (non-linear) skb */
 };
 
 
@@ -61,6 +66,12 @@ struct pfq_group_counters
 };
 
 
+struct pfq_drop_counters
+{
+	local_t reason[Q_DROP_MAX];	/* Q_DROP_* */
+};
+
+
 struct pfq_global_stats
 {
 	local_t recv;		/* received by PFQ */
@@ -83,9 +94,11 @@ struct pfq_memory_stats
 	local_t pool_free;
 	local_t pool_push;
 	local_t pool_pop;
+	local_t pool_return;
 	local_t err_norecyl;
 	local_t err_pop;
 	local_t err_push;
+	local_t err_return;
 	local_t err_intdis;
 	local_t err_shared;
 	local_t err_cloned;
@@ -102,10 +115,12 @@ struct pfq_pool_stat
 	uint64_t pool_free;
 	uint64_t pool_push;
 	uint64_t pool_pop;
+	uint64_t pool_return;
 
 	uint64_t err_norecyl;
 	uint64_t err_pop;
 	uint64_t err_push;
+	uint64_t err_return;
 	uint64_t err_intdis;
 	uint64_t err_shared;
 	uint64_t err_cloned;
@@ -113,9 +128,47 @@ struct pfq_pool_stat
 };
 
 
+struct pfq_netq_stats
+{
+	local_t recv;		/* received from the hw queue */
+	local_t frwd;		/* forwarded to devices */
+	local_t drop;		/* not delivered to any endpoint */
+};
+
+
+struct pfq_dev_stats
+{
+	struct rcu_head rcu;
+	int num_queues;
+	struct pfq_netq_stats __percpu *netq;	/* per-cpu array of num_queues counters */
+};
+
+
+extern struct pfq_dev_stats __rcu *dev_stats[Q_MAX_DEVICE];
+
+
+/* per hw-queue counters of the given device (rcu-bh read side) */
+
+static inline
+struct pfq_netq_stats *
+pfq_get_netq_stats(int ifindex, int queue, int cpu)
+{
+	struct pfq_dev_stats *ds = rcu_dereference_bh(dev_stats[ifindex]);
+	if (unlikely(ds == NULL || queue >= ds->num_queues))
+		return NULL;
+	return per_cpu_ptr(ds->netq, cpu) + queue;
+}
+
+
+extern int  pfq_dev_stats_register(struct net_device *dev);
+extern void pfq_dev_stats_free_all(void);
+extern void pfq_dev_stats_reset_all(void);
+
 extern void pfq_sock_stats_reset(struct pfq_sock_stats __percpu *stats);
 extern void pfq_group_stats_reset(struct pfq_group_stats __percpu *stats);
 extern void pfq_group_counters_reset(struct pfq_group_counters __percpu *counters);
+extern void pfq_drop_counters_reset(struct pfq_drop_counters __percpu *drops);
+extern void pfq_drop_counters_read(struct pfq_drop_counters __percpu *drops, struct pfq_drop_stats *stat);
 extern void pfq_global_stats_reset(struct pfq_global_stats __percpu *stats);
 extern void pfq_memory_stats_reset(struct pfq_memory_stats __percpu *stats);
 
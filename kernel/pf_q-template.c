@@ -0,0 +1,173 @@
+/***************************************************************
+ *
+ * (C) 2011-15 Nicola Bonelli <nicola@pfq.io>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ *
+ * The full GNU General Public License is included in this distribution in
+ * the file called "COPYING".
+ *
+ ****************************************************************/
+
+#include <pragma/diagnostic_push>
+#include <linux/kernel.h>
+#include <linux/version.h>
+#include <linux/random.h>
+#include <linux/string.h>
+#include <linux/ip.h>
+#include <linux/in.h>
+#include <net/checksum.h>
+#include <asm/unaligned.h>
+#include <asm/div64.h>
+#include <pragma/diagnostic_pop>
+
+#include <pf_q-template.h>
+
+
+#if(LINUX_VERSION_CODE >= KERNEL_VERSION(6,1,0))
+#define pfq_random_u32()	get_random_u32()
+#elif(LINUX_VERSION_CODE >= KERNEL_VERSION(3,8,0))
+#define pfq_random_u32()	prandom_u32()
+#else
+#define pfq_random_u32()	random32()
+#endif
+
+
+static inline uint32_t
+mutation_value(struct pfq_tx_mutation const *m, uint32_t index)
+{
+	uint32_t range;
+	uint64_t n;
+
+	if (unlikely(m->max < m->min))
+		return m->min;
+
+	range = m->max - m->min + 1; /* 0: the whole 32 bit range */
+
+	switch(m->op)
+	{
+	case Q_TX_MUT_INC: {
+		n = (uint64_t)index * m->step;
+		if (range == 0)
+			return m->min + (uint32_t)n;
+		return m->min + do_div(n, range);
+	}
+	case Q_TX_MUT_RAND:
+		return m->min + (range ? pfq_random_u32() % range : pfq_random_u32());
+	}
+
+	return m->min;
+}
+
+
+static inline void
+mutation_write(char *p, uint8_t size, uint32_t value)
+{
+	switch(size)
+	{
+	case 1: *(uint8_t *)p = (uint8_t)value; break;
+	case 2: put_unaligned(htons((uint16_t)value), (__be16 *)p); break;
+	case 4: put_unaligned(htonl(value), (__be32 *)p); break;
+	}
+}
+
+
+static inline void
+csum_fix(char *pkt, size_t off, __wsum from, __wsum to, bool udp)
+{
+	__sum16 sum = get_unaligned((__sum16 *)(pkt + off));
+
+	sum = csum_fold(csum_add(csum_sub(~csum_unfold(sum), from), to));
+	if (udp && sum == 0)
+		sum = CSUM_MANGLED_0;
+
+	put_unaligned(sum, (__sum16 *)(pkt + off));
+}
+
+
+void
+pfq_tx_template_apply(struct pfq_tx_template const *tmpl, char *pkt, size_t len, uint32_t index)
+{
+	size_t l3 = tmpl->l3_offset, l4 = 0, ip_sum = 0, l4_sum = 0;
+	bool udp = false;
+	int n, num_ops;
+
+	/* locate the checksums to fix */
+
+	if (tmpl->csum && l3 + sizeof(struct iphdr) <= len) {
+
+		struct iphdr const *ip = (struct iphdr const *)(pkt + l3);
+
+		l4 = l3 + ip->ihl * 4;
+
+		if (tmpl->csum & Q_TX_CSUM_IP4)
+			ip_sum = l3 + offsetof(struct iphdr, check);
+
+		if (tmpl->csum & Q_TX_CSUM_L4) {
+			if (ip->protocol == IPPROTO_TCP)
+				l4_sum = l4 + 16;
+			else if (ip->protocol == IPPROTO_UDP) {
+				l4_sum = l4 + 6;
+				udp = true;
+			}
+		}
+
+		/* no room for the L4 checksum, or UDP without checksum */
+
+		if (l4_sum && (l4_sum + 2 > len || (udp && get_unaligned((__sum16 *)(pkt + l4_sum)) == 0)))
+			l4_sum = 0;
+	}
+
+	num_ops = min_t(int, tmpl->num_ops, Q_TX_TEMPLATE_MAX_OPS);
+
+	for(n = 0; n < num_ops; n++)
+	{
+		struct pfq_tx_mutation const *m = &tmpl->op[n];
+		size_t off = m->offset, a = 0, b = 0;
+		char old[8];
+		bool fix;
+
+		if ((m->size != 1 && m->size != 2 && m->size != 4) || off + m->size > len)
+			continue;
+
+		/* checksums are updated on the 16 bit words covering the field,
+		 * aligned to the IPv4 header */
+
+		fix = (ip_sum || l4_sum) && off >= l3;
+		if (fix) {
+			a = l3 + ((off - l3) & ~(size_t)1);
+			b = l3 + ALIGN(off + m->size - l3, 2);
+			if (b > len)
+				fix = false;
+			else
+				memcpy(old, pkt + a, b - a);
+		}
+
+		mutation_write(pkt + off, m->size, mutation_value(m, index));
+
+		if (fix) {
+			__wsum from = csum_partial(old, (int)(b - a), 0);
+			__wsum to   = csum_partial(pkt + a, (int)(b - a), 0);
+
+			if (ip_sum && off < l4)
+				csum_fix(pkt, ip_sum, from, to, false);
+
+			/* L4 header and payload, or addresses of the pseudo-header */
+
+			if (l4_sum && (off >= l4 || (off + m->size > l3 + 12 && off < l3 + 20)))
+				csum_fix(pkt, l4_sum, from, to, udp);
+		}
+	}
+}
@@ -0,0 +1,39 @@
+/***************************************************************
+ *
+ * (C) 2011-15 Nicola Bonelli <nicola@pfq.io>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ *
+ * The full GNU General Public License is included in this distribution in
+ * the file called "COPYING".
+ *
+ ****************************************************************/
+
+#ifndef PF_Q_TEMPLATE_H
+#define PF_Q_TEMPLATE_H
+
+#include <pragma/diagnostic_push>
+#include <linux/types.h>
+#include <pragma/diagnostic_pop>
+
+#include <linux/pf_q.h>
+
+
+/* mutate the packet as the copy 'index' of the template */
+
+extern void pfq_tx_template_apply(struct pfq_tx_template const *tmpl, char *pkt, size_t len, uint32_t index);
+
+
+#endif /* PF_Q_TEMPLATE_H */
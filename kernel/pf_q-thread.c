@@ -33,6 +33,8 @@
 #include <linux/kthread.h>
 #include <linux/mutex.h>
 #include <linux/jiffies.h>
+#include <linux/ktime.h>
+#include <linux/if_ether.h>
 
 #include <pragma/diagnostic_pop>
 
@@ -41,6 +43,7 @@
 #include <pf_q-memory.h>
 #include <pf_q-sock.h>
 #include <pf_q-transmit.h>
+#include <pf_q-global.h>
 
 
 
@@ -54,8 +57,8 @@ static struct pfq_thread_tx_data pfq_thread_tx_pool[Q_MAX_CPU] =
 		.cpu    = -1,
 		.node   = -1,
 		.task	= NULL,
-		.sock   = {NULL, NULL, NULL, NULL},
-		.sock_queue = {{-1}, {-1}, {-1}, {-1}}
+		.sock   = { [0 ... Q_MAX_TX_QUEUES-1] = NULL },
+		.sock_queue = { [0 ... Q_MAX_TX_QUEUES-1] = ATOMIC_INIT(-1) }
 	}
 };
 
@@ -79,10 +82,190 @@ pfq_tx_thread_dump(struct pfq_thread_tx_data const *data)
 }
 #endif
 
+/* true if the socket queue holds packets not yet consumed */
+
+static inline bool
+pfq_tx_queue_pending(struct pfq_sock *sock, int sock_queue, struct pfq_tx_queue *txm)
+{
+	return __atomic_load_n(&txm->prod.pos, __ATOMIC_RELAXED) != pfq_tx_queue_cons(&sock->opt, sock_queue, txm);
+}
+
+
+/* publish the sleeping state of the thread to the queues it serves:
+ * returns true if any of them has pending packets.
+ */
+
+static bool
+pfq_tx_thread_doorbell(struct pfq_thread_tx_data *data, unsigned int sleeping)
+{
+	bool pending = false;
+	int n;
+
+	for(n = 0; n < Q_MAX_TX_QUEUES; n++)
+	{
+		struct pfq_tx_queue *txm;
+		struct pfq_sock *sock;
+		int sock_queue;
+
+		sock_queue = atomic_read(&data->sock_queue[n]);
+		smp_rmb();
+		sock = data->sock[n];
+		if (sock_queue == -1 || sock == NULL)
+			continue;
+
+		txm = pfq_get_tx_queue(&sock->opt, sock_queue);
+		if (txm == NULL)
+			continue;
+
+		__atomic_store_n(&txm->cons.sleeping, sleeping, __ATOMIC_RELAXED);
+
+		/* pairs with the fence of the producer, between the offset
+		 * update and the load of the sleeping flag */
+
+		smp_mb();
+
+		if (sleeping && pfq_tx_queue_pending(sock, sock_queue, txm))
+			pending = true;
+	}
+
+	return pending;
+}
+
+
+/* the queue has packets to send (the Tx ring, or a pcap replay in progress) */
+
+static bool
+pfq_tx_queue_backlog(struct pfq_sock *sock, int sock_queue)
+{
+	struct pfq_tx_info *txinfo = pfq_get_tx_queue_info(&sock->opt, sock_queue);
+	struct pfq_tx_replay_state *st;
+	struct pfq_tx_queue *txm;
+
+	txm = pfq_get_tx_queue(&sock->opt, sock_queue);
+	if (txm && pfq_tx_queue_pending(sock, sock_queue, txm))
+		return true;
+
+	st = (struct pfq_tx_replay_state *)atomic_long_read(&txinfo->replay);
+	return st && st->active;
+}
+
+
+/* DRR quantum of a weighted Tx queue: 'weight' frames of the MTU of its
+ * default device (bytes) */
+
+static inline long
+pfq_tx_sched_quantum(struct pfq_tx_info const *txinfo)
+{
+	long frame = txinfo->def_dev ? (long)txinfo->def_dev->mtu + txinfo->def_dev->hard_header_len : ETH_FRAME_LEN;
+	return (long)txinfo->weight * frame;
+}
+
+
+/* a round of the Tx thread: the priority levels are served in strict order
+ * (a level is skipped for the next round as soon as a higher one has packets
+ * pending), the queues of a level by deficit round robin (in bytes). Returns
+ * the number of packets sent.
+ */
+
+static int
+pfq_tx_thread_round(struct pfq_thread_tx_data *data, bool *reg)
+{
+	unsigned int levels = 0;
+	int total_sent = 0, prio, n;
+
+	/* the priority levels in use */
+
+	for(n = 0; n < Q_MAX_TX_QUEUES; n++)
+	{
+		struct pfq_sock *sock;
+		int sock_queue;
+
+		sock_queue = atomic_read(&data->sock_queue[n]);
+		smp_rmb();
+		sock = data->sock[n];
+		if (sock_queue != -1 && sock != NULL)
+			levels |= 1U << pfq_get_tx_queue_info(&sock->opt, sock_queue)->prio;
+	}
+
+	if (levels == 0)
+		return 0;
+
+	*reg = true;
+
+	for(prio = Q_TX_MAX_PRIO - 1; prio >= 0; prio--)
+	{
+		if (!(levels & (1U << prio)))
+			continue;
+
+		/* strict priority: a higher level has packets pending? */
+
+		if (total_sent > 0) {
+			for(n = 0; n < Q_MAX_TX_QUEUES; n++)
+			{
+				struct pfq_sock *sock;
+				int sock_queue;
+
+				sock_queue = atomic_read(&data->sock_queue[n]);
+				smp_rmb();
+				sock = data->sock[n];
+				if (sock_queue != -1 && sock != NULL &&
+				    pfq_get_tx_queue_info(&sock->opt, sock_queue)->prio > prio &&
+				    pfq_tx_queue_backlog(sock, sock_queue))
+					return total_sent;
+			}
+		}
+
+		for(n = 0; n < Q_MAX_TX_QUEUES; n++)
+		{
+			struct pfq_tx_info *txinfo;
+			struct pfq_sock *sock;
+			long *credit = NULL;
+			int sock_queue, sent;
+
+			sock_queue = atomic_read(&data->sock_queue[n]);
+			smp_rmb();
+			sock = data->sock[n];
+			if (sock_queue == -1 || sock == NULL)
+				continue;
+
+			txinfo = pfq_get_tx_queue_info(&sock->opt, sock_queue);
+			if (txinfo->prio != prio)
+				continue;
+
+			/* weighted queue: a quantum is added to its deficit, which is
+			 * the credit (in bytes) of the round. The credit left unused is
+			 * carried over, up to a quantum plus a max-size packet */
+
+			if (txinfo->weight) {
+				long quantum = pfq_tx_sched_quantum(txinfo);
+				data->deficit[n] = min_t(long, data->deficit[n] + quantum, quantum + xmit_slot_size);
+				credit = &data->deficit[n];
+			}
+
+			sent = pfq_sk_queue_xmit(sock, sock_queue, data->cpu, data->node, &data->sock_queue[n], &data->aggr, credit);
+			if (!credit || *credit > 0)
+				sent += pfq_sk_replay_xmit(sock, sock_queue, data->cpu, data->node, &data->sock_queue[n], &data->aggr,
+							   credit);
+
+			total_sent += sent;
+
+			/* an idle queue does not save credit */
+
+			if (credit && !pfq_tx_queue_backlog(sock, sock_queue))
+				data->deficit[n] = 0;
+		}
+	}
+
+	return total_sent;
+}
+
+
 static int
 pfq_tx_thread(void *_data)
 {
 	struct pfq_thread_tx_data *data = (struct pfq_thread_tx_data *)_data;
+	ktime_t idle_start = ktime_set(0, 0);
+	bool idle = false;
 
 #ifdef PFQ_DEBUG
         int now = 0;
@@ -101,21 +284,13 @@ pfq_tx_thread(void *_data)
 	{
 		/* transmit the registered socket's queues */
 		bool reg = false;
-		int total_sent = 0, n;
+		int total_sent;
 
-		for(n = 0; n < Q_MAX_TX_QUEUES; n++)
-		{
-			struct pfq_sock *sock;
-			int sock_queue;
+		total_sent = pfq_tx_thread_round(data, &reg);
 
-			sock_queue = atomic_read(&data->sock_queue[n]);
-			smp_rmb();
-			sock = data->sock[n];
-			if (sock_queue != -1 && sock != NULL) {
-				reg = true;
-				total_sent += pfq_sk_queue_xmit(sock, sock_queue, data->cpu, data->node, &data->sock_queue[n]);
-			}
-		}
+		/* ring the doorbell of the hw queue left locked by the round */
+
+		pfq_xmit_aggr_flush(&data->aggr);
 
                 if (kthread_should_stop())
                         break;
@@ -129,11 +304,36 @@ pfq_tx_thread(void *_data)
 		}
 #endif
 
-		if (total_sent == 0)
-			schedule();
+		if (total_sent > 0) {
+			idle = false;
+			continue;
+		}
+
+		/* adaptive polling: keep spinning within the budget... */
+
+		if (reg) {
+			if (!idle) {
+				idle = true;
+				idle_start = ktime_get();
+			}
+
+			if (ktime_us_delta(ktime_get(), idle_start) < tx_poll_budget) {
+				schedule();
+				continue;
+			}
+		}
 
-		if (!reg)
-			msleep(1);
+		/* ...then sleep until the doorbell is rung (or a queue is bound) */
+
+		set_current_state(TASK_INTERRUPTIBLE);
+
+		if (!pfq_tx_thread_doorbell(data, 1) && !kthread_should_stop())
+			schedule_timeout(msecs_to_jiffies(Q_GRACE_PERIOD));
+
+		__set_current_state(TASK_RUNNING);
+
+		pfq_tx_thread_doorbell(data, 0);
+		idle = false;
 	}
 
         printk(KERN_INFO "[PFQ] Tx[%d] thread stopped on cpu %d.\n", data->id, data->cpu);
@@ -148,15 +348,16 @@ pfq_bind_tx_thread(int tid, struct pfq_sock *sock, int sock_queue)
 	struct pfq_thread_tx_data *thread_data;
 	int n;
 
+	mutex_lock(&pfq_thread_tx_pool_lock);
+
 	if (tid >= tx_thread_nr) {
+		mutex_unlock(&pfq_thread_tx_pool_lock);
 		printk(KERN_INFO "[PFQ] Tx[%d] thread not available (%d Tx threads running)!\n", tid, tx_thread_nr);
 		return -ESRCH;
 	}
 
 	thread_data = &pfq_thread_tx_pool[tid];
 
-	mutex_lock(&pfq_thread_tx_pool_lock);
-
 	for(n = 0; n < Q_MAX_TX_QUEUES; n++)
 	{
 		if (atomic_read(&thread_data->sock_queue[n]) == -1)
@@ -170,9 +371,13 @@ pfq_bind_tx_thread(int tid, struct pfq_sock *sock, int sock_queue)
 	}
 
 	thread_data->sock[n] = sock;
+	thread_data->deficit[n] = 0;
+	sock->opt.txq_async[sock_queue].task = thread_data->task;
 	smp_wmb();
 	atomic_set(&thread_data->sock_queue[n], sock_queue);
 
+	wake_up_process(thread_data->task);
+
         mutex_unlock(&pfq_thread_tx_pool_lock);
         printk(KERN_INFO "[PFQ] Tx[%d] thread bound to sock_id = %d, queue = %d...\n", tid, sock->id, sock_queue);
         return 0;
@@ -191,9 +396,11 @@ pfq_unbind_tx_thread(struct pfq_sock *sock)
 
 		for(i = 0; i < Q_MAX_TX_QUEUES; i++)
 		{
-			if (atomic_read(&data->sock_queue[i]) != -1)
+			int sock_queue = atomic_read(&data->sock_queue[i]);
+			if (sock_queue != -1)
 			{
 				if (data->sock[i] == sock) {
+					sock->opt.txq_async[sock_queue].task = NULL;
 					atomic_set(&data->sock_queue[i], -1);
 					smp_wmb();
 					msleep(Q_GRACE_PERIOD);
@@ -208,6 +415,59 @@ pfq_unbind_tx_thread(struct pfq_sock *sock)
 }
 
 
+static int
+pfq_start_tx_thread(int n, int cpu)
+{
+	struct pfq_thread_tx_data *data = &pfq_thread_tx_pool[n];
+	int err;
+
+	data->id = n;
+	data->cpu = cpu;
+	data->node = cpu_online(cpu) ? cpu_to_node(cpu) : NUMA_NO_NODE;
+	data->task = kthread_create_on_node(pfq_tx_thread,
+					    data, data->node,
+					    "kpfq/%d:%d", n, data->cpu);
+	if (IS_ERR(data->task)) {
+		printk(KERN_INFO "[PFQ] kernel_thread: create failed on cpu %d!\n",
+		       data->cpu);
+		err = PTR_ERR(data->task);
+		data->task = NULL;
+		return err;
+	}
+
+	kthread_bind(data->task, data->cpu);
+
+	pr_devel("[PFQ] created Tx[%d] kthread on cpu %d...\n", data->id, data->cpu);
+
+	wake_up_process(data->task);
+	return 0;
+}
+
+
+static void
+pfq_stop_tx_thread(int n)
+{
+	struct pfq_thread_tx_data *data = &pfq_thread_tx_pool[n];
+
+	if (data->task)
+	{
+		int i;
+		pr_devel("[PFQ stopping Tx[%d] thread@%p\n", data->id, data->task);
+
+		kthread_stop(data->task);
+		data->id   = -1;
+		data->cpu  = -1;
+		data->task = NULL;
+
+		for(i=0; i < Q_MAX_TX_QUEUES; ++i)
+		{
+			atomic_set(&data->sock_queue[i], -1);
+			data->sock[i] = NULL;
+		}
+	}
+}
+
+
 int
 pfq_start_all_tx_threads(void)
 {
@@ -220,27 +480,8 @@ pfq_start_all_tx_threads(void)
 
 		for(n = 0; n < tx_thread_nr; n++)
 		{
-			struct pfq_thread_tx_data *data = &pfq_thread_tx_pool[n];
-
-			data->id = n;
-			data->cpu = tx_affinity[n];
-			data->node = cpu_online(tx_affinity[n]) ? cpu_to_node(tx_affinity[n]) : NUMA_NO_NODE;
-			data->task = kthread_create_on_node(pfq_tx_thread,
-							    data, data->node,
-							    "kpfq/%d:%d", n, data->cpu);
-			if (IS_ERR(data->task)) {
-				printk(KERN_INFO "[PFQ] kernel_thread: create failed on cpu %d!\n",
-				       data->cpu);
-				err = PTR_ERR(data->task);
-				data->task = NULL;
+			if ((err = pfq_start_tx_thread(n, tx_affinity[n])) < 0)
 				return err;
-			}
-
-			kthread_bind(data->task, data->cpu);
-
-			pr_devel("[PFQ] created Tx[%d] kthread on cpu %d...\n", data->id, data->cpu);
-
-			wake_up_process(data->task);
 		}
 	}
 
@@ -258,26 +499,101 @@ pfq_stop_all_tx_threads(void)
 		printk(KERN_INFO "[PFQ] stopping %d Tx thread(s)...\n", tx_thread_nr);
 
 		for(n = 0; n < tx_thread_nr; n++)
-		{
-			struct pfq_thread_tx_data *data = &pfq_thread_tx_pool[n];
+			pfq_stop_tx_thread(n);
+	}
+}
 
-			if (data->task)
-			{
-				int i;
-				pr_devel("[PFQ stopping Tx[%d] thread@%p\n", data->id, data->task);
 
-				kthread_stop(data->task);
-				data->id   = -1;
-				data->cpu  = -1;
-				data->task = NULL;
+/* resize the pool of Tx threads at runtime: threads are appended (and removed)
+ * at the end of the pool, so that the index of the running ones never changes.
+ */
 
-				for(i=0; i < Q_MAX_TX_QUEUES; ++i)
-				{
-					atomic_set(&data->sock_queue[i], -1);
-					data->sock[i] = NULL;
-				}
-			}
+int
+pfq_add_tx_thread(int cpu)
+{
+	int n, err;
+
+	if (cpu < 0 || cpu >= nr_cpu_ids || !cpu_online(cpu)) {
+		printk(KERN_INFO "[PFQ] Tx thread: bad affinity on cpu:%d!\n", cpu);
+		return -EINVAL;
+	}
+
+	mutex_lock(&pfq_thread_tx_pool_lock);
+
+	if (tx_thread_nr >= Q_MAX_CPU) {
+		mutex_unlock(&pfq_thread_tx_pool_lock);
+		printk(KERN_INFO "[PFQ] Tx thread: pool full (%d threads)!\n", tx_thread_nr);
+		return -EBUSY;
+	}
+
+	for(n = 0; n < tx_thread_nr; n++)
+	{
+		if (pfq_thread_tx_pool[n].cpu == cpu) {
+			mutex_unlock(&pfq_thread_tx_pool_lock);
+			printk(KERN_INFO "[PFQ] Tx thread: affinity for cpu:%d already in use!\n", cpu);
+			return -EBUSY;
 		}
 	}
+
+	n = tx_thread_nr;
+
+	if ((err = pfq_start_tx_thread(n, cpu)) < 0) {
+		mutex_unlock(&pfq_thread_tx_pool_lock);
+		return err;
+	}
+
+	tx_affinity[n] = cpu;
+	tx_thread_nr++;
+
+	mutex_unlock(&pfq_thread_tx_pool_lock);
+
+	printk(KERN_INFO "[PFQ] Tx[%d] thread added on cpu %d.\n", n, cpu);
+	return n;
+}
+
+
+int
+pfq_del_tx_thread(void)
+{
+	struct pfq_thread_tx_data *data;
+	int n, i;
+
+	mutex_lock(&pfq_thread_tx_pool_lock);
+
+	if (tx_thread_nr == 0) {
+		mutex_unlock(&pfq_thread_tx_pool_lock);
+		return -ESRCH;
+	}
+
+	n = tx_thread_nr - 1;
+	data = &pfq_thread_tx_pool[n];
+
+	for(i = 0; i < Q_MAX_TX_QUEUES; i++)
+	{
+		if (atomic_read(&data->sock_queue[i]) != -1) {
+			mutex_unlock(&pfq_thread_tx_pool_lock);
+			printk(KERN_INFO "[PFQ] Tx[%d] thread busy (socket queues bound)!\n", n);
+			return -EBUSY;
+		}
+	}
+
+	pfq_stop_tx_thread(n);
+	tx_thread_nr--;
+
+	mutex_unlock(&pfq_thread_tx_pool_lock);
+
+	printk(KERN_INFO "[PFQ] Tx[%d] thread removed.\n", n);
+	return 0;
+}
+
+
+int
+pfq_get_tx_thread_nr(void)
+{
+	int ret;
+	mutex_lock(&pfq_thread_tx_pool_lock);
+	ret = tx_thread_nr;
+	mutex_unlock(&pfq_thread_tx_pool_lock);
+	return ret;
 }
 
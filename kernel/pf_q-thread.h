@@ -35,6 +35,7 @@
 
 #include <pf_q-sock.h>
 #include <pf_q-define.h>
+#include <pf_q-transmit.h>
 
 extern struct task_struct *kthread_tx_pool [Q_MAX_CPU];
 
@@ -44,6 +45,10 @@ extern void pfq_stop_all_tx_threads(void);
 extern int pfq_bind_tx_thread(int tx_index, struct pfq_sock *sock, int sock_queue);
 extern int pfq_unbind_tx_thread(struct pfq_sock *sock);
 
+extern int pfq_add_tx_thread(int cpu);
+extern int pfq_del_tx_thread(void);
+extern int pfq_get_tx_thread_nr(void);
+
 
 static inline
 void pfq_relax(void)
@@ -63,6 +68,8 @@ struct pfq_thread_tx_data
 	struct task_struct *	task;
 	struct pfq_sock *	sock[Q_MAX_TX_QUEUES];
 	atomic_t		sock_queue[Q_MAX_TX_QUEUES];
+	long			deficit[Q_MAX_TX_QUEUES];	/* DRR, in bytes (weighted queues) */
+	struct pfq_xmit_aggr	aggr;
 
 } __attribute__((aligned(64)));
 
@@ -35,6 +35,13 @@
 #include <linux/skbuff.h>
 #include <linux/netdevice.h>
 #include <linux/delay.h>
+#include <linux/hrtimer.h>
+#include <linux/vmalloc.h>
+#include <linux/slab.h>
+#include <linux/errqueue.h>
+#include <linux/swab.h>
+#include <linux/math64.h>
+#include <asm/unaligned.h>
 
 #include <pragma/diagnostic_pop>
 
@@ -46,6 +53,7 @@
 #include <pf_q-global.h>
 #include <pf_q-printk.h>
 #include <pf_q-netdev.h>
+#include <pf_q-template.h>
 
 #include <lang/GC.h>
 
@@ -82,7 +90,7 @@ pfq_netdev_pick_tx(struct net_device *dev, struct sk_buff *skb, int *queue)
 			: 0;
 	}
 
-	*queue = __pfq_dev_cap_txqueue(dev, *queue);
+	*queue = pfq_txq_shared(dev, __pfq_dev_cap_txqueue(dev, *queue), 0);
 
 	return netdev_get_tx_queue(dev, *queue);
 }
@@ -96,36 +104,87 @@ bool giveup_tx_process(atomic_t const *stop)
 }
 
 
+/* wait until the given time (ns): sleep on an hrtimer for the bulk of the
+ * interval and spin only for the last Q_TX_SPIN_NS.
+ */
+
 static inline
 ktime_t wait_until(uint64_t ts, atomic_t const *stop, bool *intr)
 {
-	ktime_t now;
-	do
+	ktime_t now = ktime_get_real();
+
+	while (ktime_to_ns(now) + Q_TX_SPIN_NS < ts)
+	{
+		ktime_t delta = ns_to_ktime(ts - ktime_to_ns(now) - Q_TX_SPIN_NS);
+
+		set_current_state(TASK_INTERRUPTIBLE);
+		schedule_hrtimeout_range(&delta, Q_TX_SPIN_NS/2, HRTIMER_MODE_REL);
+
+		now = ktime_get_real();
+		if (giveup_tx_process(stop)) {
+			*intr= true;
+			return now;
+		}
+	}
+
+	while (ktime_to_ns(now) < ts)
 	{
+		pfq_relax();
+
 		now = ktime_get_real();
 		if (giveup_tx_process(stop)) {
 			*intr= true;
 			return now;
 		}
 	}
-	while (ktime_to_ns(now) < ts
-	       && (pfq_relax(), true));
 
 	return now;
 }
 
 
+/* cost of a packet (ns) for the pacer of the queue */
+
+static inline
+uint64_t pfq_tx_pacer_cost(struct pfq_tx_pacer const *p, size_t len)
+{
+	uint64_t bytes_ns = p->byte_ps ? div_u64((uint64_t)len * p->byte_ps, 1000) : 0;
+	return max(p->pkt_ns, bytes_ns);
+}
+
+
+/* bytes charged to the DRR credit of the queue (Tx scheduling) for a record */
+
 static inline
-ptrdiff_t swap_sk_tx_queue(struct pfq_tx_queue *txm, int *prod)
+long pfq_tx_sched_cost(struct pfq_pkthdr const *hdr)
 {
-	*prod = __atomic_load_n(&txm->prod.index, __ATOMIC_RELAXED);
-	if (*prod == __atomic_load_n(&txm->cons.index, __ATOMIC_RELAXED))
+	return (long)hdr->caplen * (long)max_t(unsigned int, hdr->data.copies, 1);
+}
+
+
+/* get the contiguous segment of the Tx ring starting at the consumer cursor
+ * (up to the producer cursor or the end of the ring), skipping the tail of the
+ * ring left unused by the producer. The cursor never passes prod, whatever is
+ * written in the ring. Returns the length of the segment.
+ */
+
+static inline
+size_t sk_tx_ring_segment(struct pfq_tx_queue *txm, char *base, size_t *cons, size_t prod, char **begin)
+{
+	while (*cons != prod)
 	{
-		__atomic_store_n(&txm->cons.index, *prod+1, __ATOMIC_RELAXED);
-		txm->cons.off = 0;
+		size_t off = *cons % txm->size;
+		size_t rem = txm->size - off;
+
+		if (Q_TX_RING_SKIP((struct pfq_pkthdr *)(base + off), rem)) {
+			*cons += min(rem, prod - *cons);
+			continue;
+		}
+
+		*begin = base + off;
+		return min(prod - *cons, rem);
 	}
 
-	return __atomic_load_n((*prod & 1) ? &txm->prod.off1 : &txm->prod.off0, __ATOMIC_ACQUIRE);
+	return 0;
 }
 
 
@@ -149,6 +208,281 @@ unsigned int dev_tx_skb_copies(struct net_device *dev, unsigned int req_copies)
 }
 
 
+/* zero-copy Tx: the skb carries the first bytes of the packet in its
+ * linear part, the rest is attached as frags pointing to the pages of the
+ * mmapped Tx memory. The slot is held (cons.pos does not pass it) until the
+ * driver releases the skb, then it is pushed to the completion ring.
+ */
+
+struct pfq_tx_zerocopy
+{
+	struct ubuf_info	ubuf;
+	struct pfq_tx_zc_queue	*zc;
+	unsigned int		rec;
+	uint32_t		off;
+};
+
+
+static void
+pfq_tx_zc_put(struct pfq_tx_zc_queue *zc)
+{
+	if (atomic_dec_and_test(&zc->refcnt))
+		kfree(zc);
+}
+
+
+/* release to the producer the records up to the oldest one in flight:
+ * called with the lock held */
+
+static void
+pfq_tx_zc_release(struct pfq_tx_zc_queue *zc)
+{
+	while (zc->tail != zc->head && zc->rec[zc->tail & (Q_TX_COMPLETION_LEN-1)].done)
+		zc->tail++;
+
+	if (zc->txm)
+		__atomic_store_n(&zc->txm->cons.pos,
+				 zc->tail != zc->head ? zc->rec[zc->tail & (Q_TX_COMPLETION_LEN-1)].pos : zc->cons,
+				 __ATOMIC_RELEASE);
+}
+
+
+static void
+pfq_tx_zerocopy_complete(struct ubuf_info *ubuf, bool success)
+{
+	struct pfq_tx_zerocopy *tz = container_of(ubuf, struct pfq_tx_zerocopy, ubuf);
+	struct pfq_tx_zc_queue *zc = tz->zc;
+	unsigned long flags;
+
+	spin_lock_irqsave(&zc->lock, flags);
+
+	zc->rec[tz->rec & (Q_TX_COMPLETION_LEN-1)].done = true;
+
+	if (zc->ring) {
+		struct pfq_tx_completion_ring *ring = zc->ring;
+		unsigned int seq = ring->head;
+		struct pfq_tx_completion *c = &ring->ring[seq & (Q_TX_COMPLETION_LEN-1)];
+
+		if (seq - READ_ONCE(ring->tail) >= Q_TX_COMPLETION_LEN)
+			ring->overflow++;
+
+		c->off = tz->off;
+		__atomic_store_n(&c->seq, seq + 1, __ATOMIC_RELEASE);
+		__atomic_store_n(&ring->head, seq + 1, __ATOMIC_RELEASE);
+	}
+
+	pfq_tx_zc_release(zc);
+
+	spin_unlock_irqrestore(&zc->lock, flags);
+
+	pfq_tx_zc_put(zc);
+	kfree(tz);
+}
+
+
+/* the records in flight are bounded by the length of the completion ring:
+ * when it is full packets are copied */
+
+static inline bool
+pfq_tx_zc_full(struct pfq_tx_zc_queue const *zc)
+{
+	return zc->head - READ_ONCE(zc->tail) >= Q_TX_COMPLETION_LEN;
+}
+
+
+static struct sk_buff *
+pfq_alloc_zerocopy_skb(struct pfq_pkthdr *hdr, size_t len, struct pfq_mbuff_xmit_context *ctx, int node)
+{
+	struct pfq_tx_zc_queue *zc = ctx->zerocopy;
+	char *data = (char *)(hdr+1);
+	struct pfq_tx_zerocopy *tz;
+	struct pfq_tx_zc_record *r;
+	struct sk_buff *skb;
+	unsigned long flags;
+	size_t off;
+
+	tz = kmalloc_node(sizeof(*tz), GFP_ATOMIC, node);
+	if (unlikely(tz == NULL))
+		return NULL;
+
+	skb = __alloc_skb(Q_TX_ZEROCOPY_HEAD, GFP_ATOMIC, 0, node);
+	if (unlikely(skb == NULL)) {
+		kfree(tz);
+		return NULL;
+	}
+
+	sparse_inc(&memory_stats, os_alloc);
+
+	__skb_put(skb, Q_TX_ZEROCOPY_HEAD);
+	skb_copy_to_linear_data(skb, data, Q_TX_ZEROCOPY_HEAD);
+
+	for(off = Q_TX_ZEROCOPY_HEAD; off < len;)
+	{
+		struct page *page = pfq_shared_memory_page(&ctx->so->shmem, data + off);
+		size_t pg_off = offset_in_page(data + off);
+		size_t n = min_t(size_t, PAGE_SIZE - pg_off, len - off);
+
+		get_page(page);
+		skb_fill_page_desc(skb, skb_shinfo(skb)->nr_frags, page, pg_off, n);
+		off += n;
+	}
+
+	skb->len      += len - Q_TX_ZEROCOPY_HEAD;
+	skb->data_len  = len - Q_TX_ZEROCOPY_HEAD;
+	skb->truesize += len - Q_TX_ZEROCOPY_HEAD;
+
+	/* hold the record until the completion */
+
+	spin_lock_irqsave(&zc->lock, flags);
+
+	r = &zc->rec[zc->head & (Q_TX_COMPLETION_LEN-1)];
+	r->pos = ctx->pos;
+	r->done = false;
+	tz->rec = zc->head++;
+
+	spin_unlock_irqrestore(&zc->lock, flags);
+
+	atomic_inc(&zc->refcnt);
+
+	tz->ubuf.callback = pfq_tx_zerocopy_complete;
+	tz->ubuf.ctx = NULL;
+	tz->ubuf.desc = 0;
+	tz->zc  = zc;
+	tz->off = (uint32_t)((char *)hdr - ctx->tx_base);
+
+	skb_shinfo(skb)->destructor_arg = &tz->ubuf;
+	skb_shinfo(skb)->tx_flags |= SKBTX_DEV_ZEROCOPY;
+
+	return skb;
+}
+
+
+/* the Tx thread consumed the ring up to cons */
+
+static void
+pfq_tx_zc_consume(struct pfq_tx_zc_queue *zc, size_t cons)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&zc->lock, flags);
+	zc->cons = cons;
+	pfq_tx_zc_release(zc);
+	spin_unlock_irqrestore(&zc->lock, flags);
+}
+
+
+int
+pfq_tx_zc_enable(struct pfq_tx_info *txinfo, struct pfq_tx_queue *txm,
+		 struct pfq_tx_completion_ring *ring, int node)
+{
+	struct pfq_tx_zc_queue *zc;
+
+	zc = kzalloc_node(sizeof(*zc), GFP_KERNEL, node);
+	if (zc == NULL)
+		return -ENOMEM;
+
+	spin_lock_init(&zc->lock);
+	atomic_set(&zc->refcnt, 1);
+	zc->txm = txm;
+	zc->ring = ring;
+
+	txinfo->zc = zc;
+	return 0;
+}
+
+
+/* wait for the skbs in flight up to the deadline, then detach the state from
+ * the shared memory: late completions only release it */
+
+void
+pfq_tx_zc_disable(struct pfq_sock *so, struct pfq_tx_info *txinfo, unsigned long deadline)
+{
+	struct pfq_tx_zc_queue *zc = txinfo->zc;
+	unsigned long flags;
+	int inflight;
+
+	if (zc == NULL)
+		return;
+
+	txinfo->zc = NULL;
+
+	while (atomic_read(&zc->refcnt) > 1 && time_before(jiffies, deadline))
+		msleep(Q_GRACE_PERIOD);
+
+	spin_lock_irqsave(&zc->lock, flags);
+	zc->txm = NULL;
+	zc->ring = NULL;
+	spin_unlock_irqrestore(&zc->lock, flags);
+
+	inflight = atomic_read(&zc->refcnt) - 1;
+	if (inflight > 0)
+		printk(KERN_WARNING "[PFQ|%d] Tx zerocopy: %d skbs still in flight, memory released!\n",
+		       so->id, inflight);
+
+	pfq_tx_zc_put(zc);
+}
+
+
+/* Tx timestamps: hw timestamps come back through the error queue of the
+ * socket, keyed by queue and record id.
+ */
+
+#define PFQ_TX_TSKEY(queue, id)		(((uint32_t)((queue) + 1) << 24) | ((id) & Q_TX_TSTAMP_ID_MASK))
+
+
+static void
+pfq_tx_tstamp_push(struct pfq_sock *so, int queue, uint32_t id, uint64_t sw, uint64_t hw)
+{
+	struct pfq_tx_tstamp_ring *ts = so->opt.tx_tstamp_ring;
+	struct pfq_tx_tstamp *t;
+	unsigned int seq;
+
+	if (unlikely(ts == NULL))
+		return;
+
+	seq = __atomic_fetch_add(&ts->head, 1, __ATOMIC_RELAXED);
+	t = &ts->ring[seq & (Q_TX_TSTAMP_LEN-1)];
+
+	t->queue = (int16_t)queue;
+	t->id = id & Q_TX_TSTAMP_ID_MASK;
+	t->sw = sw;
+	t->hw = hw;
+
+	__atomic_store_n(&t->seq, seq + 1, __ATOMIC_RELEASE);
+}
+
+
+static inline void
+pfq_tx_tstamp_request(struct sk_buff *skb, struct pfq_mbuff_xmit_context *ctx)
+{
+#if(LINUX_VERSION_CODE >= KERNEL_VERSION(4,0,0))
+	skb_set_owner_w(skb, &ctx->so->sk);
+	skb_shinfo(skb)->tx_flags |= SKBTX_HW_TSTAMP;
+	skb_shinfo(skb)->tskey = PFQ_TX_TSKEY(ctx->sock_queue, ctx->tstamp_id);
+#endif
+}
+
+
+void
+pfq_tx_tstamp_drain(struct pfq_sock *so)
+{
+#if(LINUX_VERSION_CODE >= KERNEL_VERSION(4,0,0))
+	struct sk_buff *skb;
+
+	while ((skb = sock_dequeue_err_skb(&so->sk)) != NULL)
+	{
+		struct sock_exterr_skb *serr = SKB_EXT_ERR(skb);
+		uint64_t hw = (uint64_t)ktime_to_ns(skb_hwtstamps(skb)->hwtstamp);
+
+		if (serr->ee.ee_origin == SO_EE_ORIGIN_TIMESTAMPING && hw)
+			pfq_tx_tstamp_push(so, (int)(serr->ee.ee_data >> 24) - 1, serr->ee.ee_data, 0, hw);
+
+		kfree_skb(skb);
+	}
+#endif
+}
+
+
 static inline
 devq_id_t
 make_devq_id(struct pfq_pkthdr *hdr, devq_id_t const default_qid)
@@ -161,16 +495,127 @@ make_devq_id(struct pfq_pkthdr *hdr, devq_id_t const default_qid)
 
 
 
+/* a new socket buffer (from the pool) with a copy of the packet */
+
+static inline struct sk_buff *
+pfq_tx_copy_skb(const char *data, size_t len, struct pfq_mbuff_xmit_context *ctx, int node,
+		struct pfq_skb_pool *skb_pool)
+{
+	struct sk_buff *skb;
+
+	skb = pfq_alloc_skb_pool(xmit_slot_size, GFP_KERNEL, node, skb_pool);
+	if (unlikely(skb == NULL)) {
+		sparse_inc(&global_drops, reason[pfq_skb_pool_drop_reason(skb_pool)]);
+		if (printk_ratelimit())
+			printk(KERN_INFO "[PFQ] Tx could not allocate an skb!\n");
+		return NULL;
+	}
+
+	/* fill the socket buffer */
+
+	skb_reset_tail_pointer(skb);
+	skb->dev = ctx->dev_queue.dev;
+	skb->len = 0;
+
+	__skb_put(skb, len);
+
+	skb_copy_to_linear_data(skb, data, len);
+	return skb;
+}
+
+
+/* send the skb held back for the aggregation stage: the lock of the hw queue is held.
+ * As in the main loop, it is retried until sent or the Tx process gives up; then
+ * the packet, already counted as sent by its producer, is counted as discarded. */
+
+static void
+pfq_xmit_held(struct sk_buff *skb, struct pfq_skb_pool *skb_pool, struct pfq_sock_stats __percpu *stats,
+	      atomic_t const *stop, struct net_dev_queue *dq, int xmit_more)
+{
+	for(;;)
+	{
+		skb_get(skb);
+
+		if (__pfq_xmit(skb, dq->dev, xmit_more) >= 0) {
+			dq->queue->trans_start = jiffies;
+			break;
+		}
+
+		if (need_resched()) {
+			pfq_hard_tx_unlock(dq);
+			local_bh_enable();
+
+			pfq_relax();
+
+			local_bh_disable();
+			pfq_hard_tx_lock(dq);
+		}
+
+		if (giveup_tx_process(stop)) {
+			sparse_dec(stats, sent);
+			sparse_inc(stats, disc);
+			sparse_dec(&global_stats, sent);
+			sparse_inc(&global_stats, disc);
+			break;
+		}
+	}
+
+	pfq_kfree_skb_pool(skb, skb_pool);
+}
+
+
+static inline void
+pfq_xmit_context_unlock(struct pfq_mbuff_xmit_context *ctx)
+{
+	/* the doorbell is rung before releasing the hw queue */
+
+	if (ctx->held) {
+		pfq_xmit_held(ctx->held, ctx->held_pool, ctx->held_stats, ctx->held_stop, &ctx->dev_queue, 0);
+		ctx->held = NULL;
+	}
+
+	pfq_hard_tx_unlock(&ctx->dev_queue);
+	local_bh_enable();
+}
+
+
+static inline void
+pfq_xmit_context_lock(struct pfq_mbuff_xmit_context *ctx)
+{
+	local_bh_disable();
+	pfq_hard_tx_lock(&ctx->dev_queue);
+}
+
+
+void
+pfq_xmit_aggr_flush(struct pfq_xmit_aggr *aggr)
+{
+	if (aggr->dev_queue.dev == NULL)
+		return;
+
+	if (aggr->skb) {
+		pfq_xmit_held(aggr->skb, aggr->skb_pool, aggr->skb_stats, aggr->skb_stop, &aggr->dev_queue, 0);
+		aggr->skb = NULL;
+	}
+
+	pfq_hard_tx_unlock(&aggr->dev_queue);
+	local_bh_enable();
+
+	dev_put(aggr->dev_queue.dev);
+	aggr->dev_queue.dev = NULL;
+}
+
+
 static int
-__pfq_mbuff_xmit(struct pfq_pkthdr *hdr, struct pfq_mbuff_xmit_context *ctx, int slot_size,
-	       int node, atomic_t const *stop, bool last_pkt, bool *intr)
+__pfq_mbuff_xmit(struct pfq_pkthdr *hdr, const char *data, struct pfq_tx_template const *tmpl,
+		 struct pfq_mbuff_xmit_context *ctx, int node, atomic_t const *stop, devq_id_t next_qid, bool *intr)
 {
 	unsigned int copies, total_copies;
-	devq_id_t cur_qid, next_qid;
-	struct pfq_pkthdr *next;
+	struct pfq_skb_pool *skb_pool;
 	struct sk_buff *skb;
+	devq_id_t cur_qid;
 	size_t len;
-	bool last;
+	bool last, hw_tstamp;
 
 	/* skip this packet ? */
 
@@ -178,11 +623,6 @@ __pfq_mbuff_xmit(struct pfq_pkthdr *hdr, struct pfq_mbuff_xmit_context *ctx, int
 	if (unlikely(PFQ_NETQ_IS_NULL(cur_qid)))
 		return 0;
 
-	/* get next_qid ...*/
-
-	next = Q_NEXT_PKTHDR(hdr, slot_size);
-	next_qid = last_pkt ? PFQ_NETQ_NULL : make_devq_id(next, ctx->default_qid);
-
 
 	/* dev_queue switch, or relax the batch queue (at the first packet of
 	 * this new batch) ? */
@@ -191,18 +631,16 @@ __pfq_mbuff_xmit(struct pfq_pkthdr *hdr, struct pfq_mbuff_xmit_context *ctx, int
 
 	if (ctx->prec_qid != cur_qid || (ctx->batch_cntr == 1 && need_resched())) {
 
-		pfq_hard_tx_unlock(&ctx->dev_queue);
-		local_bh_enable();
+		pfq_xmit_context_unlock(ctx);
 
 		dev_queue_put(ctx->net, &ctx->default_dev, &ctx->dev_queue);
 
 		if (ctx->batch_cntr == 1)
 			schedule();
 
-		dev_queue_get(ctx->net, &ctx->default_dev, cur_qid , &ctx->dev_queue);
+		dev_queue_get(ctx->net, &ctx->default_dev, cur_qid, ctx->owner, &ctx->dev_queue);
 
-		local_bh_disable();
-		pfq_hard_tx_lock(&ctx->dev_queue);
+		pfq_xmit_context_lock(ctx);
 
 		ctx->prec_qid  = cur_qid;
 		ctx->batch_cntr = 1;
@@ -210,7 +648,7 @@ __pfq_mbuff_xmit(struct pfq_pkthdr *hdr, struct pfq_mbuff_xmit_context *ctx, int
 
 	/* is this the last skb of the batch ? */
 
-	if (ctx->batch_cntr >= xmit_batch_len || cur_qid != next_qid || last_pkt) {
+	if (ctx->batch_cntr >= xmit_batch_len || cur_qid != next_qid) {
 		last = true;
 		ctx->batch_cntr = 0;
 	}
@@ -230,46 +668,112 @@ __pfq_mbuff_xmit(struct pfq_pkthdr *hdr, struct pfq_mbuff_xmit_context *ctx, int
 
 	if (hdr->tstamp.tv64 > ktime_to_ns(ctx->now)) {
 
-		pfq_hard_tx_unlock(&ctx->dev_queue);
-		local_bh_enable();
+		pfq_xmit_context_unlock(ctx);
 
 		ctx->now = wait_until(hdr->tstamp.tv64, stop, intr);
 
-		local_bh_disable();
-		pfq_hard_tx_lock(&ctx->dev_queue);
+		pfq_xmit_context_lock(ctx);
 
 		if (*intr)
 			return 0;
 	}
 
-	/* allocate a new socket buffer */
+	len = min_t(size_t, hdr->caplen - (tmpl ? sizeof(*tmpl) : 0), xmit_slot_size);
 
-	skb = pfq_alloc_skb_pool(xmit_slot_size, GFP_KERNEL, node, ctx->skb_pool);
-	if (unlikely(skb == NULL)) {
-		if (printk_ratelimit())
-			printk(KERN_INFO "[PFQ] Tx could not allocate an skb!\n");
-		return 0;
+	/* the copies of a template are distinct skbs: no sharing required */
+
+	if (tmpl)
+		total_copies = copies = max_t(unsigned int, hdr->data.copies, 1);
+	else
+		total_copies = copies = dev_tx_skb_copies(ctx->dev_queue.dev, hdr->data.copies);
+
+	/* hw timestamps are requested on skbs not shared among copies */
+
+	hw_tstamp = (ctx->tstamp & Q_TX_TSTAMP_HW) && (tmpl || total_copies == 1);
+
+	/* pace the queue ? */
+
+	if (pfq_tx_pacer_enabled(ctx->pacer)) {
+
+		struct pfq_tx_pacer *p = ctx->pacer;
+		uint64_t cost = pfq_tx_pacer_cost(p, len) * copies;
+		uint64_t tol  = (p->burst - 1) * cost;
+		uint64_t now  = ktime_to_ns(ctx->now);
+
+		if (p->tat > now + tol) {
+
+			pfq_xmit_context_unlock(ctx);
+
+			ctx->now = wait_until(p->tat - tol, stop, intr);
+
+			pfq_xmit_context_lock(ctx);
+
+			if (*intr)
+				return 0;
+
+			now = ktime_to_ns(ctx->now);
+		}
+
+		p->tat = max(p->tat, now) + cost;
 	}
 
-	/* fill the socket buffer */
+	/* zero-copy skb or a new socket buffer from the pool */
 
-	len = min_t(size_t, hdr->caplen, xmit_slot_size);
+	if (!tmpl && ctx->zerocopy && len > Q_TX_ZEROCOPY_HEAD &&
+	    (ctx->dev_queue.dev->features & NETIF_F_SG) && !pfq_tx_zc_full(ctx->zerocopy)) {
 
-	skb_reset_tail_pointer(skb);
-	skb->dev = ctx->dev_queue.dev;
-	skb->len = 0;
+		skb_pool = NULL;
+		skb = pfq_alloc_zerocopy_skb(hdr, len, ctx, node);
+		if (unlikely(skb == NULL)) {
+			sparse_inc(&global_drops, reason[Q_DROP_NOMEM]);
+			if (printk_ratelimit())
+				printk(KERN_INFO "[PFQ] Tx could not allocate a zero-copy skb!\n");
+			return 0;
+		}
 
-	__skb_put(skb, len);
+		skb->dev = ctx->dev_queue.dev;
+	}
+	else {
+		/* skbs owned by the socket (hw timestamps) are not recycled */
+		skb_pool = hw_tstamp ? NULL : ctx->skb_pool;
+		skb = pfq_tx_copy_skb(data, len, ctx, node, skb_pool);
+		if (unlikely(skb == NULL))
+			return 0;
+
+		if (tmpl)
+			pfq_tx_template_apply(tmpl, skb->data, len, 0);
+	}
+
+	if (hw_tstamp)
+		pfq_tx_tstamp_request(skb, ctx);
 
 	skb_set_queue_mapping(skb, ctx->dev_queue.queue_mapping);
-	skb_copy_to_linear_data(skb, hdr+1, len < 64 ? 64 : len);
 
-	/* transmit the packet(s) */
+	/* the last packet of the drain is held back: the next producer of this
+	 * hw queue in the round (or the flush of the stage) rings the doorbell */
 
-	total_copies = copies = dev_tx_skb_copies(ctx->dev_queue.dev, hdr->data.copies);
+	if (ctx->aggr && last && PFQ_NETQ_IS_NULL(next_qid) && !tmpl && total_copies == 1 && !ctx->tstamp) {
+		if (ctx->held)
+			pfq_xmit_held(ctx->held, ctx->held_pool, ctx->held_stats, ctx->held_stop, &ctx->dev_queue, 1);
+		ctx->held = skb;
+		ctx->held_pool = skb_pool;
+		ctx->held_stats = ctx->so->stats;
+		ctx->held_stop = stop;
+		return 1;
+	}
+
+	/* a packet held back by the previous producer goes first */
+
+	if (ctx->held) {
+		pfq_xmit_held(ctx->held, ctx->held_pool, ctx->held_stats, ctx->held_stop, &ctx->dev_queue, 1);
+		ctx->held = NULL;
+	}
+
+	/* transmit the packet(s) */
 
 	do {
-		const bool xmit_more = !last || copies != 1;
+		/* templates may be long: the NIC is flushed every batch */
+		const bool xmit_more = copies != 1 ? !(tmpl && (copies - 1) % xmit_batch_len == 0) : !last;
 
 		skb_get(skb);
 
@@ -278,17 +782,15 @@ __pfq_mbuff_xmit(struct pfq_pkthdr *hdr, struct pfq_mbuff_xmit_context *ctx, int
 			ctx->batch_cntr = 0;
 
 			if (need_resched()) {
-				pfq_hard_tx_unlock(&ctx->dev_queue);
-				local_bh_enable();
+				pfq_xmit_context_unlock(ctx);
 
 				pfq_relax();
 
-				local_bh_disable();
-				pfq_hard_tx_lock(&ctx->dev_queue);
+				pfq_xmit_context_lock(ctx);
 			}
 
 			if (giveup_tx_process(stop)) {
-				pfq_kfree_skb_pool(skb, ctx->skb_pool);
+				pfq_kfree_skb_pool(skb, skb_pool);
 				*intr = true;
 				return total_copies - copies;
 			}
@@ -296,27 +798,111 @@ __pfq_mbuff_xmit(struct pfq_pkthdr *hdr, struct pfq_mbuff_xmit_context *ctx, int
 		else {
 			ctx->dev_queue.queue->trans_start = ctx->jiffies;
 			copies--;
+
+			if (ctx->tstamp & Q_TX_TSTAMP_SW)
+				pfq_tx_tstamp_push(ctx->so, ctx->sock_queue, ctx->tstamp_id,
+						   (uint64_t)ktime_to_ns(ktime_get_real()), 0);
+
+			/* templates: the next copy is a new mutated packet */
+
+			if (tmpl && copies) {
+
+				pfq_kfree_skb_pool(skb, skb_pool);
+
+				if (copies % xmit_batch_len == 0) {
+					if (need_resched()) {
+						pfq_xmit_context_unlock(ctx);
+
+						pfq_relax();
+
+						pfq_xmit_context_lock(ctx);
+					}
+
+					if (giveup_tx_process(stop)) {
+						*intr = true;
+						return total_copies - copies;
+					}
+				}
+
+				skb = pfq_tx_copy_skb(data, len, ctx, node, skb_pool);
+				if (unlikely(skb == NULL))
+					return total_copies - copies;
+
+				pfq_tx_template_apply(tmpl, skb->data, len, total_copies - copies);
+				skb_set_queue_mapping(skb, ctx->dev_queue.queue_mapping);
+
+				if (hw_tstamp)
+					pfq_tx_tstamp_request(skb, ctx);
+			}
 		}
 	}
 	while (copies > 0);
 
-	pfq_kfree_skb_pool(skb, ctx->skb_pool);
+	pfq_kfree_skb_pool(skb, skb_pool);
 
 	return total_copies;
 }
 
 
 
+/* setup the transmit context of a socket queue: returns the cpu */
+
+static int
+pfq_sk_xmit_context_init(struct pfq_mbuff_xmit_context *ctx, struct pfq_sock *so, int sock_queue,
+			 struct pfq_tx_queue *txm, int cpu)
+{
+	struct pfq_tx_info * txinfo = pfq_get_tx_queue_info(&so->opt, sock_queue);
+
+	ctx->default_qid = PFQ_NETQ_ID(txinfo->def_ifindex, txinfo->def_queue);
+        ctx->prec_qid = PFQ_NETQ_ID(txinfo->def_ifindex, txinfo->def_queue);
+
+	ctx->default_dev.ifindex = txinfo->def_ifindex;
+	ctx->default_dev.dev = txinfo->def_dev;
+	ctx->default_dev.net = sock_net(&so->sk);
+	ctx->batch_cntr = 0;
+        ctx->net = sock_net(&so->sk);
+
+	ctx->so = so;
+	ctx->txm = txm;
+	ctx->tx_base = txinfo->base_addr;
+	ctx->zerocopy = txinfo->zc;
+	ctx->pacer = &txinfo->pacer;
+	pfq_tx_pacer_update(ctx->pacer);
+	ctx->owner = txinfo->reserved ? PFQ_TXQ_OWNER(so->id, sock_queue) : 0;
+	ctx->skb_pool = NULL;
+	ctx->sock_queue = sock_queue;
+	ctx->tstamp = so->opt.tx_tstamp;
+	ctx->tstamp_id = txinfo->tstamp_id;
+	ctx->aggr = NULL;
+	ctx->held = NULL;
+
+	/* enable skb_pool for Tx threads */
+
+	if (cpu != Q_NO_KTHREAD)
+	{
+		/* get local pool data */
+		struct pfq_percpu_pool *pool = this_cpu_ptr(percpu_pool);
+		if (likely(atomic_read(&pool->enable)))
+			ctx->skb_pool = &pool->tx_pool;
+		return cpu;
+	}
+
+	return smp_processor_id();
+}
+
+
 int
-pfq_sk_queue_xmit(struct pfq_sock *so, int sock_queue, int cpu, int node, atomic_t const *stop)
+pfq_sk_queue_xmit(struct pfq_sock *so, int sock_queue, int cpu, int node, atomic_t const *stop,
+		  struct pfq_xmit_aggr *aggr, long *credit)
 {
-	struct pfq_tx_info const * txinfo = pfq_get_tx_queue_info(&so->opt, sock_queue);
+	struct pfq_tx_info * txinfo = pfq_get_tx_queue_info(&so->opt, sock_queue);
 	struct pfq_mbuff_xmit_context ctx;
 	struct pfq_tx_queue *txm;
 	struct pfq_pkthdr *hdr;
-	ptrdiff_t prod_off;
+	size_t prod, cons, len;
+        bool intr = false, done = false;
 
-	int total_sent = 0, disc = 0, prod_idx;
+	int total_sent = 0, disc = 0;
         char *begin, *end;
 
 	/* get the Tx queue */
@@ -327,63 +913,313 @@ pfq_sk_queue_xmit(struct pfq_sock *so, int sock_queue, int cpu, int node, atomic
 
 	/* setup ctx */
 
-	ctx.default_qid = PFQ_NETQ_ID(txinfo->def_ifindex, txinfo->def_queue);
-        ctx.prec_qid = PFQ_NETQ_ID(txinfo->def_ifindex, txinfo->def_queue);
+	cpu = pfq_sk_xmit_context_init(&ctx, so, sock_queue, txm, cpu);
 
-	ctx.default_dev.ifindex = txinfo->def_ifindex;
-	ctx.default_dev.dev = txinfo->def_dev;
-	ctx.default_dev.net = sock_net(&so->sk);
-	ctx.batch_cntr = 0;
-        ctx.net = sock_net(&so->sk);
+	/* snapshot the cursors of the transmit ring */
 
-	/* enable skb_pool for Tx threads */
+	prod = __atomic_load_n(&txm->prod.pos, __ATOMIC_ACQUIRE);
+	cons = pfq_tx_queue_cons(&so->opt, sock_queue, txm);
 
-	if (cpu != Q_NO_KTHREAD)
-	{
-		/* get local pool data */
-		struct pfq_percpu_pool *pool = this_cpu_ptr(percpu_pool);
-		if (likely(atomic_read(&pool->enable)))
-			ctx.skb_pool = &pool->tx_pool;
+	/* nothing to send: the hw queue held by the stage is left to the next producer */
+
+	if (aggr && prod == cons) {
+		if (ctx.tstamp & Q_TX_TSTAMP_HW)
+			pfq_tx_tstamp_drain(so);
+		return 0;
+	}
+
+	ctx.aggr = aggr;
+
+	/* lock the default dev_queue, or adopt the one locked by the stage */
+
+	dev_queue_get(sock_net(&so->sk), &ctx.default_dev, ctx.default_qid, ctx.owner, &ctx.dev_queue);
+
+	if (aggr && aggr->dev_queue.dev && aggr->dev_queue.dev == ctx.dev_queue.dev &&
+	    aggr->dev_queue.queue == ctx.dev_queue.queue &&
+	    aggr->dev_queue.reserved == ctx.dev_queue.reserved) {
+
+		ctx.held = aggr->skb;
+		ctx.held_pool = aggr->skb_pool;
+		ctx.held_stats = aggr->skb_stats;
+		ctx.held_stop = aggr->skb_stop;
+
+		dev_put(aggr->dev_queue.dev);
+		aggr->dev_queue.dev = NULL;
+		aggr->skb = NULL;
 	}
 	else {
-		cpu = smp_processor_id();
-		ctx.skb_pool = NULL;
+		if (aggr)
+			pfq_xmit_aggr_flush(aggr);
+
+		pfq_xmit_context_lock(&ctx);
+	}
+
+	/* traverse the socket queue */
+
+	ctx.now = ktime_get_real();
+	ctx.jiffies = jiffies;
+
+	while (!intr && !done && (len = sk_tx_ring_segment(txm, txinfo->base_addr, &cons, prod, &begin)))
+	{
+		end = begin + len;
+		hdr = (struct pfq_pkthdr *)begin;
+
+		for_each_sk_mbuff(hdr, end, 0)
+		{
+			struct pfq_tx_template const *tmpl;
+			struct pfq_pkthdr *next;
+			devq_id_t qid;
+			int sent;
+
+			if (Q_TX_RING_SKIP(hdr, (size_t)(end - (char *)hdr))) /* unused tail */
+				break;
+
+			/* skip this packet ? */
+
+			qid = make_devq_id(hdr, ctx.default_qid);
+			if (unlikely(PFQ_NETQ_IS_NULL(qid))) {
+				ctx.tstamp_id++;
+				continue;
+			}
+
+			/* the credit of the queue (Tx scheduling) is not enough for this packet ? */
+
+			if (credit && pfq_tx_sched_cost(hdr) > *credit) {
+				done = true;
+				break;
+			}
+
+			next = Q_NEXT_PKTHDR(hdr, 0);
+
+			/* ...or for the next one: this is the last packet of the round */
+
+			done = credit && (char *)next < end && !Q_TX_RING_SKIP(next, (size_t)(end - (char *)next)) &&
+				pfq_tx_sched_cost(next) > *credit - pfq_tx_sched_cost(hdr);
+
+			ctx.pos = cons + (size_t)((char *)hdr - begin);
+
+			/* a template, or a plain packet? */
+
+			tmpl = NULL;
+			if (hdr->commit == Q_TX_SLOT_TEMPLATE) {
+				if (unlikely(hdr->caplen < sizeof(*tmpl))) {
+					ctx.tstamp_id++;
+					disc++;
+					continue;
+				}
+				tmpl = (struct pfq_tx_template const *)(hdr+1);
+			}
+
+			sent = __pfq_mbuff_xmit(hdr, tmpl ? (const char *)(tmpl+1) : (const char *)(hdr+1), tmpl, &ctx, node, stop,
+						done || (char *)next >= end ||
+						Q_TX_RING_SKIP(next, (size_t)(end - (char *)next)) ?
+							PFQ_NETQ_NULL : make_devq_id(next, ctx.default_qid), &intr);
+
+			/* update stats */
+
+			total_sent += sent;
+			__sparse_add(so->stats, sent, sent, cpu);
+			__sparse_add(&global_stats, sent, sent, cpu);
+
+			/* only the bytes actually sent are charged */
+
+			if (credit)
+				*credit -= (long)hdr->caplen * sent;
+
+			if (unlikely(intr))
+				break;
+
+			ctx.tstamp_id++;
+
+			if (done) {
+				hdr = next;
+				break;
+			}
+		}
+
+		cons += (size_t)((char *)hdr - begin);
 	}
 
-	/* initialize boundaries for the transmit queue */
+	txinfo->tstamp_id = ctx.tstamp_id;
+
+	/* hand the locked queue over to the stage (its last skb is pending),
+	 * or unlock it */
+
+	if (ctx.held && !intr) {
+		dev_hold(ctx.dev_queue.dev);
+		aggr->dev_queue = ctx.dev_queue;
+		aggr->skb = ctx.held;
+		aggr->skb_pool = ctx.held_pool;
+		aggr->skb_stats = ctx.held_stats;
+		aggr->skb_stop = ctx.held_stop;
+	}
+	else
+		pfq_xmit_context_unlock(&ctx);
+
+	/* release the device */
+
+	dev_queue_put(sock_net(&so->sk), &ctx.default_dev, &ctx.dev_queue);
+
+	/* count the packets left in the ring (discarded), unless the credit is over */
+
+	while (!done && (len = sk_tx_ring_segment(txm, txinfo->base_addr, &cons, prod, &begin)))
+	{
+		end = begin + len;
+		hdr = (struct pfq_pkthdr *)begin;
+
+		for_each_sk_mbuff(hdr, end, 0)
+		{
+			if (Q_TX_RING_SKIP(hdr, (size_t)(end - (char *)hdr)))
+				break;
+			disc++;
+		}
+
+		cons += (size_t)((char *)hdr - begin);
+	}
+
+	/* release the consumed slots to the producer (but the zero-copy ones in flight) */
+
+	if (ctx.zerocopy)
+		pfq_tx_zc_consume(ctx.zerocopy, cons);
+	else
+		__atomic_store_n(&txm->cons.pos, cons, __ATOMIC_RELEASE);
+
+	/* collect the hw timestamps of the packets sent so far */
+
+	if (ctx.tstamp & Q_TX_TSTAMP_HW)
+		pfq_tx_tstamp_drain(so);
+
+	/* update stats */
+
+	__sparse_add(so->stats, disc, disc, cpu);
+	__sparse_add(&global_stats, disc, disc, cpu);
+
+	return total_sent;
+}
+
+
+/* pcap replay: records of the pinned file are read in place */
+
+static inline uint32_t
+pcap_u32(struct pfq_tx_replay_state const *st, const char *p)
+{
+	uint32_t v = get_unaligned((const uint32_t *)p);
+	return st->swapped ? swab32(v) : v;
+}
+
+
+static inline const char *
+pfq_tx_replay_record(struct pfq_tx_replay_state const *st, size_t off, uint64_t *ts, size_t *caplen)
+{
+	const char *rec;
+
+	if (off + Q_PCAP_REC_LEN > st->len)
+		return NULL;
+
+	rec = st->base + off;
+
+	*caplen = pcap_u32(st, rec + 8);
+	if (*caplen > st->len - off - Q_PCAP_REC_LEN)	/* truncated record */
+		return NULL;
 
-	prod_off  = swap_sk_tx_queue(txm, &prod_idx);
-	begin = txinfo->base_addr + (prod_idx & 1) * txm->size + txm->cons.off;
-	end   = txinfo->base_addr + (prod_idx & 1) * txm->size + prod_off;
+	*ts = (uint64_t)pcap_u32(st, rec) * NSEC_PER_SEC +
+	      (uint64_t)pcap_u32(st, rec + 4) * (st->nsec ? 1 : NSEC_PER_USEC);
+
+	return rec + Q_PCAP_REC_LEN;
+}
+
+
+int
+pfq_sk_replay_xmit(struct pfq_sock *so, int sock_queue, int cpu, int node, atomic_t const *stop,
+		   struct pfq_xmit_aggr *aggr, long *credit)
+{
+	struct pfq_tx_info * txinfo = pfq_get_tx_queue_info(&so->opt, sock_queue);
+	struct pfq_tx_replay_state *st;
+	struct pfq_mbuff_xmit_context ctx;
+	int total_sent = 0, batch, n;
+	bool intr = false;
+
+	st = (struct pfq_tx_replay_state *)atomic_long_read(&txinfo->replay);
+	if (st == NULL || !st->active || atomic_read(&st->stop) == -1 || atomic_read(stop) == -1)
+		return 0;
+
+	smp_rmb();
+
+	/* the replay does not take part in the aggregation */
+
+	if (aggr)
+		pfq_xmit_aggr_flush(aggr);
+
+	/* setup ctx (the pcap file is not a Tx ring: skbs are always copied) */
+
+	cpu = pfq_sk_xmit_context_init(&ctx, so, sock_queue, NULL, cpu);
+	ctx.zerocopy = NULL;
 
 	/* lock the default dev_queue */
 
-	dev_queue_get(sock_net(&so->sk), &ctx.default_dev, ctx.default_qid , &ctx.dev_queue);
+	dev_queue_get(sock_net(&so->sk), &ctx.default_dev, ctx.default_qid, ctx.owner, &ctx.dev_queue);
 
 	local_bh_disable();
 	pfq_hard_tx_lock(&ctx.dev_queue);
 
-	/* traverse the socket queue */
-
 	ctx.now = ktime_get_real();
 	ctx.jiffies = jiffies;
 
-	hdr  = (struct pfq_pkthdr *)begin;
+	batch = xmit_batch_len;
 
-	for_each_sk_mbuff(hdr, end, 0)
+	for(n = 0; n < batch; n++)
 	{
-		devq_id_t qid;
-                bool intr = false;
+		struct pfq_pkthdr hdr;
+		const char *data;
+		uint64_t ts, next_ts;
+		size_t caplen, next_caplen;
+		bool more;
 		int sent;
 
-		/* skip this packet ? */
+		data = pfq_tx_replay_record(st, st->off, &ts, &caplen);
+		if (data == NULL) {
+
+			/* end of file (or empty one): next loop? */
+
+			st->done_loops++;
+
+			if ((st->loops && st->done_loops >= st->loops) || st->off == Q_PCAP_HDR_LEN) {
+				st->active = false;
+				break;
+			}
 
-		qid = make_devq_id(hdr, ctx.default_qid);
-		if (unlikely(PFQ_NETQ_IS_NULL(qid)))
+			st->off = Q_PCAP_HDR_LEN;
+			st->t0 = 0;
 			continue;
+		}
+
+		if (st->t0 == 0) {
+			st->t0 = ktime_to_ns(ctx.now);
+			st->t0_file = ts;
+		}
+
+		memset(&hdr, 0, sizeof(hdr));
+
+		hdr.tstamp.tv64 = st->tstamp && ts > st->t0_file ?
+				  st->t0 + div_u64((ts - st->t0_file) * 1000, st->speed) : 0;
+		hdr.caplen = (uint16_t)min_t(size_t, caplen, xmit_slot_size);
+		hdr.len = hdr.caplen;
+		hdr.data.copies = 1;
+
+		/* the credit of the queue (Tx scheduling) is not enough for this packet ? */
 
-		sent = __pfq_mbuff_xmit(hdr, &ctx, 0, node, stop,
-					Q_NEXT_PKTHDR(hdr, 0) >= (struct pfq_pkthdr *)end , &intr);
+		if (credit && (long)hdr.caplen > *credit)
+			break;
+
+		/* honoring the timestamps, every packet is flushed to the NIC
+		 * before waiting for the next one (or the last of the round) */
+
+		more = !st->tstamp && n + 1 < batch &&
+			pfq_tx_replay_record(st, st->off + Q_PCAP_REC_LEN + caplen, &next_ts, &next_caplen) &&
+			(!credit || (long)min_t(size_t, next_caplen, xmit_slot_size) <= *credit - (long)hdr.caplen);
+
+		sent = __pfq_mbuff_xmit(&hdr, data, NULL, &ctx, node, &st->stop,
+					more ? ctx.default_qid : PFQ_NETQ_NULL, &intr);
 
 		/* update stats */
 
@@ -391,10 +1227,19 @@ pfq_sk_queue_xmit(struct pfq_sock *so, int sock_queue, int cpu, int node, atomic
 		__sparse_add(so->stats, sent, sent, cpu);
 		__sparse_add(&global_stats, sent, sent, cpu);
 
+		if (credit)
+			*credit -= (long)hdr.caplen * sent;
+
 		if (unlikely(intr))
 			break;
+
+		st->sent += sent;
+		st->off += Q_PCAP_REC_LEN + caplen;
+		ctx.tstamp_id++;
 	}
 
+	txinfo->tstamp_id = ctx.tstamp_id;
+
 	/* unlock the current locked queue */
 
 	pfq_hard_tx_unlock(&ctx.dev_queue);
@@ -404,21 +1249,8 @@ pfq_sk_queue_xmit(struct pfq_sock *so, int sock_queue, int cpu, int node, atomic
 
 	dev_queue_put(sock_net(&so->sk), &ctx.default_dev, &ctx.dev_queue);
 
-	/* update the local consumer offset */
-
-	txm->cons.off = prod_off;
-
-	/* count the packets left in the shared queue */
-
-	for_each_sk_mbuff(hdr, end, 0)
-	{
-		disc++;
-	}
-
-	/* update stats */
-
-	__sparse_add(so->stats, disc, disc, cpu);
-	__sparse_add(&global_stats, disc, disc, cpu);
+	if (ctx.tstamp & Q_TX_TSTAMP_HW)
+		pfq_tx_tstamp_drain(so);
 
 	return total_sent;
 }
@@ -435,7 +1267,13 @@ __pfq_xmit(struct sk_buff *skb, struct net_device *dev, int xmit_more)
 	skb->mark = xmit_more;
 #endif
 
-	rc = dev->netdev_ops->ndo_start_xmit(skb, dev);
+	/* the hw queue may be stopped by the driver, or frozen */
+
+	if (unlikely(netif_xmit_frozen_or_stopped(netdev_get_tx_queue(dev, skb_get_queue_mapping(skb)))))
+		rc = NETDEV_TX_BUSY;
+	else
+		rc = dev->netdev_ops->ndo_start_xmit(skb, dev);
+
 	if (dev_xmit_complete(rc))
 		return rc;
 
@@ -569,16 +1407,17 @@ intr:
 int
 pfq_lazy_xmit(struct sk_buff __GC * skb, struct net_device *dev, int queue)
 {
+	struct pfq_percpu_data *data = this_cpu_ptr(percpu_data);
 	struct GC_log *skb_log = PFQ_CB(skb)->log;
 
-	if (skb_log->num_devs >= Q_GC_LOG_QUEUE_LEN) {
+	if (GC_lazy_xmit(data->GC, skb, dev, queue) < 0) {
+		sparse_inc(&global_drops, reason[Q_DROP_FWD_FULL]);
 		if (printk_ratelimit())
 			printk(KERN_INFO "[PFQ] bridge %s: too many annotation!\n", dev->name);
 		return 0;
 	}
 
-	skb_set_queue_mapping(PFQ_SKB(skb), queue);
-	skb_log->dev[skb_log->num_devs++] = dev;
+	skb_log->num_devs++;
 	skb_log->xmit_todo++;
 
 	return 1;
@@ -629,70 +1468,60 @@ skb_tx_clone(struct net_device *dev, struct sk_buff *skb, gfp_t mask)
 
 
 size_t
-pfq_skb_queue_lazy_xmit_run(struct pfq_skbuff_GC_queue *skbs, struct pfq_endpoint_info const *endpoints)
+pfq_lazy_xmit_run(struct GC_xmit_queue *xq)
 {
 	struct netdev_queue *txq;
 	struct net_device *dev;
 	struct sk_buff __GC *skb;
         size_t sent = 0;
-	size_t n, i;
-	int queue = -1;
+	size_t n;
+	int i, queue, hw_queue = 0;
 
-	/* for each net_device... */
+	/* for each net_device (bucket)... */
 
-	for(n = 0; n < endpoints->num; n++)
+	for(n = 0; n < xq->num_devs; n++)
 	{
-		size_t sent_dev = 0;
-		dev = endpoints->dev[n];
+		struct GC_xmit_bucket *b = &xq->bucket[n];
 
+		dev = b->dev;
 		txq = NULL;
                 queue = -1;
 
-		/* scan the list of skbs, and forward them in batch fashion */
+		/* forward the skbs of the bucket in batch fashion */
 
-		for(i = 0; i < skbs->len; i++)
+		for(i = b->head; i != -1; i = xq->slot[i].next)
 		{
-                        size_t j, num;
-
-			/* select packet and log */
+			struct GC_xmit_slot *s = &xq->slot[i];
+			const int xmit_more = s->next != -1 && xq->slot[s->next].queue == s->queue;
+			bool to_clone;
+			struct sk_buff *nskb;
 
-			skb = skbs->queue[i];
+			skb = s->skb;
 
-			num = GC_count_dev_in_log(dev, PFQ_CB(skb)->log);
-
-			if (num == 0)
-				continue;
-
-			if (queue != skb->queue_mapping) {
-
-				queue = skb->queue_mapping;
+			if (queue != s->queue || txq == NULL) {
 
 				if (txq) {
 					HARD_TX_UNLOCK(dev, txq);
 					local_bh_enable();
                                 }
 
-				txq = pfq_netdev_pick_tx(dev, PFQ_SKB(skb), &queue);
+				queue = hw_queue = s->queue;
+				txq = pfq_netdev_pick_tx(dev, PFQ_SKB(skb), &hw_queue);
 
 				local_bh_disable();
 				HARD_TX_LOCK(dev, txq, smp_processor_id());
 			}
 
-			/* forward this skb `num` times (to this device) */
-
-			for (j = 0; j < num; j++)
-			{
-				const int xmit_more  = ++sent_dev != endpoints->cnt[n];
-				const bool to_clone  = PFQ_CB(skb)->log->to_kernel || PFQ_CB(skb)->log->xmit_todo-- > 1;
+			to_clone = PFQ_CB(skb)->log->to_kernel || PFQ_CB(skb)->log->xmit_todo-- > 1;
 
-				struct sk_buff *nskb = to_clone ? skb_tx_clone(dev, PFQ_SKB(skb), GFP_ATOMIC) :
-								  skb_get(PFQ_SKB(skb));
+			nskb = to_clone ? skb_tx_clone(dev, PFQ_SKB(skb), GFP_ATOMIC) : skb_get(PFQ_SKB(skb));
+			if (nskb)
+				skb_set_queue_mapping(nskb, hw_queue);
 
-				if (nskb && __pfq_xmit(nskb, dev, xmit_more) == NETDEV_TX_OK)
-					sent++;
-				else
-					sparse_inc(&global_stats, abrt);
-			}
+			if (nskb && __pfq_xmit(nskb, dev, xmit_more) == NETDEV_TX_OK)
+				sent++;
+			else
+				sparse_inc(&global_stats, abrt);
 		}
 
 		if (txq) {
@@ -40,6 +40,25 @@
 #include <lang/GC.h>
 #include <lang/module.h>
 
+/* Tx threads: the hw queue left locked by the last socket queue drained in
+ * a round, along with its last skb (the doorbell is pending). The next socket
+ * queue of the round that targets the same hw queue adopts both, so that the
+ * packets of several producers are sent with one lock hold and one doorbell.
+ * The stage is private to a Tx thread: sync senders and other Tx threads that
+ * use the same hw queue still take its lock and ring the doorbell on their own
+ * (reserved hw queues keep other PFQ producers off a queue instead).
+ */
+
+struct pfq_xmit_aggr
+{
+	struct net_dev_queue		dev_queue;	/* locked hw queue (dev == NULL: empty) */
+	struct sk_buff		       *skb;
+	struct pfq_skb_pool	       *skb_pool;
+	struct pfq_sock_stats __percpu *skb_stats;	/* of the producer */
+	atomic_t const		       *skb_stop;
+};
+
+
 struct pfq_mbuff_xmit_context
 {
 	struct net_device_cache		default_dev;
@@ -54,12 +73,38 @@ struct pfq_mbuff_xmit_context
 
 	ktime_t			        now;
 	unsigned long			jiffies;
+
+	struct pfq_sock		       *so;
+	struct pfq_tx_queue	       *txm;
+	char			       *tx_base;
+	struct pfq_tx_zc_queue	       *zerocopy;	/* zero-copy Tx, or NULL */
+	size_t				pos;		/* position of the current record */
+
+	struct pfq_tx_pacer	       *pacer;
+	int				owner;		/* reserved hw queue owner, or 0 */
+
+	int				sock_queue;
+	int				tstamp;		/* Q_TX_TSTAMP_* */
+	uint32_t			tstamp_id;	/* index of the current record */
+
+	struct pfq_xmit_aggr	       *aggr;		/* Tx threads only */
+	struct sk_buff		       *held;		/* last skb not yet sent */
+	struct pfq_skb_pool	       *held_pool;
+	struct pfq_sock_stats __percpu *held_stats;	/* of the producer (counted as sent) */
+	atomic_t const		       *held_stop;
 };
 
 
 /* socket queues */
 
-extern int pfq_sk_queue_xmit(struct pfq_sock *so, int qindex, int cpu, int node, atomic_t const *stop);
+/* credit: DRR deficit in bytes, decreased by the bytes sent; a packet is
+ * sent only if it fits the credit (NULL = the whole ring) */
+
+extern int pfq_sk_queue_xmit(struct pfq_sock *so, int qindex, int cpu, int node, atomic_t const *stop,
+			     struct pfq_xmit_aggr *aggr, long *credit);
+extern int pfq_sk_replay_xmit(struct pfq_sock *so, int qindex, int cpu, int node, atomic_t const *stop,
+			      struct pfq_xmit_aggr *aggr, long *credit);
+extern void pfq_xmit_aggr_flush(struct pfq_xmit_aggr *aggr);
 extern int pfq_sk_queue_flush(struct pfq_sock *so, int index);
 
 /* skb queues */
@@ -75,7 +120,13 @@ extern int pfq_skb_queue_lazy_xmit(struct pfq_skbuff_GC_queue *queue, struct net
 extern int pfq_skb_queue_lazy_xmit_by_mask(struct pfq_skbuff_GC_queue *queue, unsigned long long mask,
 					   struct net_device *dev, int queue_index);
 
-extern size_t pfq_skb_queue_lazy_xmit_run(struct pfq_skbuff_GC_queue *queue, struct pfq_endpoint_info const *info);
+extern size_t pfq_lazy_xmit_run(struct GC_xmit_queue *queue);
+
+extern void pfq_tx_tstamp_drain(struct pfq_sock *so);
+
+extern int  pfq_tx_zc_enable(struct pfq_tx_info *txinfo, struct pfq_tx_queue *txm,
+			     struct pfq_tx_completion_ring *ring, int node);
+extern void pfq_tx_zc_disable(struct pfq_sock *so, struct pfq_tx_info *txinfo, unsigned long deadline);
 
 
 #endif /* PF_Q_TRANSMIT_H */
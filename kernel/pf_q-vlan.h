@@ -26,30 +26,47 @@
 #define PF_Q_VLAN_H
 
 #include <pragma/diagnostic_push>
-#include <linux/version.h>
 #include <linux/if_vlan.h>
+#include <linux/skbuff.h>
 #include <pragma/diagnostic_pop>
 
-#if (LINUX_VERSION_CODE < KERNEL_VERSION(3,9,0))
+#include <pf_q-skbuff.h>
 
-extern struct sk_buff *pfq_vlan_untag(struct sk_buff *skb);
 
-#elif (LINUX_VERSION_CODE < KERNEL_VERSION(3,16,6))
+/* Parse the 802.1q tag of the packet into its cb: the tci (VLAN_TAG_PRESENT
+ * set if tagged), the layer 3 protocol and the offset of its header.
+ * The hw-accel tag is used if present. Otherwise, if sw is set, the tag is
+ * parsed in place: the packet is never modified, and the layer 3 header is
+ * the one encapsulated past the tag.
+ *
+ * skb->data must point to the mac header.
+ */
 
 static inline
-struct sk_buff *pfq_vlan_untag(struct sk_buff *skb)
+void pfq_vlan_parse(struct sk_buff *skb, int sw)
 {
-        return vlan_untag(skb);
-}
+	struct pfq_cb *cb = PFQ_CB(skb);
+	struct vlan_ethhdr const *vh;
 
-#else
+	cb->l3_proto = eth_hdr(skb)->h_proto;
+	cb->l3_off   = skb->mac_len;
 
-static inline
-struct sk_buff *pfq_vlan_untag(struct sk_buff *skb)
-{
-        return skb_vlan_untag(skb);
-}
+	if (skb->vlan_tci & VLAN_TAG_PRESENT) {
+		cb->vlan_tci = skb->vlan_tci;
+		return;
+	}
+
+	if (!sw || skb->protocol != cpu_to_be16(ETH_P_8021Q) ||
+	    unlikely(skb_headlen(skb) < VLAN_ETH_HLEN)) {
+		cb->vlan_tci = 0;
+		return;
+	}
 
-#endif
+	vh = (struct vlan_ethhdr const *)skb->data;
+
+	cb->vlan_tci = ntohs(vh->h_vlan_TCI) | VLAN_TAG_PRESENT;
+	cb->l3_proto = vh->h_vlan_encapsulated_proto;
+	cb->l3_off   = skb->mac_len + VLAN_HLEN;
+}
 
 #endif /* PF_Q_VLAN_H */
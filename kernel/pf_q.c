@@ -154,6 +154,15 @@ unsigned int pfq_fold(unsigned int a, unsigned int b)
 }
 
 
+static inline
+void pfq_group_drop(struct pfq_group *group, int why, int cpu)
+{
+	__sparse_inc(group->stats, drop, cpu);
+	__sparse_inc(group->drops, reason[why], cpu);
+	__sparse_inc(&global_drops, reason[why], cpu);
+}
+
+
 static int
 pfq_receive_batch(struct pfq_percpu_data *data,
 		  struct pfq_percpu_sock *sock,
@@ -163,7 +172,7 @@ pfq_receive_batch(struct pfq_percpu_data *data,
 {
 	unsigned long long sock_queue[Q_SKBUFF_BATCH];
         unsigned long group_mask, socket_mask;
-	struct pfq_endpoint_info endpoints;
+	unsigned long long delivered_mask = 0;
         struct sk_buff *skb;
 	struct sk_buff __GC * buff;
 
@@ -198,6 +207,8 @@ pfq_receive_batch(struct pfq_percpu_data *data,
         {
 		uint16_t queue = skb_rx_queue_recorded(skb) ? skb_get_rx_queue(skb) : 0;
 		unsigned long local_group_mask = pfq_devmap_get_groups(skb->dev->ifindex, queue);
+		if (unlikely(local_group_mask == 0))
+			__sparse_inc(&global_drops, reason[Q_DROP_DEVMAP], cpu);
 		group_mask |= local_group_mask;
 		PFQ_CB(skb)->group_mask = local_group_mask;
 		PFQ_CB(skb)->monad = &monad;
@@ -243,7 +254,7 @@ pfq_receive_batch(struct pfq_percpu_data *data,
 				if (bpf && !SK_RUN_FILTER(bpf, PFQ_SKB(buff)))
 #endif
 				{
-					__sparse_inc(this_group->stats, drop, cpu);
+					pfq_group_drop(this_group, Q_DROP_BPF, cpu);
 					refs.queue[refs.len++] = NULL;
 					continue;
 				}
@@ -252,8 +263,8 @@ pfq_receive_batch(struct pfq_percpu_data *data,
 			/* check vlan filter */
 
 			if (vlan_filt_enabled) {
-				if (!pfq_check_group_vlan_filter(gid, buff->vlan_tci & ~VLAN_TAG_PRESENT)) {
-					__sparse_inc(this_group->stats, drop, cpu);
+				if (!pfq_check_group_vlan_filter(gid, PFQ_CB(buff)->vlan_tci & ~VLAN_TAG_PRESENT)) {
+					pfq_group_drop(this_group, Q_DROP_VLAN, cpu);
 					refs.queue[refs.len++] = NULL;
 					continue;
 				}
@@ -280,7 +291,7 @@ pfq_receive_batch(struct pfq_percpu_data *data,
 
 				buff = pfq_lang_run(buff, prg).skb;
 				if (buff == NULL) {
-					__sparse_inc(this_group->stats, drop, cpu);
+					pfq_group_drop(this_group, Q_DROP_LANG, cpu);
 					refs.queue[refs.len++] = NULL;
 					continue;
 				}
@@ -297,7 +308,7 @@ pfq_receive_batch(struct pfq_percpu_data *data,
 				/* skip the packet? */
 
 				if (is_drop(monad.fanout)) {
-					__sparse_inc(this_group->stats, drop, cpu);
+					pfq_group_drop(this_group, Q_DROP_LANG, cpu);
 					refs.queue[refs.len++] = NULL;
 					continue;
 				}
@@ -359,6 +370,8 @@ pfq_receive_batch(struct pfq_percpu_data *data,
 
 			mask_to_sock_queue(n, sock_mask, sock_queue);
 			socket_mask |= sock_mask;
+			if (sock_mask)
+				delivered_mask |= 1ULL << n;
 		}
 
 		/* copy payloads to endpoints... */
@@ -371,16 +384,33 @@ pfq_receive_batch(struct pfq_percpu_data *data,
 		})
 	})
 
-	/* forward skbs to network devices */
+	/* update per hw-queue counters */
+
+	for_each_skbuff_upto(this_batch_len, &GC_ptr->pool, buff, n)
+	{
+		struct pfq_netq_stats *netq;
+		uint16_t queue = skb_rx_queue_recorded(PFQ_SKB(buff)) ? skb_get_rx_queue(PFQ_SKB(buff)) : 0;
 
-	GC_get_lazy_endpoints(GC_ptr, &endpoints);
+		netq = pfq_get_netq_stats(buff->dev->ifindex, queue, cpu);
+		if (unlikely(netq == NULL))
+			continue;
 
-	if (endpoints.cnt_total)
+		local_inc(&netq->recv);
+
+		if (PFQ_CB(buff)->log->num_devs)
+			local_add(PFQ_CB(buff)->log->num_devs, &netq->frwd);
+		else if (!(delivered_mask & (1ULL << n)) && !PFQ_CB(buff)->log->to_kernel)
+			local_inc(&netq->drop);
+	}
+
+	/* forward skbs to network devices */
+
+	if (GC_ptr->xmit.len)
 	{
-		size_t total = pfq_skb_queue_lazy_xmit_run(SKBUFF_GC_QUEUE_ADDR(GC_ptr->pool), &endpoints);
+		size_t total = pfq_lazy_xmit_run(&GC_ptr->xmit);
 
 		__sparse_add(&global_stats, frwd, total, cpu);
-		__sparse_add(&global_stats, disc, endpoints.cnt_total - total, cpu);
+		__sparse_add(&global_stats, disc, GC_ptr->xmit.len - total, cpu);
 	}
 
 	/* forward skbs to kernel or to the pool */
@@ -416,6 +446,41 @@ pfq_receive_batch(struct pfq_percpu_data *data,
 }
 
 
+/* prepare the skb and pass its ownership to the GC (soft-irq must be disabled) */
+
+static inline struct sk_buff __GC *
+pfq_receive_to_GC(struct pfq_percpu_data *data, struct sk_buff *skb, int direct, int cpu)
+{
+	struct sk_buff __GC * buff;
+
+	skb_reset_mac_len(skb);
+
+	/* push the mac header: reset skb->data to the beginning of the packet */
+
+	if (likely(skb->pkt_type != PACKET_OUTGOING))
+	    skb_push(skb, skb->mac_len);
+
+	/* pass the ownership of this skb to the garbage collector */
+
+	buff = GC_make_buff(data->GC, skb);
+	if (buff == NULL) {
+		if (printk_ratelimit())
+			printk(KERN_INFO "[PFQ] GC: memory exhausted!\n");
+		__sparse_inc(&global_stats, lost, cpu);
+		__sparse_inc(&global_drops, reason[Q_DROP_GC_FULL], cpu);
+		__sparse_inc(&memory_stats, os_free, cpu);
+		kfree_skb(skb);
+		return NULL;
+	}
+
+	/* parse the vlan tag in place (sw tags only if vl_untag is set) */
+
+	pfq_vlan_parse(skb, vl_untag);
+	PFQ_CB(buff)->direct = direct;
+	return buff;
+}
+
+
 static int
 pfq_receive(struct napi_struct *napi, struct sk_buff * skb, int direct)
 {
@@ -425,8 +490,11 @@ pfq_receive(struct napi_struct *napi, struct sk_buff * skb, int direct)
 	/* if no socket is open drop the packet */
 
 	if (unlikely(pfq_get_sock_count() == 0)) {
-		sparse_inc(&memory_stats, os_free);
-		kfree_skb(skb);
+		if (skb) {
+			sparse_inc(&global_drops, reason[Q_DROP_NO_SOCKET]);
+			sparse_inc(&memory_stats, os_free);
+			kfree_skb(skb);
+		}
 		return 0;
 	}
 
@@ -446,39 +514,12 @@ pfq_receive(struct napi_struct *napi, struct sk_buff * skb, int direct)
 		if (skb->tstamp.tv64 == 0)
 			__net_timestamp(skb);
 
-		/* if vlan header is present, remove it */
-
-		if (vl_untag && skb->protocol == cpu_to_be16(ETH_P_8021Q)) {
-			skb = pfq_vlan_untag(skb);
-			if (unlikely(!skb)) {
-				__sparse_inc(&global_stats, lost, cpu);
-				local_bh_enable();
-				return -1;
-			}
-		}
-
-		skb_reset_mac_len(skb);
-
-		/* push the mac header: reset skb->data to the beginning of the packet */
-
-		if (likely(skb->pkt_type != PACKET_OUTGOING))
-		    skb_push(skb, skb->mac_len);
-
-		/* pass the ownership of this skb to the garbage collector */
-
-		buff = GC_make_buff(data->GC, skb);
+		buff = pfq_receive_to_GC(data, skb, direct, cpu);
 		if (buff == NULL) {
-			if (printk_ratelimit())
-				printk(KERN_INFO "[PFQ] GC: memory exhausted!\n");
-			__sparse_inc(&global_stats, lost, cpu);
-			__sparse_inc(&memory_stats, os_free, cpu);
-			kfree_skb(skb);
 			local_bh_enable();
 			return 0;
 		}
 
-		PFQ_CB(buff)->direct = direct;
-
 		if ((GC_size(data->GC) < (size_t)capt_batch_len) &&
 		     (ktime_to_ns(ktime_sub(skb_get_ktime(PFQ_SKB(buff)), data->last_rx)) < 1000000))
 		{
@@ -503,6 +544,78 @@ pfq_receive(struct napi_struct *napi, struct sk_buff * skb, int direct)
 }
 
 
+/* receive a burst of skbs: the per-cpu data is looked up and the
+ * timestamp taken once per burst. The list is consumed.
+ */
+
+static int
+pfq_receive_list(struct sk_buff_head *list, int direct)
+{
+	struct pfq_percpu_data * data;
+	struct sk_buff *skb;
+	ktime_t now;
+	int cpu;
+
+	/* if no socket is open drop the whole burst */
+
+	if (unlikely(pfq_get_sock_count() == 0)) {
+		while ((skb = __skb_dequeue(list)) != NULL) {
+			sparse_inc(&global_drops, reason[Q_DROP_NO_SOCKET]);
+			sparse_inc(&memory_stats, os_free);
+			kfree_skb(skb);
+		}
+		return 0;
+	}
+
+	now = ktime_get_real();
+
+	/* disable soft-irq */
+
+        local_bh_disable();
+
+        cpu = smp_processor_id();
+	data = per_cpu_ptr(percpu_data, cpu);
+
+	while ((skb = __skb_dequeue(list)) != NULL)
+	{
+		if (skb->tstamp.tv64 == 0)
+			skb->tstamp = now;
+
+		if (pfq_receive_to_GC(data, skb, direct, cpu) == NULL)
+			continue;
+
+		/* the GC is full: process this batch and go on with the burst */
+
+		if (GC_size(data->GC) >= (size_t)Q_SKBUFF_BATCH) {
+
+			pfq_receive_batch(data,
+					  per_cpu_ptr(percpu_sock, cpu),
+					  per_cpu_ptr(percpu_pool, cpu),
+					  data->GC, cpu);
+
+			local_bh_disable();
+
+			cpu = smp_processor_id();
+			data = per_cpu_ptr(percpu_data, cpu);
+		}
+	}
+
+	/* the end of the burst is a batch boundary */
+
+	if (GC_size(data->GC) == 0) {
+		local_bh_enable();
+		return 0;
+	}
+
+	data->last_rx = now;
+
+	return pfq_receive_batch(data,
+				 per_cpu_ptr(percpu_sock, cpu),
+				 per_cpu_ptr(percpu_pool, cpu),
+				 data->GC, cpu);
+}
+
+
 /* simple packet HANDLER */
 
 static int
@@ -552,9 +665,20 @@ out:
 void pfq_timer(unsigned long cpu)
 {
 	struct pfq_percpu_data *data;
+#ifdef PFQ_USE_SKB_POOL
+	struct pfq_percpu_pool *pool;
+#endif
 
 	pfq_receive(NULL, NULL, 0);
 
+#ifdef PFQ_USE_SKB_POOL
+	/* the Tx pool is only touched by the Tx path (process context) */
+
+	pool = per_cpu_ptr(percpu_pool, cpu);
+	if (atomic_read(&pool->enable))
+		pfq_skb_pool_refill(&pool->rx_pool, cpu_to_node(cpu));
+#endif
+
 	data = per_cpu_ptr(percpu_data, cpu);
 	mod_timer_pinned(&data->timer, jiffies + msecs_to_jiffies(100));
 }
@@ -707,6 +831,12 @@ static int pfq_netdev_notifier(struct notifier_block *this, unsigned long info,
 		}
 
 		pr_devel(KERN_INFO "[PFQ] %s: device %s, ifindex %d\n", kind, dev->name, dev->ifindex);
+
+		if (info == NETDEV_REGISTER) {
+			if (pfq_dev_stats_register(dev) < 0)
+				printk(KERN_INFO "[PFQ] %s: could not allocate hw queue stats!\n", dev->name);
+		}
+
 		return NOTIFY_OK;
 	}
 
@@ -925,6 +1055,13 @@ static int __init pfq_init_module(void)
 		return -EFAULT;
 	}
 
+	if (skb_pool_low < 0 || skb_pool_high < 0 ||
+	    (skb_pool_high && skb_pool_low > skb_pool_high)) {
+                printk(KERN_INFO "[PFQ] skb_pool_low=%d skb_pool_high=%d not allowed!\n",
+                       skb_pool_low, skb_pool_high);
+		return -EFAULT;
+	}
+
 	/* initialize data structures ... */
 
 	err = pfq_groups_init();
@@ -1004,6 +1141,7 @@ err7:
 err6:
 	unregister_netdevice_notifier(&pfq_netdev_notifier_block);
 	unregister_device_handler();
+	pfq_dev_stats_free_all();
 err5:
         sock_unregister(PF_Q);
 err4:
@@ -1050,6 +1188,9 @@ static void __exit pfq_exit_module(void)
         /* free per CPU data */
         total += pfq_percpu_destruct();
 
+	/* free per hw-queue stats */
+	pfq_dev_stats_free_all();
+
 #ifdef PFQ_USE_SKB_POOL
         total += pfq_skb_pool_free_all();
 	sparse_add(&memory_stats, pool_pop, total);
@@ -1144,7 +1285,44 @@ pfq_gro_receive(struct napi_struct *napi, struct sk_buff *skb)
 }
 
 
+/* burst of skbs collected by the driver in a NAPI poll.
+ * The list is consumed; return the number of skbs passed.
+ */
+
+static int
+pfq_netif_receive_list(struct sk_buff_head *list)
+{
+	struct sk_buff_head burst;
+	struct sk_buff *skb;
+	int n = 0;
+
+	__skb_queue_head_init(&burst);
+
+	while ((skb = __skb_dequeue(list)) != NULL)
+	{
+		n++;
+
+		if (likely(pfq_direct_capture(skb))) {
+
+			if (pfq_normalize_skb(skb) < 0)
+				continue;
+
+			__skb_queue_tail(&burst, skb);
+			continue;
+		}
+
+		netif_receive_skb(skb);
+	}
+
+	if (!skb_queue_empty(&burst))
+		pfq_receive_list(&burst, 2);
+
+	return n;
+}
+
+
 EXPORT_SYMBOL_GPL(pfq_netif_rx);
+EXPORT_SYMBOL_GPL(pfq_netif_receive_list);
 EXPORT_SYMBOL_GPL(pfq_netif_receive_skb);
 EXPORT_SYMBOL_GPL(pfq_gro_receive);
 
@@ -665,6 +665,75 @@ namespace lang
             return mfunction("tee", dev, p);
         }
 
+        //! Tx queue policies of the forwarders: a queue >= 0 is a fixed queue
+        //! of the device (modulo the number of its Tx queues).
+
+        constexpr int queue_any     = Q_FWD_QUEUE_ANY;       // picked by the driver (ndo_select_queue), or queue 0
+        constexpr int queue_ingress = Q_FWD_QUEUE_INGRESS;   // the Rx queue of the packet
+        constexpr int queue_hash    = Q_FWD_QUEUE_HASH;      // the hash of the steering function
+
+        //! Forward the packet to the given Tx queue of the device.
+        /*!
+         * Like forward, with the Tx queue picked by the given policy. Example:
+         *
+         * steer_flow >> forward_queue ("eth1", queue_hash)
+         *
+         * Flows are spread across the Tx queues of eth1.
+         */
+
+        auto forward_queue = [] (std::string dev, int queue) { return mfunction("forward_queue", std::move(dev), queue); };
+
+        //! Forward the packet to the given Tx queue of the device and evaluates to \c Drop.
+        /*!
+         * Like bridge, with the Tx queue picked by the given policy. Example:
+         *
+         * bridge_queue ("eth1", queue_ingress)
+         */
+
+        auto bridge_queue  = [] (std::string dev, int queue) { return mfunction("bridge_queue", std::move(dev), queue); };
+
+        //! Forward the packet to the given Tx queue of the device.
+        /*! Like tee, with the Tx queue picked by the given policy. Example:
+         *
+         * tee_queue ("eth1", queue_hash, is_udp) >> kernel
+         */
+
+        template <typename Predicate>
+        auto tee_queue(std::string dev, int queue, Predicate p)
+            -> decltype(mfunction(nullptr, dev, queue, p))
+        {
+            static_assert(is_predicate<Predicate>::value, "tee_queue: argument 2: predicate expected");
+            return mfunction("tee_queue", dev, queue, p);
+        }
+
+        //! Forward the packet to the given Tx queue of the devices.
+        /*! Unlike forward_queue, the packet is not forwarded to the device it comes from. Example:
+         *
+         * steer_flow >> link_queue ({"eth1", "eth2"}, queue_hash) >> kernel
+         */
+
+        auto link_queue = [] (std::vector<std::string> const &devs, int queue) { return mfunction("link_queue", devs, queue); };
+
+        //! Forward the packet to a device of the given link group.
+        /*!
+         * The flow of the packet (the hash of the steering function, or the flow hash)
+         * picks one of the devices with carrier of the link group, by weight (see
+         * socket::set_group_links). Example:
+         *
+         * steer_flow >> link_group (0) >> kernel
+         */
+
+        auto link_group        = [] (int id) { return mfunction("link_group", id); };
+
+        //! Forward the packet to a device of the given link group and evaluates to \c Drop.
+        /*!
+         * Example:
+         *
+         * steer_flow >> bridge_link_group (0)
+         */
+
+        auto bridge_link_group = [] (int id) { return mfunction("bridge_link_group", id); };
+
         //! Evaluate to \c Pass SkBuff, or forward the packet to the given device.
         /*!
          * It evaluates to \c Drop, depending on the value returned by the predicate. Example:
@@ -31,6 +31,7 @@
 #include <algorithm>
 #include <thread>
 #include <chrono>
+#include <functional>
 
 #include <pfq/util.hpp>
 #include <pfq/queue.hpp>
@@ -172,6 +173,12 @@ namespace pfq {
 
             size_t tx_attempt;
             size_t tx_num_async;
+
+            unsigned int tx_compl_tail[1 + Q_MAX_TX_QUEUES];
+            size_t tx_prod[1 + Q_MAX_TX_QUEUES];
+            unsigned int tx_tstamp_tail;
+
+            std::function<uint32_t(const char *, size_t)> tx_selector;
         };
 
         int fd_;
@@ -436,7 +443,11 @@ namespace pfq {
                                         0,
                                         0,
                                         0,
-                                        0
+                                        0,
+                                        {},
+                                        {},
+                                        0,
+                                        {}
                                      });
 
             // get id
@@ -479,6 +490,99 @@ namespace pfq {
             data_->tx_slot_size = align<8>(sizeof(pfq_pkthdr) + static_cast<size_t>(maxlen));
         }
 
+        // Tx ring producer: records are reserved at the local cursor (tx_prod)
+        // and become visible to the kernel only when the cursor is published.
+
+        struct pfq_tx_queue *
+        tx_queue_of(int tss)
+        {
+            auto sh_queue = static_cast<struct pfq_shared_queue *>(data_->shm_addr);
+            return tss == -1 ? &sh_queue->tx : &sh_queue->tx_async[tss];
+        }
+
+        uint32_t
+        tx_hash(const char *pkt, size_t len) const
+        {
+            return data_->tx_selector ? data_->tx_selector(pkt, len) : symmetric_hash(pkt);
+        }
+
+        int
+        tx_select(const char *pkt, size_t len, bool async, int queue) const
+        {
+            if (!async)
+                return -1;
+            if (unlikely(data_->tx_num_async == 0))
+                throw pfq_error("PFQ: send: socket not bound to async threads");
+            return static_cast<int>(fold(queue == any_queue ? tx_hash(pkt, len) : static_cast<uint32_t>(queue), static_cast<uint32_t>(data_->tx_num_async)));
+        }
+
+        struct pfq_pkthdr *
+        tx_ring_reserve(int tss, size_t len, int ifindex, int qindex, uint64_t nsec, unsigned int copies)
+        {
+            auto tx = tx_queue_of(tss);
+
+            char * base_addr = static_cast<char *>(data_->tx_queue_addr) + data_->tx_queue_size * static_cast<size_t>(2 * (1+tss));
+
+            // get the ring cursors...
+            //
+            auto pos  = data_->tx_prod[1+tss];
+            auto cons = __atomic_load_n(&tx->cons.pos, __ATOMIC_ACQUIRE);
+
+            // compute the current slot_size:
+            //
+            auto slot_size = sizeof(struct pfq_pkthdr) + align<8>(len);
+
+            // slots never wrap: skip the tail of the ring if too short...
+            //
+            auto off = pos % tx->size;
+            auto rem = tx->size - off;
+            auto pad = rem < slot_size ? rem : 0;
+
+            // ensure there's enough free space in the ring:
+            //
+            if (pos + pad + slot_size - cons > tx->size)
+                return nullptr;
+
+            if (pad)
+            {
+                if (rem >= sizeof(struct pfq_pkthdr))
+                    reinterpret_cast<struct pfq_pkthdr *>(base_addr + off)->commit = Q_TX_SLOT_SKIP;
+                pos += pad;
+                off = 0;
+            }
+
+            auto hdr = (struct pfq_pkthdr *)(base_addr + off);
+            hdr->tstamp.tv64 = nsec;
+            hdr->caplen      = static_cast<uint16_t>(len);
+            hdr->data.copies = copies;
+            hdr->commit      = 0;
+            hdr->ifindex     = ifindex;
+            hdr->queue       = static_cast<uint8_t>(qindex);
+
+            data_->tx_prod[1+tss] = pos + slot_size;
+            return hdr;
+        }
+
+        void
+        tx_ring_publish(int tss)
+        {
+            auto tx = tx_queue_of(tss);
+
+            if (tx->prod.pos == data_->tx_prod[1+tss])
+                return;
+
+            __atomic_store_n(&tx->prod.pos, data_->tx_prod[1+tss], __ATOMIC_RELEASE);
+
+            // wake up the Tx thread, if asleep
+            //
+            if (tss != -1)
+            {
+                __atomic_thread_fence(__ATOMIC_SEQ_CST);
+                if (unlikely(__atomic_load_n(&tx->cons.sleeping, __ATOMIC_RELAXED)))
+                    ::setsockopt(fd_, PF_Q, Q_SO_TX_DOORBELL, &tss, sizeof(tss));
+            }
+        }
+
     public:
 
         //! Close the socket.
@@ -515,6 +619,8 @@ namespace pfq {
          * the Linux HugePages support.
          * If the enviroment variable PFQ_HUGEPAGES is set to 0 (or
          * PFQ_NO_HUGEPAGES is defined) standard 4K pages are used.
+         * When several hugetlbfs are mounted, the one with the largest pages
+         * not exceeding the size of the queues is used (e.g. 1GB pages).
          */
 
         void
@@ -530,21 +636,32 @@ namespace pfq {
                 throw pfq_error(errno, "PFQ: queue memory error");
 
             auto env = getenv("PFQ_HUGEPAGES");
-            auto hugepages = hugepages_mountpoint();
+            size_t page_size = 0;
+            auto hugepages = hugepages_mountpoint(tot_mem, page_size);
 
             if (!hugepages.empty() &&
                 !getenv("PFQ_NO_HUGEPAGES") &&
                 (env == nullptr || atoi(env) != 0))
             {
-                // HugePages
+                // HugePages: the kernel returns the exact size,
+                // the mapping is rounded up to the page size
                 //
-                std::clog << "[PFQ] using HugePages..." << std::endl;
 
-                hd_ = ::open((hugepages + "/pfq." + std::to_string(data_->id)).c_str(),  O_CREAT | O_RDWR, 0755);
+                tot_mem = (tot_mem + page_size - 1) & ~(page_size - 1);
+
+                std::clog << "[PFQ] using HugePages (" << (page_size >> 10) << " kB)..." << std::endl;
+
+                auto filename = hugepages + "/pfq." + std::to_string(data_->id);
+
+                hd_ = ::open(filename.c_str(),  O_CREAT | O_RDWR, 0755);
                 if (hd_ == -1)
                     throw pfq_error(errno, "PFQ: couldn't open a HugePages descriptor");
 
                 data()->shm_addr = ::mmap(nullptr, tot_mem, PROT_READ|PROT_WRITE, MAP_SHARED, hd_, 0);
+
+                // the pages are released with the last mapping
+                ::unlink(filename.c_str());
+
                 if (data()->shm_addr == MAP_FAILED)
                     throw pfq_error(errno, "PFQ: couldn't mmap HugePages");
 
@@ -574,6 +691,10 @@ namespace pfq {
 
             data()->tx_queue_addr = static_cast<char *>(data()->shm_addr) + sizeof(pfq_shared_queue) + data()->rx_queue_size * 2;
             data()->tx_queue_size = data()->tx_slots * data()->tx_slot_size;
+
+            std::fill(std::begin(data()->tx_compl_tail), std::end(data()->tx_compl_tail), 0);
+            std::fill(std::begin(data()->tx_prod), std::end(data()->tx_prod), 0);
+            data()->tx_tstamp_tail = 0;
         }
 
         //! Disable the socket.
@@ -592,9 +713,9 @@ namespace pfq {
                 if (::munmap(data()->shm_addr, data()->shm_size) == -1)
                     throw pfq_error(errno, "PFQ: munmap error");
 
-                auto hugepages = hugepages_mountpoint();
                 if (hd_ != -1) {
-                    unlink((hugepages + "/pfq." + std::to_string(fd_)).c_str());
+                    ::close(hd_);
+                    hd_ = -1;
                 }
             }
 
@@ -760,6 +881,150 @@ namespace pfq {
         }
 
 
+        //! Enable/disable zero-copy transmission.
+        /*!
+         * In zero-copy mode the skbs refer to the Tx memory of the socket:
+         * the kernel holds a slot until the driver releases it (see tx_completions).
+         * The mode must be set before the socket is enabled.
+         */
+
+        void
+        tx_zerocopy(bool value)
+        {
+            if (is_enabled())
+                throw pfq_error("PFQ: enabled (Tx zerocopy could not be set)");
+
+            int v = value;
+            if (::setsockopt(fd_, PF_Q, Q_SO_SET_TX_ZEROCOPY, &v, sizeof(v)) == -1)
+                throw pfq_error(errno, "PFQ: set Tx zerocopy error");
+        }
+
+
+        //! Return true if zero-copy transmission is enabled.
+
+        bool
+        tx_zerocopy() const
+        {
+           int v; socklen_t size = sizeof(v);
+           if (::getsockopt(fd_, PF_Q, Q_SO_GET_TX_ZEROCOPY, &v, &size) == -1)
+                throw pfq_error(errno, "PFQ: get Tx zerocopy error");
+           return v != 0;
+        }
+
+
+        //! Collect the Tx slots released by the kernel in zero-copy mode.
+        /*!
+         * The queue is -1 for the synchronous Tx queue or the index of the async queue.
+         * Offsets are relative to the base of the Tx queue memory.
+         */
+
+        std::vector<uint32_t>
+        tx_completions(int queue = -1)
+        {
+            if (data()->shm_addr == nullptr)
+                throw pfq_error("PFQ: tx_completions: socket not enabled");
+
+            if (queue < -1 || queue >= Q_MAX_TX_QUEUES)
+                throw pfq_error("PFQ: tx_completions: bad queue index");
+
+            auto sh_queue = static_cast<struct pfq_shared_queue *>(data()->shm_addr);
+            auto tx = queue == -1 ? &sh_queue->tx : &sh_queue->tx_async[queue];
+            if (tx->completion == 0)
+                throw pfq_error("PFQ: tx_completions: zero-copy Tx not enabled");
+
+            auto ring = reinterpret_cast<pfq_tx_completion_ring *>(static_cast<char *>(data()->shm_addr) + tx->completion);
+
+            auto head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+            auto tail = data()->tx_compl_tail[1 + queue];
+
+            // completions overwritten by the kernel are lost
+
+            if (head - tail > Q_TX_COMPLETION_LEN)
+                tail = head - Q_TX_COMPLETION_LEN;
+
+            std::vector<uint32_t> ret;
+
+            for(;; tail++)
+            {
+                auto c = &ring->ring[tail & (Q_TX_COMPLETION_LEN-1)];
+                if (__atomic_load_n(&c->seq, __ATOMIC_ACQUIRE) != tail + 1)
+                    break;
+                ret.push_back(c->off);
+            }
+
+            data()->tx_compl_tail[1 + queue] = tail;
+            __atomic_store_n(&ring->tail, tail, __ATOMIC_RELEASE);
+            return ret;
+        }
+
+
+        //! Enable the Tx timestamps of the socket.
+        /*!
+         * 'flags' is a combination of Q_TX_TSTAMP_SW and Q_TX_TSTAMP_HW; 0 disables them.
+         * The timestamps ring is allocated by enable: they can be turned on
+         * later only if they were enabled then.
+         */
+
+        void
+        tx_tstamp(int flags)
+        {
+            if (::setsockopt(fd_, PF_Q, Q_SO_TX_TSTAMP, &flags, sizeof(flags)) == -1)
+                throw pfq_error(errno, "PFQ: set Tx tstamp error");
+        }
+
+        //! Return the Tx timestamps flags of the socket.
+
+        int
+        tx_tstamp() const
+        {
+           int v; socklen_t size = sizeof(v);
+           if (::getsockopt(fd_, PF_Q, Q_SO_GET_TX_TSTAMP, &v, &size) == -1)
+                throw pfq_error(errno, "PFQ: get Tx tstamp error");
+           return v;
+        }
+
+        //! Collect the Tx timestamps of the socket.
+        /*!
+         * Entries are identified by queue (-1 for the synchronous one) and by the index
+         * of the record in that queue since the socket was enabled (modulo 2^24).
+         * A software entry has hw = 0; a hardware one, for the same record, has sw = 0.
+         */
+
+        std::vector<pfq_tx_tstamp>
+        tx_tstamps()
+        {
+            if (data()->shm_addr == nullptr)
+                throw pfq_error("PFQ: tx_tstamps: socket not enabled");
+
+            auto sh_queue = static_cast<struct pfq_shared_queue *>(data()->shm_addr);
+            if (sh_queue->tx_tstamp == 0)
+                throw pfq_error("PFQ: tx_tstamps: socket enabled without timestamps");
+
+            auto ring = reinterpret_cast<pfq_tx_tstamp_ring *>(static_cast<char *>(data()->shm_addr) + sh_queue->tx_tstamp);
+
+            auto head = __atomic_load_n(&ring->head, __ATOMIC_RELAXED);
+            auto tail = data()->tx_tstamp_tail;
+
+            // timestamps overwritten by the kernel are lost
+
+            if (head - tail > Q_TX_TSTAMP_LEN)
+                tail = head - Q_TX_TSTAMP_LEN;
+
+            std::vector<pfq_tx_tstamp> ret;
+
+            for(;; tail++)
+            {
+                auto t = &ring->ring[tail & (Q_TX_TSTAMP_LEN-1)];
+                if (__atomic_load_n(&t->seq, __ATOMIC_ACQUIRE) != tail + 1)
+                    break;
+                ret.push_back(*t);
+            }
+
+            data()->tx_tstamp_tail = tail;
+            return ret;
+        }
+
+
         //! Bind the main group of the socket to the given device/queue.
         /*!
          * The first argument is the name of the device;
@@ -890,6 +1155,31 @@ namespace pfq {
                 data()->tx_num_async++;
         }
 
+        //! Bind the socket for transmission, reserving the given hw queue.
+        /*!
+         *  As bind_tx, but the hw queue (which must be specified) is reserved
+         *  to this socket among the PFQ sockets: the traffic of other sockets is
+         *  steered to the remaining queues, so that the Tx lock of the queue is not
+         *  contended by PFQ. The stack is not steered and may still use the queue.
+         *  The reservation is released by unbind_tx.
+         */
+
+        void
+        bind_tx_reserved(const char *dev, int queue, int tid = no_kthread)
+        {
+            auto if_index = ifindex(this->fd(), dev);
+            if (if_index == -1)
+                throw pfq_error("PFQ: device not found");
+
+            struct pfq_binding b = { {tid}, if_index, queue };
+
+            if (::setsockopt(fd_, PF_Q, Q_SO_TX_BIND_RSVD, &b, sizeof(b)) == -1)
+                throw pfq_error(errno, "PFQ: Tx reserved bind error");
+
+            if (tid != no_kthread)
+                data()->tx_num_async++;
+        }
+
         //! Unbind the socket transmission.
         /*!
          * Unbind the socket for transmission from any device/queue.
@@ -904,6 +1194,102 @@ namespace pfq {
             data()->tx_num_async = 0;
         }
 
+        //! Specify the number of async Tx queues of the socket.
+        /*!
+         * The number (up to Q_MAX_TX_QUEUES, default Q_DEF_TX_QUEUES) must be set
+         * before the socket is enabled, as it determines the size of the shared memory.
+         */
+
+        void
+        tx_async_queues(size_t value)
+        {
+            if (is_enabled())
+                throw pfq_error("PFQ: enabled (Tx async queues could not be set)");
+
+            if (::setsockopt(fd_, PF_Q, Q_SO_SET_TX_ASYNC_QUEUES, &value, sizeof(value)) == -1)
+                throw pfq_error(errno, "PFQ: set Tx async queues error");
+        }
+
+        //! Return the number of async Tx queues of the socket.
+
+        size_t
+        tx_async_queues() const
+        {
+            size_t ret; socklen_t size = sizeof(ret);
+            if (::getsockopt(fd_, PF_Q, Q_SO_GET_TX_ASYNC_QUEUES, &ret, &size) == -1)
+                throw pfq_error(errno, "PFQ: get Tx async queues error");
+            return ret;
+        }
+
+        //! Start a new Tx kernel thread on the given cpu.
+        /*!
+         * Return the index of the new thread, to be used with bind_tx.
+         */
+
+        int
+        add_tx_thread(int cpu)
+        {
+            if (::setsockopt(fd_, PF_Q, Q_SO_TX_THREAD_ADD, &cpu, sizeof(cpu)) == -1)
+                throw pfq_error(errno, "PFQ: Tx thread add error");
+
+            return tx_threads() - 1;
+        }
+
+        //! Stop the last Tx kernel thread, provided no socket is bound to it.
+
+        void
+        del_tx_thread()
+        {
+            if (::setsockopt(fd_, PF_Q, Q_SO_TX_THREAD_DEL, nullptr, 0) == -1)
+                throw pfq_error(errno, "PFQ: Tx thread del error");
+        }
+
+        //! Return the number of running Tx kernel threads.
+
+        int
+        tx_threads() const
+        {
+            int ret; socklen_t size = sizeof(ret);
+            if (::getsockopt(fd_, PF_Q, Q_SO_GET_TX_THREADS, &ret, &size) == -1)
+                throw pfq_error(errno, "PFQ: get Tx threads error");
+            return ret;
+        }
+
+        //! Set the rate of the given Tx queue, enforced by the kernel.
+        /*!
+         * The queue is -1 for the synchronous Tx queue or the index of the async queue.
+         * Rates are in packets and bits per second (0 means unlimited); burst is the number
+         * of packets that can be sent back-to-back. pps = bps = 0 disables the pacing.
+         */
+
+        void
+        tx_rate(int queue, unsigned long pps, unsigned long bps = 0, unsigned int burst = 1)
+        {
+            struct pfq_tx_rate r = { queue, burst, pps, bps };
+
+            if (::setsockopt(fd_, PF_Q, Q_SO_TX_RATE, &r, sizeof(r)) == -1)
+                throw pfq_error(errno, "PFQ: Tx rate error");
+        }
+
+        //! Set the priority and the weight of the given async Tx queue.
+        /*!
+         * The Tx kernel thread serves its queues in strict priority order (0 to
+         * Q_TX_MAX_PRIO-1, higher first): a queue is served only when no queue with a
+         * higher priority has packets pending. Queues with the same priority share the
+         * thread by deficit round robin in bytes, each sending up to 'weight' MTU-sized
+         * frames worth of bytes per round, plus the credit left unused in the previous
+         * rounds (0 means the whole queue, the default).
+         */
+
+        void
+        tx_sched(int queue, int prio, unsigned int weight = 0)
+        {
+            struct pfq_tx_sched s = { queue, prio, weight };
+
+            if (::setsockopt(fd_, PF_Q, Q_SO_TX_SCHED, &s, sizeof(s)) == -1)
+                throw pfq_error(errno, "PFQ: Tx sched error");
+        }
+
         //! Join the group specified by the group id.
         /*!
          * If the policy is not specified, group_policy::shared is used by default.
@@ -1052,6 +1438,40 @@ namespace pfq {
         }
 
 
+        //! Set a link group of the given group.
+        /*!
+         * A link group is a set of (up to Q_MAX_LINKS) egress devices with their weights,
+         * used by the pfq-lang functions link_group and bridge_link_group. Each flow is
+         * forwarded to one of the devices with carrier, in proportion to the weights;
+         * devices with weight 0 are backups, used when no weighted device has carrier.
+         * The link group can be updated while the computation of the group is running;
+         * an empty set of links removes it.
+         */
+
+        void
+        set_group_links(int gid, int id, std::vector<std::pair<std::string, unsigned int>> const &links)
+        {
+            struct pfq_group_links l {};
+
+            if (links.size() > Q_MAX_LINKS)
+                throw pfq_error("PFQ: group links: too many devices");
+
+            l.gid = gid;
+            l.id  = id;
+            l.num = static_cast<int>(links.size());
+
+            for(std::size_t n = 0; n < links.size(); n++)
+            {
+                l.ifindex[n] = ifindex(this->fd(), links[n].first.c_str());
+                if (l.ifindex[n] == -1)
+                    throw pfq_error("PFQ: group links: device not found");
+                l.weight[n] = links[n].second;
+            }
+
+            if (::setsockopt(fd_, PF_Q, Q_SO_GROUP_LINKS, &l, sizeof(l)) == -1)
+                throw pfq_error(errno, "PFQ: group links error");
+        }
+
         //! Specify a BPF program for the given group.
         /*!
          * This function can be used to set a specific BPF filter for the group.
@@ -1311,6 +1731,70 @@ namespace pfq {
             return std::vector<unsigned long>(std::begin(cs.counter), std::end(cs.counter));
         }
 
+        //! Return the drop counters of the socket, indexed by Q_DROP_* reason.
+
+        pfq_drop_stats
+        drop_stats() const
+        {
+            pfq_drop_stats stat;
+            socklen_t size = sizeof(struct pfq_drop_stats);
+            if (::getsockopt(fd_, PF_Q, Q_SO_GET_DROP_STATS, &stat, &size) == -1)
+                throw pfq_error(errno, "PFQ: get drop stats error");
+            return stat;
+        }
+
+        //! Return the drop counters of the given group.
+
+        pfq_drop_stats
+        group_drop_stats(int gid) const
+        {
+            pfq_drop_stats stat;
+            stat.reason[0] = static_cast<unsigned long>(gid);
+            socklen_t size = sizeof(struct pfq_drop_stats);
+            if (::getsockopt(fd_, PF_Q, Q_SO_GET_GROUP_DROP_STATS, &stat, &size) == -1)
+                throw pfq_error(errno, "PFQ: get group drop stats error");
+            return stat;
+        }
+
+        //! Return the global drop counters.
+
+        pfq_drop_stats
+        global_drop_stats() const
+        {
+            pfq_drop_stats stat;
+            socklen_t size = sizeof(struct pfq_drop_stats);
+            if (::getsockopt(fd_, PF_Q, Q_SO_GET_GLOBAL_DROP_STATS, &stat, &size) == -1)
+                throw pfq_error(errno, "PFQ: get global drop stats error");
+            return stat;
+        }
+
+        //! Return the number of packets copied from linear and paged skbs.
+
+        pfq_copy_stats
+        copy_stats() const
+        {
+            pfq_copy_stats stat;
+            socklen_t size = sizeof(struct pfq_copy_stats);
+            if (::getsockopt(fd_, PF_Q, Q_SO_GET_COPY_STATS, &stat, &size) == -1)
+                throw pfq_error(errno, "PFQ: get copy stats error");
+            return stat;
+        }
+
+        //! Return the statistics of the hw queues of the given device.
+
+        std::vector<pfq_queue_stats>
+        netq_stats(const char *dev) const
+        {
+            std::vector<pfq_queue_stats> stats(Q_MAX_NETQ_STATS);
+            stats[0].recv = static_cast<unsigned long>(ifindex(this->fd(), dev));
+            socklen_t size = static_cast<socklen_t>(sizeof(pfq_queue_stats) * stats.size());
+            if (::getsockopt(fd_, PF_Q, Q_SO_GET_NETQ_STATS, stats.data(), &size) == -1)
+                throw pfq_error(errno, "PFQ: get netq stats error");
+
+            stats.resize(size / sizeof(pfq_queue_stats));
+            return stats;
+        }
+
         //! Return the memory size of the Rx queue.
 
         size_t
@@ -1319,6 +1803,17 @@ namespace pfq {
             return data()->shm_size;
         }
 
+        //! Return the size of the pages backing the shared memory (0 if the socket is not enabled).
+
+        size_t
+        mem_page_size() const
+        {
+            size_t page_size = 0; socklen_t size = sizeof(page_size);
+            if (::getsockopt(fd_, PF_Q, Q_SO_GET_SHMEM_PAGE_SIZE, &page_size, &size) == -1)
+                throw pfq_error(errno, "PFQ: get shared memory page size error");
+            return page_size;
+        }
+
         //! Return the address of the Rx queue.
 
         const void *
@@ -1406,62 +1901,241 @@ namespace pfq {
             if (unlikely(!data_->shm_addr))
                 throw pfq_error("PFQ: send_to: socket not enabled");
 
-            int tss;
+            int tss = tx_select(pkt.first, pkt.second, async, queue);
 
-            auto tx = [&] {
+            // cut the packet to maxlen:
+            //
+            auto len = std::min(pkt.second, data_->tx_slot_size - sizeof(struct pfq_pkthdr));
 
-                if (async) {
-                    if (unlikely(data_->tx_num_async == 0))
-                        throw pfq_error("PFQ: send_to: socket not bound to async threads");
-                    tss = static_cast<int>(fold(queue == any_queue ? symmetric_hash(pkt.first) : static_cast<uint32_t>(queue), static_cast<uint32_t>(data_->tx_num_async)));
-                    return &static_cast<struct pfq_shared_queue *>(data_->shm_addr)->tx_async[tss];
-                }
+            auto hdr = tx_ring_reserve(tss, len, ifindex, qindex, nsec, copies);
+            if (!hdr)
+                return false;
 
-                tss = -1;
-                return &static_cast<struct pfq_shared_queue *>(data_->shm_addr)->tx;
-            }();
+            memcpy(hdr+1, pkt.first, len);
 
-            // swap the queue...
-            //
+            tx_ring_publish(tss);
+            return true;
+        }
+
+        //! Select how async Tx queues are chosen for any_queue.
+        /*!
+         * 'fun' returns a hash of the packet, folded to the number of async queues
+         * (e.g. pfq::toeplitz{key} spreads the packets as the RSS of the NIC).
+         * An empty function restores the symmetric hash.
+         */
+
+        void
+        tx_selector(std::function<uint32_t(const char *, size_t)> fun)
+        {
+            data_->tx_selector = std::move(fun);
+        }
+
+        //! Schedule the transmission of a packet template.
+        /*!
+         * The packet is stored once, with the template 'tmpl': the kernel expands it into
+         * 'copies' distinct packets, each mutated by the operations of the template
+         * (see pfq_tx_template), with the IPv4 and TCP/UDP checksums fixed incrementally.
+         */
+
+        bool
+        send_template(const_buffer pkt, pfq_tx_template const &tmpl, unsigned int copies, int ifindex = 0, int qindex = 0, bool async = false, int queue = any_queue)
+        {
+            if (unlikely(!data_->shm_addr))
+                throw pfq_error("PFQ: send_template: socket not enabled");
+
+            if (tmpl.num_ops > Q_TX_TEMPLATE_MAX_OPS)
+                throw pfq_error("PFQ: send_template: too many mutations");
 
-            auto index = __atomic_load_n(&tx->cons.index, __ATOMIC_RELAXED);
-            if (index != __atomic_load_n(&tx->prod.index, __ATOMIC_RELAXED))
+            int tss = tx_select(pkt.first, pkt.second, async, queue);
+
+            auto len = std::min(pkt.second, data_->tx_slot_size - sizeof(struct pfq_pkthdr) - sizeof(pfq_tx_template));
+
+            auto hdr = tx_ring_reserve(tss, sizeof(pfq_tx_template) + len, ifindex, qindex, 0, copies);
+            if (!hdr)
+                return false;
+
+            hdr->commit = Q_TX_SLOT_TEMPLATE;
+
+            memcpy(hdr+1, &tmpl, sizeof(pfq_tx_template));
+            memcpy(reinterpret_cast<pfq_tx_template *>(hdr+1) + 1, pkt.first, len);
+
+            tx_ring_publish(tss);
+            return true;
+        }
+
+        //! Schedule the transmission of a burst of packets.
+        /*!
+         * The packets in the range [first, last) of const_buffer are copied into the Tx queues and
+         * published to the kernel at once. With 'async' and any_queue every packet goes to the queue
+         * chosen by the Tx selector (see tx_selector), otherwise all of them go to the given queue.
+         * Return the number of packets stored, which is less than the length of the range if a queue is full.
+         */
+
+        template <typename It>
+        size_t
+        send_raw_vec(It first, It last, int ifindex, int qindex, uint64_t nsec, unsigned int copies, bool async = false, int queue = any_queue)
+        {
+            if (unlikely(!data_->shm_addr))
+                throw pfq_error("PFQ: send_vec: socket not enabled");
+
+            if (first == last)
+                return 0;
+
+            if (async && queue == any_queue)
             {
-                __atomic_store_n(&tx->prod.index, index, __ATOMIC_RELAXED);
-                __atomic_store_n((index & 1) ? &tx->prod.off1 : &tx->prod.off0, 0, __ATOMIC_RELAXED);
-            }
+                if (unlikely(data_->tx_num_async == 0))
+                    throw pfq_error("PFQ: send: socket not bound to async threads");
 
-            char * base_addr = static_cast<char *>(data_->tx_queue_addr) + data_->tx_queue_size * static_cast<size_t>(2 * (1+tss) + (index & 1 ? 1 : 0));
+                // a queue per packet: the selector runs on a batch at a time, then
+                // the packets are stored and every queue touched is published once
 
-            // get the current offset...
-            //
-            auto offset = __atomic_load_n((index & 1) ? &tx->prod.off1 : &tx->prod.off0, __ATOMIC_RELAXED);
+                constexpr size_t batch = 32;
+                unsigned int touched = 0;
+                int qs[batch];
+                size_t n = 0;
 
-            // cut the packet to maxlen:
-            //
-            auto len = std::min(pkt.second, data_->tx_slot_size - sizeof(struct pfq_pkthdr));
+                while (first != last)
+                {
+                    auto it = first;
+                    size_t m = 0;
+
+                    for(; m < batch && it != last; ++it, ++m)
+                        qs[m] = static_cast<int>(fold(tx_hash(it->first, static_cast<size_t>(it->second)),
+                                                      static_cast<uint32_t>(data_->tx_num_async)));
+
+                    for(size_t j = 0; j < m; ++j, ++first, ++n)
+                    {
+                        auto len = std::min(static_cast<size_t>(first->second), data_->tx_slot_size - sizeof(struct pfq_pkthdr));
+                        auto hdr = tx_ring_reserve(qs[j], len, ifindex, qindex, nsec, copies);
+                        if (!hdr)
+                            goto publish;
+                        memcpy(hdr+1, first->first, len);
+                        touched |= 1U << qs[j];
+                    }
+                }
+            publish:
+                for(int tss = 0; touched; ++tss, touched >>= 1)
+                    if (touched & 1)
+                        tx_ring_publish(tss);
+                return n;
+            }
 
-            // compute the current slot_size:
-            //
-            auto slot_size = sizeof(struct pfq_pkthdr) + align<8>(len);
+            int tss = tx_select(first->first, static_cast<size_t>(first->second), async, queue);
 
-            // ensure there's enough space for the current slot_size + the next header:
-            //
-            if ((static_cast<size_t>(offset) + slot_size) < data_->tx_queue_size)
+            size_t n = 0;
+            for(; first != last; ++first, ++n)
             {
-                auto hdr = (struct pfq_pkthdr *)(base_addr + offset);
-                hdr->tstamp.tv64 = nsec;
-                hdr->caplen      = static_cast<uint16_t>(len);
-                hdr->data.copies = copies;
-                hdr->ifindex     = ifindex;
-                hdr->queue       = static_cast<uint8_t>(qindex);
-                memcpy(hdr+1, pkt.first, len);
-
-                __atomic_store_n((index & 1) ? &tx->prod.off1 : &tx->prod.off0, offset + static_cast<ptrdiff_t>(slot_size), __ATOMIC_RELEASE);
-                return true;
+                auto len = std::min(static_cast<size_t>(first->second), data_->tx_slot_size - sizeof(struct pfq_pkthdr));
+                auto hdr = tx_ring_reserve(tss, len, ifindex, qindex, nsec, copies);
+                if (!hdr)
+                    break;
+                memcpy(hdr+1, first->first, len);
             }
 
-            return false;
+            tx_ring_publish(tss);
+            return n;
+        }
+
+        //! Store a burst of packets and optionally transmit the packets in the queue.
+        /*!
+         * The queue is flushed once, if 'flush' is true.
+         * Requires the socket is bound for transmission to a net device and queue.
+         * See 'bind_tx'.
+         */
+
+        template <typename It>
+        size_t
+        send_vec(It first, It last, bool flush = true, unsigned int copies = 1)
+        {
+            auto n = send_raw_vec(first, last, 0, 0, 0, copies, false);
+            if (n && flush)
+                this->transmit_queue(0);
+            return n;
+        }
+
+        //! Transmit a burst of packets asynchronously.
+        /*!
+         * The burst is handled by a single PFQ kernel thread.
+         * See 'send_raw_vec'.
+         */
+
+        template <typename It>
+        size_t
+        send_vec_async(It first, It last, unsigned int copies = 1)
+        {
+            return send_raw_vec(first, last, 0, 0, 0, copies, true, any_queue);
+        }
+
+        //! Reserve a slot in a Tx queue to build a packet in place.
+        /*!
+         * 'queue' is -1 for the synchronous queue, or the index of an async queue.
+         * Return the buffer where the packet is to be written, or an empty buffer if
+         * the queue is full. The packet is not visible to the kernel until tx_commit
+         * is called, and must be written before any other send on the same queue.
+         */
+
+        mutable_buffer
+        tx_reserve(int queue, size_t len, int ifindex = 0, int qindex = 0, uint64_t nsec = 0, unsigned int copies = 1)
+        {
+            if (unlikely(!data_->shm_addr))
+                throw pfq_error("PFQ: tx_reserve: socket not enabled");
+
+            if (queue < -1 || queue >= static_cast<int>(data_->tx_num_async))
+                throw pfq_error("PFQ: tx_reserve: bad queue index");
+
+            if (len > data_->tx_slot_size - sizeof(struct pfq_pkthdr))
+                throw pfq_error("PFQ: tx_reserve: packet too long");
+
+            auto hdr = tx_ring_reserve(queue, len, ifindex, qindex, nsec, copies);
+            if (!hdr)
+                return mutable_buffer{nullptr, 0};
+
+            return mutable_buffer{reinterpret_cast<char *>(hdr+1), len};
+        }
+
+        //! Publish the packets reserved with tx_reserve.
+        /*!
+         * Async Tx threads waiting on the doorbell are woken up.
+         */
+
+        void
+        tx_commit()
+        {
+            if (unlikely(!data_->shm_addr))
+                throw pfq_error("PFQ: tx_commit: socket not enabled");
+
+            for(int tss = -1; tss < static_cast<int>(data_->tx_num_async); tss++)
+                tx_ring_publish(tss);
+        }
+
+        //! Replay a pcap file from an async Tx queue.
+        /*!
+         * The pcap file mapped at 'addr' is pinned and transmitted by the Tx
+         * thread of the queue, 'loops' times (0 = forever). With 'tstamp' the
+         * original gaps are honored, scaled by 'speed' (1000 = original pace).
+         * A null 'addr' stops the replay in progress.
+         */
+
+        void
+        tx_replay(int queue, const void *addr, size_t len, unsigned int loops = 1, unsigned int speed = 1000, bool tstamp = false)
+        {
+            struct pfq_tx_replay replay { queue, addr, len, loops, speed, tstamp };
+
+            if (::setsockopt(fd_, PF_Q, Q_SO_TX_REPLAY, &replay, sizeof(replay)) == -1)
+                throw pfq_error(errno, "PFQ: Tx replay error");
+        }
+
+        //! Return the progress of the pcap replay of an async Tx queue.
+
+        pfq_tx_replay_stats
+        tx_replay_stats(int queue) const
+        {
+            pfq_tx_replay_stats stat;
+            stat.queue = queue;
+            socklen_t size = sizeof(stat);
+            if (::getsockopt(fd_, PF_Q, Q_SO_GET_TX_REPLAY, &stat, &size) == -1)
+                throw pfq_error(errno, "PFQ: get Tx replay stats error");
+            return stat;
         }
 
         //! Transmit the packets in the queue.
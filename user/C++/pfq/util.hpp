@@ -33,6 +33,8 @@
 #include <iterator>
 #include <thread>
 #include <algorithm>
+#include <array>
+#include <cstdint>
 
 #include <linux/pf_q.h>
 #include <linux/if_ether.h>
@@ -41,6 +43,7 @@
 
 #include <arpa/inet.h>
 #include <sys/ioctl.h>
+#include <sys/vfs.h>
 #include <net/if.h>
 
 #include <pfq/exception.hpp>
@@ -227,8 +230,50 @@ namespace pfq {
         return {};
     }
 
+    //! HugePages mount point best suited to a memory of the given size.
+    /*!
+     * The hugetlbfs with the largest pages not exceeding the size (e.g. 1GB
+     * pages for multi-GB rings), the one with the smallest pages otherwise.
+     */
+
+    inline std::string
+    hugepages_mountpoint(size_t size, size_t &page_size)
+    {
+        std::ifstream ms("/proc/mounts");
+        std::string ret;
+        size_t best = 0;
+
+        for(std::string line; std::getline(ms, line); )
+        {
+            if (line.compare(0, 10, "hugetlbfs ") != 0)
+                continue;
+
+            auto mp = split(line, " ").at(1);
+
+            struct statfs fs;
+            if (::statfs(mp.c_str(), &fs) == -1)
+                continue;
+
+            auto psize = static_cast<size_t>(fs.f_bsize);
+
+            if (ret.empty() ||
+                (psize <= size && (best > size || psize > best)) ||
+                (psize > size && best > size && psize < best)) {
+                ret = mp;
+                best = psize;
+            }
+        }
+
+        page_size = best;
+        return ret;
+    }
+
 
     //! symmetric hash (TSS).
+    /*!
+     * Addresses and TCP/UDP ports of IPv4 and IPv6 packets (with an optional
+     * 802.1Q tag), MAC addresses of non-IP frames.
+     */
 
     inline uint32_t
     symmetric_hash(const char *buf) noexcept
@@ -236,23 +281,159 @@ namespace pfq {
         const char *ptr = buf;
 
         auto eh = reinterpret_cast<const ethhdr *>(ptr);
-        if (eh->h_proto != htons(0x800))
-            return 0;
+        auto proto = eh->h_proto;
 
         ptr += sizeof(ethhdr);
 
-        auto ih = reinterpret_cast<const iphdr *>(ptr);
-        if (ih->protocol != IPPROTO_TCP &&
-            ih->protocol != IPPROTO_UDP)
-            return (ih->saddr ^ ih->daddr);
+        if (proto == htons(ETH_P_8021Q)) {
+            proto = *reinterpret_cast<const uint16_t *>(ptr + 2);
+            ptr += 4;
+        }
+
+        if (proto == htons(ETH_P_IP))
+        {
+            auto ih = reinterpret_cast<const iphdr *>(ptr);
+            if (ih->protocol != IPPROTO_TCP &&
+                ih->protocol != IPPROTO_UDP)
+                return (ih->saddr ^ ih->daddr);
+
+            auto uh = reinterpret_cast<const udphdr *>(ptr + (ih->ihl << 2));
+            return (ih->saddr ^ ih->daddr ^ uh->source ^ uh->dest);
+        }
 
-        ptr += sizeof(ih->ihl << 2);
+        if (proto == htons(ETH_P_IPV6))
+        {
+            auto addr = reinterpret_cast<const uint32_t *>(ptr + 8);
+            uint32_t hash = addr[0] ^ addr[1] ^ addr[2] ^ addr[3] ^
+                            addr[4] ^ addr[5] ^ addr[6] ^ addr[7];
+
+            if (ptr[6] == IPPROTO_TCP || ptr[6] == IPPROTO_UDP) {
+                auto uh = reinterpret_cast<const udphdr *>(ptr + 40);
+                hash ^= static_cast<uint32_t>(uh->source ^ uh->dest);
+            }
+            return hash;
+        }
 
-        auto uh = reinterpret_cast<const udphdr *>(ptr);
-        return (ih->saddr ^ ih->daddr ^ uh->source ^ uh->dest);
+        return *reinterpret_cast<const uint32_t *>(eh->h_dest) ^ *reinterpret_cast<const uint32_t *>(eh->h_source) ^
+               static_cast<uint32_t>(*reinterpret_cast<const uint16_t *>(eh->h_dest + 4) ^ *reinterpret_cast<const uint16_t *>(eh->h_source + 4));
     }
 
 
+    //! Toeplitz hash (RSS).
+    /*!
+     * Computed on the addresses and TCP/UDP ports of IPv4/IPv6 packets, as the
+     * RSS of the NIC with the same key. The default key (0x6d5a...) is symmetric.
+     * For each byte of the input and each of its values the table holds the xor
+     * of the windows of the key selected by its bits: a lookup per byte.
+     */
+
+    class toeplitz
+    {
+    public:
+        static constexpr size_t key_len   = 40;
+        static constexpr size_t input_len = 36;    // IPv6 addresses and ports
+
+        toeplitz()
+        {
+            std::array<uint8_t, key_len> key;
+            for(size_t i = 0; i < key_len; i += 2) {
+                key[i]   = 0x6d;
+                key[i+1] = 0x5a;
+            }
+            init(key.data());
+        }
+
+        explicit toeplitz(const uint8_t *key)
+        {
+            init(key);
+        }
+
+        uint32_t
+        hash(const char *buf, size_t len) const noexcept
+        {
+            const char *ptr = buf + sizeof(ethhdr);
+            uint8_t in[input_len];
+            size_t n, off;
+            int l4;
+
+            if (len < sizeof(ethhdr) + 4)
+                return 0;
+
+            auto proto = reinterpret_cast<const ethhdr *>(buf)->h_proto;
+            if (proto == htons(ETH_P_8021Q)) {
+                memcpy(&proto, ptr + 2, sizeof(proto));
+                ptr += 4;
+            }
+
+            auto rem = len - static_cast<size_t>(ptr - buf);
+
+            if (proto == htons(ETH_P_IP) && rem >= sizeof(iphdr)) {
+                auto ih = reinterpret_cast<const iphdr *>(ptr);
+                memcpy(in, &ih->saddr, 8);
+                n = 8;
+                off = static_cast<size_t>(ih->ihl) << 2;
+                l4 = (ih->frag_off & htons(0x3fff)) ? 0 : ih->protocol;  // no ports in fragments
+            }
+            else if (proto == htons(ETH_P_IPV6) && rem >= 40) {
+                memcpy(in, ptr + 8, 32);
+                n = 32;
+                off = 40;
+                l4 = static_cast<uint8_t>(ptr[6]);
+            }
+            else if (proto == htons(ETH_P_IP) || proto == htons(ETH_P_IPV6))
+                return 0;   // truncated IP header
+            else
+                return symmetric_hash(buf);    // MAC addresses only
+
+            if ((l4 == IPPROTO_TCP || l4 == IPPROTO_UDP) && rem >= off + 4) {
+                memcpy(in + n, ptr + off, 4);
+                n += 4;
+            }
+
+            uint32_t h = 0;
+            for(size_t i = 0; i < n; i++)
+                h ^= table_[i * 256 + in[i]];
+            return h;
+        }
+
+        //! Index in the default RSS indirection table (128 entries): usable as Tx selector.
+
+        uint32_t
+        operator()(const char *buf, size_t len) const noexcept
+        {
+            return hash(buf, len) & 0x7f;
+        }
+
+    private:
+
+        void init(const uint8_t *key)
+        {
+            table_.resize(input_len * 256);
+
+            for(size_t i = 0; i < input_len; i++)
+            {
+                uint64_t k = static_cast<uint64_t>(key[i]) << 32 | static_cast<uint64_t>(key[i+1]) << 24 |
+                             static_cast<uint64_t>(key[i+2]) << 16 | static_cast<uint64_t>(key[i+3]) << 8 | key[i+4];
+                uint32_t win[8];
+
+                for(size_t b = 0; b < 8; b++)
+                    win[b] = static_cast<uint32_t>(k >> (8 - b));
+
+                for(size_t v = 0; v < 256; v++)
+                {
+                    uint32_t h = 0;
+                    for(size_t b = 0; b < 8; b++)
+                        if (v & (0x80 >> b))
+                            h ^= win[b];
+                    table_[i * 256 + v] = h;
+                }
+            }
+        }
+
+        std::vector<uint32_t> table_;
+    };
+
+
     inline uint32_t
     fold(uint32_t hash, uint32_t n) noexcept
     {
@@ -26,6 +26,7 @@
 #include <sys/stat.h>
 #include <sys/ioctl.h>
 #include <sys/mman.h>
+#include <sys/vfs.h>
 
 #include <net/if.h>
 #include <net/ethernet.h>
@@ -73,6 +74,15 @@ struct pfq_data
 
 	size_t tx_num_async;
 
+	unsigned int tx_compl_tail[1 + Q_MAX_TX_QUEUES];
+	size_t tx_prod[1 + Q_MAX_TX_QUEUES];
+	unsigned int tx_tstamp_tail;
+
+	int tx_selector;
+	uint32_t *tx_toeplitz;
+	pfq_tx_selector_t tx_selector_fun;
+	void *tx_selector_user;
+
 	const char * error;
 
 	int fd;
@@ -159,12 +169,17 @@ with_tokens(const char *p, const char *sep, int (*call)(char **, size_t n, va_li
 	return ret;
 }
 
+/* return the hugetlbfs mount point best suited to a memory of the given
+ * size: the one with the largest pages not exceeding the size (e.g. 1GB
+ * pages for multi-GB rings), the one with the smallest pages otherwise.
+ */
+
 static char *
-hugepages_mountpoint()
+hugepages_mountpoint(size_t size, size_t *page_size)
 {
 	FILE *mp;
 	char *line = NULL, *mount_point = NULL;
-	size_t len = 0;
+	size_t len = 0, best = 0;
 	ssize_t read;
 
 	mp = fopen("/proc/mounts", "r");
@@ -173,14 +188,31 @@ hugepages_mountpoint()
 
 	while((read = getline(&line, &len, mp)) != -1) {
 		char mbuff[256];
-		if(sscanf(line, "hugetlbfs %s", mbuff) == 1) {
+		struct statfs fs;
+		size_t psize;
+
+		if(sscanf(line, "hugetlbfs %255s", mbuff) != 1)
+			continue;
+
+		if (statfs(mbuff, &fs) == -1)
+			continue;
+
+		psize = (size_t)fs.f_bsize;
+
+		if (mount_point == NULL ||
+		    (psize <= size && (best > size || psize > best)) ||
+		    (psize > size && best > size && psize < best)) {
+			free(mount_point);
 			mount_point = strdup(mbuff);
-			break;
+			best = psize;
 		}
 	}
 
 	free (line);
 	fclose (mp);
+
+	if (page_size)
+		*page_size = best;
 	return mount_point;
 }
 
@@ -307,10 +339,12 @@ int pfq_close(pfq_t *q)
 		if (q->hd != -1)
 			close(q->hd);
 
+		free(q->tx_toeplitz);
 		free(q);
                 return Q_OK(q);
 	}
 
+	free(q->tx_toeplitz);
 	free(q);
 	return __error = "PFQ: socket not open", -1;
 }
@@ -319,7 +353,7 @@ int pfq_close(pfq_t *q)
 int
 pfq_enable(pfq_t *q)
 {
-	size_t tot_mem; socklen_t size = sizeof(tot_mem);
+	size_t tot_mem, page_size = 0; socklen_t size = sizeof(tot_mem);
 	char filename[256];
         char *hugepages, *env;
 
@@ -333,14 +367,18 @@ pfq_enable(pfq_t *q)
 	}
 
 	env = getenv("PFQ_HUGEPAGES");
-	hugepages = hugepages_mountpoint();
+	hugepages = hugepages_mountpoint(tot_mem, &page_size);
 
 	if (hugepages &&
 	    !getenv("PFQ_NO_HUGEPAGES") &&
 	    (env == NULL || atoi(env) != 0) )
 	{
-		/* HugePages */
-		fprintf(stdout, "[PFQ] using HugePages...\n");
+		/* HugePages: the kernel returns the exact size,
+		 * the mapping is rounded up to the page size */
+
+		tot_mem = ALIGN(tot_mem, page_size);
+
+		fprintf(stdout, "[PFQ] using HugePages (%zu kB)...\n", page_size >> 10);
 
 		snprintf(filename, 256, "%s/pfq.%d", hugepages, q->id);
 		free (hugepages);
@@ -350,6 +388,10 @@ pfq_enable(pfq_t *q)
 			return Q_ERROR(q, "PFQ: couldn't open a HugePages descriptor");
 
 		q->shm_addr = mmap(NULL, tot_mem, PROT_READ|PROT_WRITE, MAP_SHARED, q->hd, 0);
+
+		/* the pages are released with the last mapping */
+		unlink(filename);
+
 		if (q->shm_addr == MAP_FAILED)
 			return Q_ERROR(q, "PFQ: couldn't mmap HugePages");
 
@@ -360,6 +402,7 @@ pfq_enable(pfq_t *q)
 		/* Standard pages (4K) */
 
 		void * null = NULL;
+		free (hugepages);
 		fprintf(stdout, "[PFQ] using 4k-Pages...\n");
 		if(setsockopt(q->fd, PF_Q, Q_SO_ENABLE, &null, sizeof(null)) == -1)
 			return Q_ERROR(q, "PFQ: socket enable");
@@ -377,6 +420,10 @@ pfq_enable(pfq_t *q)
 	q->tx_queue_addr = (char *)(q->shm_addr) + sizeof(struct pfq_shared_queue) + q->rx_queue_size * 2;
 	q->tx_queue_size = q->tx_slots * q->tx_slot_size;
 
+	memset(q->tx_compl_tail, 0, sizeof(q->tx_compl_tail));
+	memset(q->tx_prod, 0, sizeof(q->tx_prod));
+	q->tx_tstamp_tail = 0;
+
 	return Q_OK(q);
 }
 
@@ -393,13 +440,8 @@ pfq_disable(pfq_t *q)
 			return Q_ERROR(q, "PFQ: munmap error");
 
 		if (q->hd != -1) {
-			char filename[256];
-			char *hugepages = hugepages_mountpoint();
-			if (hugepages) {
-				snprintf(filename, 256, "%s/pfq.%d", hugepages, q->fd);
-				unlink(filename);
-				free(hugepages);
-			}
+			close(q->hd);
+			q->hd = -1;
 		}
 	}
 
@@ -471,6 +513,134 @@ pfq_get_weight(pfq_t const *q)
 	return Q_VALUE(q, ret);
 }
 
+int
+pfq_set_tx_zerocopy(pfq_t *q, int value)
+{
+	int enabled = pfq_is_enabled(q);
+	if (enabled == 1) {
+		return Q_ERROR(q, "PFQ: enabled (Tx zerocopy could not be set)");
+	}
+	if (setsockopt(q->fd, PF_Q, Q_SO_SET_TX_ZEROCOPY, &value, sizeof(value)) == -1) {
+		return Q_ERROR(q, "PFQ: set Tx zerocopy error");
+	}
+	return Q_OK(q);
+}
+
+
+int
+pfq_get_tx_zerocopy(pfq_t const *q)
+{
+	int ret; socklen_t size = sizeof(ret);
+
+	if (getsockopt(q->fd, PF_Q, Q_SO_GET_TX_ZEROCOPY, &ret, &size) == -1) {
+	        return Q_ERROR(q, "PFQ: get Tx zerocopy error");
+	}
+	return Q_VALUE(q, ret);
+}
+
+
+int
+pfq_tx_completions(pfq_t *q, int queue, uint32_t *offs, size_t max)
+{
+        struct pfq_shared_queue *sh_queue = (struct pfq_shared_queue *)(q->shm_addr);
+        struct pfq_tx_completion_ring *ring;
+        struct pfq_tx_queue *tx;
+	unsigned int head, tail;
+	size_t n = 0;
+
+	if (unlikely(q->shm_addr == NULL))
+		return Q_ERROR(q, "PFQ: tx_completions: socket not enabled");
+
+	if (queue < -1 || queue >= Q_MAX_TX_QUEUES)
+		return Q_ERROR(q, "PFQ: tx_completions: bad queue index");
+
+	tx = queue == -1 ? &sh_queue->tx : &sh_queue->tx_async[queue];
+	if (tx->completion == 0)
+		return Q_ERROR(q, "PFQ: tx_completions: zero-copy Tx not enabled");
+
+	ring = (struct pfq_tx_completion_ring *)((char *)q->shm_addr + tx->completion);
+
+	head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+	tail = q->tx_compl_tail[1 + queue];
+
+	/* completions overwritten by the kernel are lost */
+
+	if (head - tail > Q_TX_COMPLETION_LEN)
+		tail = head - Q_TX_COMPLETION_LEN;
+
+	for(; n < max; n++, tail++)
+	{
+		struct pfq_tx_completion *c = &ring->ring[tail & (Q_TX_COMPLETION_LEN-1)];
+		if (__atomic_load_n(&c->seq, __ATOMIC_ACQUIRE) != tail + 1)
+			break;
+		offs[n] = c->off;
+	}
+
+	q->tx_compl_tail[1 + queue] = tail;
+	__atomic_store_n(&ring->tail, tail, __ATOMIC_RELEASE);
+	return Q_VALUE(q, (int)n);
+}
+
+
+int
+pfq_set_tx_tstamp(pfq_t *q, int flags)
+{
+	if (setsockopt(q->fd, PF_Q, Q_SO_TX_TSTAMP, &flags, sizeof(flags)) == -1) {
+		return Q_ERROR(q, "PFQ: set Tx tstamp error");
+	}
+	return Q_OK(q);
+}
+
+
+int
+pfq_get_tx_tstamp(pfq_t const *q)
+{
+	int ret; socklen_t size = sizeof(ret);
+
+	if (getsockopt(q->fd, PF_Q, Q_SO_GET_TX_TSTAMP, &ret, &size) == -1) {
+	        return Q_ERROR(q, "PFQ: get Tx tstamp error");
+	}
+	return Q_VALUE(q, ret);
+}
+
+
+int
+pfq_tx_tstamps(pfq_t *q, struct pfq_tx_tstamp *ts, size_t max)
+{
+        struct pfq_shared_queue *sh_queue = (struct pfq_shared_queue *)(q->shm_addr);
+        struct pfq_tx_tstamp_ring *ring;
+	unsigned int head, tail;
+	size_t n = 0;
+
+	if (unlikely(q->shm_addr == NULL))
+		return Q_ERROR(q, "PFQ: tx_tstamps: socket not enabled");
+
+	if (sh_queue->tx_tstamp == 0)
+		return Q_ERROR(q, "PFQ: tx_tstamps: socket enabled without timestamps");
+
+	ring = (struct pfq_tx_tstamp_ring *)((char *)q->shm_addr + sh_queue->tx_tstamp);
+
+	head = __atomic_load_n(&ring->head, __ATOMIC_RELAXED);
+	tail = q->tx_tstamp_tail;
+
+	/* timestamps overwritten by the kernel are lost */
+
+	if (head - tail > Q_TX_TSTAMP_LEN)
+		tail = head - Q_TX_TSTAMP_LEN;
+
+	for(; n < max; n++, tail++)
+	{
+		struct pfq_tx_tstamp *t = &ring->ring[tail & (Q_TX_TSTAMP_LEN-1)];
+		if (__atomic_load_n(&t->seq, __ATOMIC_ACQUIRE) != tail + 1)
+			break;
+		ts[n] = *t;
+	}
+
+	q->tx_tstamp_tail = tail;
+	return Q_VALUE(q, (int)n);
+}
+
+
 int
 pfq_ifindex(pfq_t const *q, const char *dev)
 {
@@ -740,6 +910,36 @@ pfq_set_group_computation(pfq_t *q, int gid, struct pfq_lang_computation_descr *
 }
 
 
+int
+pfq_set_group_links(pfq_t *q, int gid, int id, const char **devs, const unsigned int *weights, size_t n)
+{
+	struct pfq_group_links l;
+	size_t i;
+
+	if (n > Q_MAX_LINKS)
+		return Q_ERROR(q, "PFQ: group links: too many devices");
+
+	memset(&l, 0, sizeof(l));
+
+	l.gid = gid;
+	l.id  = id;
+	l.num = (int)n;
+
+	for(i = 0; i < n; i++)
+	{
+		l.ifindex[i] = pfq_ifindex(q, devs[i]);
+		if (l.ifindex[i] == -1)
+			return Q_ERROR(q, "PFQ: group links: device not found");
+		l.weight[i] = weights ? weights[i] : 1;
+	}
+
+        if (setsockopt(q->fd, PF_Q, Q_SO_GROUP_LINKS, &l, sizeof(l)) == -1)
+		return Q_ERROR(q, "PFQ: group links error");
+
+	return Q_OK(q);
+}
+
+
 static int __do_set_group_computation(char **fun, size_t n, va_list arg_list)
 {
 	size_t i, j;
@@ -912,6 +1112,73 @@ pfq_get_group_counters(pfq_t const *q, int gid, struct pfq_counters *cs)
 }
 
 
+int
+pfq_get_drop_stats(pfq_t const *q, struct pfq_drop_stats *stats)
+{
+	socklen_t size = sizeof(struct pfq_drop_stats);
+	if (getsockopt(q->fd, PF_Q, Q_SO_GET_DROP_STATS, stats, &size) == -1) {
+		return Q_ERROR(q, "PFQ: get drop stats error");
+	}
+	return Q_OK(q);
+}
+
+
+int
+pfq_get_group_drop_stats(pfq_t const *q, int gid, struct pfq_drop_stats *stats)
+{
+	socklen_t size = sizeof(struct pfq_drop_stats);
+
+	stats->reason[0] = (unsigned long)gid;
+	if (getsockopt(q->fd, PF_Q, Q_SO_GET_GROUP_DROP_STATS, stats, &size) == -1) {
+		return Q_ERROR(q, "PFQ: get group drop stats error");
+	}
+	return Q_OK(q);
+}
+
+
+int
+pfq_get_global_drop_stats(pfq_t const *q, struct pfq_drop_stats *stats)
+{
+	socklen_t size = sizeof(struct pfq_drop_stats);
+	if (getsockopt(q->fd, PF_Q, Q_SO_GET_GLOBAL_DROP_STATS, stats, &size) == -1) {
+		return Q_ERROR(q, "PFQ: get global drop stats error");
+	}
+	return Q_OK(q);
+}
+
+
+int
+pfq_get_copy_stats(pfq_t const *q, struct pfq_copy_stats *stats)
+{
+	socklen_t size = sizeof(struct pfq_copy_stats);
+	if (getsockopt(q->fd, PF_Q, Q_SO_GET_COPY_STATS, stats, &size) == -1) {
+		return Q_ERROR(q, "PFQ: get copy stats error");
+	}
+	return Q_OK(q);
+}
+
+
+int
+pfq_get_netq_stats(pfq_t const *q, const char *dev, struct pfq_queue_stats *stats, size_t max)
+{
+	socklen_t size = (socklen_t)(sizeof(struct pfq_queue_stats) * max);
+	int index;
+
+	if (max == 0)
+		return Q_ERROR(q, "PFQ: get netq stats error (empty buffer)");
+
+	index = pfq_ifindex(q, dev);
+	if (index == -1)
+		return Q_ERROR(q, "PFQ: get netq stats: device not found");
+
+	stats[0].recv = (unsigned long)index;
+	if (getsockopt(q->fd, PF_Q, Q_SO_GET_NETQ_STATS, stats, &size) == -1) {
+		return Q_ERROR(q, "PFQ: get netq stats error");
+	}
+	return Q_VALUE(q, (int)(size / sizeof(struct pfq_queue_stats)));
+}
+
+
 int
 pfq_vlan_filters_enable(pfq_t *q, int gid, int toggle)
 {
@@ -1061,6 +1328,28 @@ pfq_bind_tx(pfq_t *q, const char *dev, int queue, int tid)
 }
 
 
+int
+pfq_bind_tx_reserved(pfq_t *q, const char *dev, int queue, int tid)
+{
+	struct pfq_binding b;
+        int ifindex;
+
+        ifindex = pfq_ifindex(q, dev);
+        if (ifindex == -1)
+		return Q_ERROR(q, "PFQ: device not found");
+
+	b = (struct pfq_binding){ {tid}, ifindex, queue };
+
+        if (setsockopt(q->fd, PF_Q, Q_SO_TX_BIND_RSVD, &b, sizeof(b)) == -1)
+		return Q_ERROR(q, "PFQ: Tx reserved bind error");
+
+	if (tid != Q_NO_KTHREAD)
+		q->tx_num_async++;
+
+	return Q_OK(q);
+}
+
+
 int
 pfq_unbind_tx(pfq_t *q)
 {
@@ -1073,70 +1362,518 @@ pfq_unbind_tx(pfq_t *q)
 
 
 int
-pfq_send_raw(pfq_t *q, const void *buf, size_t len, int ifindex, int qindex, uint64_t nsec,
-	     unsigned int copies, int async, int queue)
+pfq_set_tx_async_queues(pfq_t *q, size_t value)
+{
+	int enabled = pfq_is_enabled(q);
+	if (enabled == 1) {
+		return Q_ERROR(q, "PFQ: enabled (Tx async queues could not be set)");
+	}
+	if (setsockopt(q->fd, PF_Q, Q_SO_SET_TX_ASYNC_QUEUES, &value, sizeof(value)) == -1) {
+		return Q_ERROR(q, "PFQ: set Tx async queues error");
+	}
+	return Q_OK(q);
+}
+
+
+size_t
+pfq_get_tx_async_queues(pfq_t const *q)
+{
+	size_t ret; socklen_t size = sizeof(ret);
+
+	if (getsockopt(q->fd, PF_Q, Q_SO_GET_TX_ASYNC_QUEUES, &ret, &size) == -1) {
+	        return Q_VALUE(q, (size_t)0);
+	}
+	return Q_VALUE(q, ret);
+}
+
+
+int
+pfq_add_tx_thread(pfq_t *q, int cpu)
+{
+	int tid; socklen_t size = sizeof(tid);
+
+        if (setsockopt(q->fd, PF_Q, Q_SO_TX_THREAD_ADD, &cpu, sizeof(cpu)) == -1)
+		return Q_ERROR(q, "PFQ: Tx thread add error");
+
+	if (getsockopt(q->fd, PF_Q, Q_SO_GET_TX_THREADS, &tid, &size) == -1)
+		return Q_ERROR(q, "PFQ: get Tx threads error");
+
+	return Q_VALUE(q, tid - 1);
+}
+
+
+int
+pfq_del_tx_thread(pfq_t *q)
+{
+        if (setsockopt(q->fd, PF_Q, Q_SO_TX_THREAD_DEL, NULL, 0) == -1)
+		return Q_ERROR(q, "PFQ: Tx thread del error");
+
+	return Q_OK(q);
+}
+
+
+int
+pfq_get_tx_threads(pfq_t const *q)
+{
+	int ret; socklen_t size = sizeof(ret);
+
+	if (getsockopt(q->fd, PF_Q, Q_SO_GET_TX_THREADS, &ret, &size) == -1) {
+	        return Q_ERROR(q, "PFQ: get Tx threads error");
+	}
+	return Q_VALUE(q, ret);
+}
+
+
+int
+pfq_set_tx_rate(pfq_t *q, int queue, unsigned long pps, unsigned long bps, unsigned int burst)
+{
+	struct pfq_tx_rate r = { queue, burst, pps, bps };
+
+        if (setsockopt(q->fd, PF_Q, Q_SO_TX_RATE, &r, sizeof(r)) == -1)
+		return Q_ERROR(q, "PFQ: Tx rate error");
+
+	return Q_OK(q);
+}
+
+
+int
+pfq_set_tx_sched(pfq_t *q, int queue, int prio, unsigned int weight)
+{
+	struct pfq_tx_sched s = { queue, prio, weight };
+
+        if (setsockopt(q->fd, PF_Q, Q_SO_TX_SCHED, &s, sizeof(s)) == -1)
+		return Q_ERROR(q, "PFQ: Tx sched error");
+
+	return Q_OK(q);
+}
+
+
+/* Tx ring producer: records are reserved at the local cursor (tx_prod) and
+ * become visible to the kernel only when the cursor is published.
+ */
+
+static inline struct pfq_tx_queue *
+pfq_tx_queue_of(pfq_t *q, int tss)
 {
         struct pfq_shared_queue *sh_queue = (struct pfq_shared_queue *)(q->shm_addr);
-        struct pfq_tx_queue *tx;
-        unsigned int index;
-        size_t slot_size;
+	return tss == -1 ? (struct pfq_tx_queue *)&sh_queue->tx : (struct pfq_tx_queue *)&sh_queue->tx_async[tss];
+}
+
+
+static struct pfq_pkthdr *
+pfq_tx_ring_reserve(pfq_t *q, int tss, size_t len, int ifindex, int qindex, uint64_t nsec, unsigned int copies)
+{
+        struct pfq_tx_queue *tx = pfq_tx_queue_of(q, tss);
+        struct pfq_pkthdr *hdr;
+        size_t slot_size, pos, cons, off, rem, pad;
         char *base_addr;
-        ptrdiff_t offset;
-        int tss;
 
-	if (unlikely(q->shm_addr == NULL))
-		return Q_ERROR(q, "PFQ: send_deferred: socket not enabled");
+	base_addr = q->tx_queue_addr + q->tx_queue_size * (size_t)(2 * (1+tss));
+
+	pos  = q->tx_prod[1+tss];
+	cons = __atomic_load_n(&tx->cons.pos, __ATOMIC_ACQUIRE);
 
-	if (async) {
-		if (unlikely(q->tx_num_async == 0))
-			return Q_ERROR(q, "PFQ: send_deferred: socket not bound to async thread");
+	slot_size = sizeof(struct pfq_pkthdr) + ALIGN(len, 8);
+
+	/* slots never wrap: the tail of the ring is skipped if too short */
+
+	off = pos % tx->size;
+	rem = tx->size - off;
+	pad = rem < slot_size ? rem : 0;
 
-		tss = (int)pfq_fold((queue == Q_ANY_QUEUE ? pfq_symmetric_hash(buf) : (unsigned int)queue),
-										      (unsigned int)q->tx_num_async);
+	if (pos + pad + slot_size - cons > tx->size)
+		return NULL;
 
-		tx = (struct pfq_tx_queue *)&sh_queue->tx_async[tss];
+	if (pad) {
+		if (rem >= sizeof(struct pfq_pkthdr))
+			((struct pfq_pkthdr *)(base_addr + off))->commit = Q_TX_SLOT_SKIP;
+		pos += pad;
+		off = 0;
 	}
-	else {
-		tss = -1;
-		tx = (struct pfq_tx_queue *)&sh_queue->tx;
+
+	hdr = (struct pfq_pkthdr *)(base_addr + off);
+	hdr->tstamp.tv64 = nsec;
+	hdr->caplen = (uint16_t)len;
+	hdr->data.copies = copies;
+        hdr->ifindex = ifindex;
+        hdr->queue = (uint8_t)qindex;
+        hdr->commit = 0;
+
+	q->tx_prod[1+tss] = pos + slot_size;
+	return hdr;
+}
+
+
+static void
+pfq_tx_ring_publish(pfq_t *q, int tss)
+{
+        struct pfq_tx_queue *tx = pfq_tx_queue_of(q, tss);
+
+	if (tx->prod.pos == q->tx_prod[1+tss])
+		return;
+
+	__atomic_store_n(&tx->prod.pos, q->tx_prod[1+tss], __ATOMIC_RELEASE);
+
+	/* wake up the Tx thread, if asleep */
+
+	if (tss != -1) {
+		__atomic_thread_fence(__ATOMIC_SEQ_CST);
+		if (unlikely(__atomic_load_n(&tx->cons.sleeping, __ATOMIC_RELAXED)))
+			setsockopt(q->fd, PF_Q, Q_SO_TX_DOORBELL, &tss, sizeof(tss));
 	}
+}
+
+
+/* Toeplitz hash (RSS): for each byte of the input and each of its values the
+ * table holds the xor of the 32 bit windows of the key selected by its bits,
+ * so that the hash costs a lookup per byte.
+ */
+
+#define Q_TOEPLITZ_INPUT_LEN	36	/* IPv6 addresses and ports */
+#define Q_TX_SELECT_BATCH	32
+
+static const uint8_t pfq_toeplitz_symmetric_key[Q_TOEPLITZ_KEY_LEN] =
+{
+	0x6d, 0x5a, 0x6d, 0x5a, 0x6d, 0x5a, 0x6d, 0x5a, 0x6d, 0x5a,
+	0x6d, 0x5a, 0x6d, 0x5a, 0x6d, 0x5a, 0x6d, 0x5a, 0x6d, 0x5a,
+	0x6d, 0x5a, 0x6d, 0x5a, 0x6d, 0x5a, 0x6d, 0x5a, 0x6d, 0x5a,
+	0x6d, 0x5a, 0x6d, 0x5a, 0x6d, 0x5a, 0x6d, 0x5a, 0x6d, 0x5a
+};
+
+
+static void
+pfq_toeplitz_init(uint32_t *table, const uint8_t *key)
+{
+	size_t i, b, v;
 
-	index = __atomic_load_n(&tx->cons.index, __ATOMIC_RELAXED);
-	if (index != __atomic_load_n(&tx->prod.index, __ATOMIC_RELAXED))
+	for(i = 0; i < Q_TOEPLITZ_INPUT_LEN; i++)
 	{
-                __atomic_store_n(&tx->prod.index, index, __ATOMIC_RELAXED);
-                __atomic_store_n((index & 1) ? &tx->prod.off1 : &tx->prod.off0, 0, __ATOMIC_RELAXED);
+		uint64_t k = (uint64_t)key[i] << 32 | (uint64_t)key[i+1] << 24 |
+			     (uint64_t)key[i+2] << 16 | (uint64_t)key[i+3] << 8 | key[i+4];
+		uint32_t win[8];
+
+		for(b = 0; b < 8; b++)
+			win[b] = (uint32_t)(k >> (8 - b));
+
+		for(v = 0; v < 256; v++)
+		{
+			uint32_t h = 0;
+			for(b = 0; b < 8; b++)
+				if (v & (0x80 >> b))
+					h ^= win[b];
+			table[i * 256 + v] = h;
+		}
 	}
+}
+
 
+static unsigned int
+pfq_toeplitz_hash(uint32_t const *table, const char *buf, size_t len)
+{
+	const char *ptr = buf + sizeof(struct ethhdr);
+	uint8_t in[Q_TOEPLITZ_INPUT_LEN];
+	size_t n, off, rem, i;
+	uint16_t proto;
+	uint32_t h = 0;
+	int l4;
+
+	if (len < sizeof(struct ethhdr) + 4)
+		return 0;
+
+	proto = ((struct ethhdr const *)buf)->h_proto;
+	if (proto == htons(ETH_P_8021Q)) {
+		memcpy(&proto, ptr + 2, sizeof(proto));
+		ptr += 4;
+	}
+
+	rem = len - (size_t)(ptr - buf);
+
+	if (proto == htons(ETH_P_IP) && rem >= sizeof(struct iphdr)) {
+		struct iphdr const *ih = (struct iphdr const *)ptr;
+		memcpy(in, &ih->saddr, 8);
+		n = 8;
+		off = (size_t)ih->ihl << 2;
+		l4 = (ih->frag_off & htons(0x3fff)) ? 0 : ih->protocol;  /* no ports in fragments */
+	}
+	else if (proto == htons(ETH_P_IPV6) && rem >= 40) {
+		memcpy(in, ptr + 8, 32);
+		n = 32;
+		off = 40;
+		l4 = (uint8_t)ptr[6];
+	}
+	else if (proto == htons(ETH_P_IP) || proto == htons(ETH_P_IPV6))
+		return 0;	/* truncated IP header */
+	else
+		return pfq_symmetric_hash(buf);	/* MAC addresses only */
+
+	if ((l4 == IPPROTO_TCP || l4 == IPPROTO_UDP) && rem >= off + 4) {
+		memcpy(in + n, ptr + off, 4);
+		n += 4;
+	}
 
-	base_addr = q->tx_queue_addr + q->tx_queue_size * (size_t)(2 * (1+tss) + (index & 1 ? 1 : 0));
+	for(i = 0; i < n; i++)
+		h ^= table[i * 256 + in[i]];
 
-        offset = __atomic_load_n((index & 1) ? &tx->prod.off1 : &tx->prod.off0, __ATOMIC_RELAXED);
+	return h;
+}
+
+
+int
+pfq_set_tx_selector(pfq_t *q, int selector, const uint8_t *key, pfq_tx_selector_t fun, void *user)
+{
+	switch(selector)
+	{
+	case Q_TX_SELECT_SYMMETRIC: break;
+	case Q_TX_SELECT_TOEPLITZ: {
+		if (q->tx_toeplitz == NULL) {
+			q->tx_toeplitz = malloc(Q_TOEPLITZ_INPUT_LEN * 256 * sizeof(uint32_t));
+			if (q->tx_toeplitz == NULL)
+				return Q_ERROR(q, "PFQ: set Tx selector: out of memory");
+		}
+		pfq_toeplitz_init(q->tx_toeplitz, key ? key : pfq_toeplitz_symmetric_key);
+	} break;
+	case Q_TX_SELECT_CALLBACK: {
+		if (fun == NULL)
+			return Q_ERROR(q, "PFQ: set Tx selector: callback required");
+	} break;
+	default:
+		return Q_ERROR(q, "PFQ: set Tx selector: bad selector");
+	}
+
+	q->tx_selector = selector;
+	q->tx_selector_fun = fun;
+	q->tx_selector_user = user;
+	return Q_OK(q);
+}
+
+
+static inline unsigned int
+pfq_tx_hash(pfq_t *q, const void *buf, size_t len)
+{
+	switch(q->tx_selector)
+	{
+	case Q_TX_SELECT_TOEPLITZ:
+		/* as the default indirection table of RSS (128 entries) */
+		return pfq_toeplitz_hash(q->tx_toeplitz, buf, len) & 0x7f;
+	case Q_TX_SELECT_CALLBACK:
+		return q->tx_selector_fun(q->tx_selector_user, buf, len);
+	}
+
+	return pfq_symmetric_hash(buf);
+}
+
+
+static inline int
+pfq_tx_select(pfq_t *q, const void *buf, size_t len, int async, int queue)
+{
+	if (!async)
+		return -1;
+
+	return (int)pfq_fold((queue == Q_ANY_QUEUE ? pfq_tx_hash(q, buf, len) : (unsigned int)queue),
+			     (unsigned int)q->tx_num_async);
+}
+
+
+int
+pfq_send_raw(pfq_t *q, const void *buf, size_t len, int ifindex, int qindex, uint64_t nsec,
+	     unsigned int copies, int async, int queue)
+{
+        struct pfq_pkthdr *hdr;
+        int tss;
+
+	if (unlikely(q->shm_addr == NULL))
+		return Q_ERROR(q, "PFQ: send_deferred: socket not enabled");
+
+	if (unlikely(async && q->tx_num_async == 0))
+		return Q_ERROR(q, "PFQ: send_deferred: socket not bound to async thread");
+
+	tss = pfq_tx_select(q, buf, len, async, queue);
 
 	len = min(len, q->tx_slot_size - sizeof(struct pfq_pkthdr));
 
-	slot_size = sizeof(struct pfq_pkthdr) + ALIGN(len, 8);
+	hdr = pfq_tx_ring_reserve(q, tss, len, ifindex, qindex, nsec, copies);
+	if (hdr == NULL)
+		return Q_VALUE(q, -1);
+
+	memcpy(hdr+1, buf, len);
+
+	pfq_tx_ring_publish(q, tss);
+	return Q_VALUE(q, (int)len);
+}
+
+
+int
+pfq_send_template(pfq_t *q, const void *buf, size_t len, struct pfq_tx_template const *tmpl,
+		  int ifindex, int qindex, unsigned int copies, int async, int queue)
+{
+        struct pfq_pkthdr *hdr;
+        int tss;
+
+	if (unlikely(q->shm_addr == NULL))
+		return Q_ERROR(q, "PFQ: send_template: socket not enabled");
+
+	if (unlikely(async && q->tx_num_async == 0))
+		return Q_ERROR(q, "PFQ: send_template: socket not bound to async thread");
+
+	if (unlikely(tmpl->num_ops > Q_TX_TEMPLATE_MAX_OPS))
+		return Q_ERROR(q, "PFQ: send_template: too many mutations");
+
+	tss = pfq_tx_select(q, buf, len, async, queue);
+
+	len = min(len, q->tx_slot_size - sizeof(struct pfq_pkthdr) - sizeof(struct pfq_tx_template));
+
+	hdr = pfq_tx_ring_reserve(q, tss, sizeof(struct pfq_tx_template) + len, ifindex, qindex, 0, copies);
+	if (hdr == NULL)
+		return Q_VALUE(q, -1);
 
-	if (((size_t)(offset) + slot_size) < q->tx_queue_size)
+	hdr->commit = Q_TX_SLOT_TEMPLATE;
+
+	memcpy(hdr+1, tmpl, sizeof(struct pfq_tx_template));
+	memcpy((struct pfq_tx_template *)(hdr+1) + 1, buf, len);
+
+	pfq_tx_ring_publish(q, tss);
+	return Q_VALUE(q, (int)len);
+}
+
+
+int
+pfq_send_raw_vec(pfq_t *q, const struct iovec *pkts, size_t n, int ifindex, int qindex, uint64_t nsec,
+		 unsigned int copies, int async, int queue)
+{
+	size_t i;
+        int tss;
+
+	if (unlikely(q->shm_addr == NULL))
+		return Q_ERROR(q, "PFQ: send_vec: socket not enabled");
+
+	if (unlikely(async && q->tx_num_async == 0))
+		return Q_ERROR(q, "PFQ: send_vec: socket not bound to async thread");
+
+	if (n == 0)
+		return Q_VALUE(q, 0);
+
+	if (async && queue == Q_ANY_QUEUE)
 	{
-		struct pfq_pkthdr *hdr = (struct pfq_pkthdr *)(base_addr + offset);
-		hdr->tstamp.tv64 = nsec;
-		hdr->caplen = (uint16_t)len;
-		hdr->data.copies = copies;
-                hdr->ifindex = ifindex;
-                hdr->queue = (uint8_t)qindex;
-		memcpy(hdr+1, buf, len);
+		/* a queue per packet: the selector runs on a batch at a time, then
+		 * the packets are stored and every queue touched is published once */
+
+		unsigned int touched = 0;
+		int qs[Q_TX_SELECT_BATCH];
+
+		for(i = 0; i < n;)
+		{
+			size_t m = min(n - i, (size_t)Q_TX_SELECT_BATCH), j;
+
+			for(j = 0; j < m; j++)
+				qs[j] = (int)pfq_fold(pfq_tx_hash(q, pkts[i+j].iov_base, pkts[i+j].iov_len),
+						      (unsigned int)q->tx_num_async);
+
+			for(j = 0; j < m; j++, i++)
+			{
+				size_t len = min(pkts[i].iov_len, q->tx_slot_size - sizeof(struct pfq_pkthdr));
+				struct pfq_pkthdr *hdr = pfq_tx_ring_reserve(q, qs[j], len, ifindex, qindex, nsec, copies);
+				if (hdr == NULL)
+					goto publish;
+				memcpy(hdr+1, pkts[i].iov_base, len);
+				touched |= 1U << qs[j];
+			}
+		}
+	publish:
+		for(tss = 0; touched; tss++, touched >>= 1)
+			if (touched & 1)
+				pfq_tx_ring_publish(q, tss);
 
-                __atomic_store_n((index & 1) ? &tx->prod.off1 : &tx->prod.off0,
-			offset + (ptrdiff_t)slot_size, __ATOMIC_RELEASE);
+		return Q_VALUE(q, (int)i);
+	}
+
+	/* the whole burst goes to the same Tx queue */
 
+	tss = pfq_tx_select(q, pkts[0].iov_base, pkts[0].iov_len, async, queue);
 
-		return Q_VALUE(q, (int)len);
+	for(i = 0; i < n; i++)
+	{
+		size_t len = min(pkts[i].iov_len, q->tx_slot_size - sizeof(struct pfq_pkthdr));
+		struct pfq_pkthdr *hdr = pfq_tx_ring_reserve(q, tss, len, ifindex, qindex, nsec, copies);
+		if (hdr == NULL)
+			break;
+		memcpy(hdr+1, pkts[i].iov_base, len);
 	}
 
-	return Q_VALUE(q, -1);
+	pfq_tx_ring_publish(q, tss);
+	return Q_VALUE(q, (int)i);
 }
 
+
+int
+pfq_send_vec(pfq_t *q, const struct iovec *pkts, size_t n, int flush, unsigned int copies)
+{
+	int ret = pfq_send_raw_vec(q, pkts, n, 0, 0, 0, copies, 0, Q_ANY_QUEUE);
+	if (ret > 0 && flush)
+		pfq_transmit_queue(q, 0);
+	return ret;
+}
+
+
+void *
+pfq_tx_reserve(pfq_t *q, int queue, size_t len, int ifindex, int qindex, uint64_t nsec, unsigned int copies)
+{
+        struct pfq_pkthdr *hdr;
+
+	if (unlikely(q->shm_addr == NULL))
+		return q->error = "PFQ: tx_reserve: socket not enabled", NULL;
+
+	if (queue < -1 || queue >= (int)q->tx_num_async)
+		return q->error = "PFQ: tx_reserve: bad queue index", NULL;
+
+	if (len > q->tx_slot_size - sizeof(struct pfq_pkthdr))
+		return q->error = "PFQ: tx_reserve: packet too long", NULL;
+
+	hdr = pfq_tx_ring_reserve(q, queue, len, ifindex, qindex, nsec, copies);
+	q->error = NULL;
+	return hdr ? hdr + 1 : NULL;
+}
+
+
+int
+pfq_tx_commit(pfq_t *q)
+{
+	int tss;
+
+	if (unlikely(q->shm_addr == NULL))
+		return Q_ERROR(q, "PFQ: tx_commit: socket not enabled");
+
+	for(tss = -1; tss < (int)q->tx_num_async; tss++)
+		pfq_tx_ring_publish(q, tss);
+
+	return Q_OK(q);
+}
+
+
+int
+pfq_tx_replay(pfq_t *q, int queue, const void *addr, size_t len, unsigned int loops, unsigned int speed, int tstamp)
+{
+	struct pfq_tx_replay replay = { queue, addr, len, loops, speed, tstamp };
+
+	if (setsockopt(q->fd, PF_Q, Q_SO_TX_REPLAY, &replay, sizeof(replay)) == -1)
+		return Q_ERROR(q, "PFQ: Tx replay error");
+
+	return Q_OK(q);
+}
+
+
+int
+pfq_get_tx_replay_stats(pfq_t const *q, int queue, struct pfq_tx_replay_stats *stats)
+{
+	socklen_t size = sizeof(struct pfq_tx_replay_stats);
+
+	stats->queue = queue;
+	if (getsockopt(q->fd, PF_Q, Q_SO_GET_TX_REPLAY, stats, &size) == -1)
+		return Q_ERROR(q, "PFQ: get Tx replay stats error");
+
+	return Q_OK(q);
+}
+
+
 int
 pfq_send(pfq_t *q, const void *ptr, size_t len, size_t fhint, unsigned int copies)
 {
@@ -1182,6 +1919,17 @@ pfq_mem_addr(pfq_t const *q)
 }
 
 
+size_t
+pfq_mem_page_size(pfq_t const *q)
+{
+	size_t page_size = 0; socklen_t size = sizeof(page_size);
+
+	if (getsockopt(q->fd, PF_Q, Q_SO_GET_SHMEM_PAGE_SIZE, &page_size, &size) == -1)
+		return 0;
+	return page_size;
+}
+
+
 int
 pfq_id(pfq_t *q)
 {
@@ -31,6 +31,7 @@
 #include <linux/ip.h>
 #include <linux/udp.h>
 #include <arpa/inet.h>
+#include <sys/uio.h>
 
 #ifdef _REENTRANT
 #include <pthread.h>
@@ -154,8 +155,11 @@ pfq_yield()
 typedef void (*pfq_handler_t)(char *user, const struct pfq_pkthdr *h, const char *data);
 
 
-/*! Symmetric hashx */
-
+/*! Symmetric hash */
+/*!
+ * Addresses and TCP/UDP ports of IPv4 and IPv6 packets (with an optional
+ * 802.1Q tag), MAC addresses of non-IP frames.
+ */
 
 static inline
 unsigned int pfq_symmetric_hash(const char *buf)
@@ -163,21 +167,41 @@ unsigned int pfq_symmetric_hash(const char *buf)
         const char *ptr = buf;
 
         struct ethhdr const *eh = (struct ethhdr const *)(ptr);
-        if (eh->h_proto != htons(0x800))
-            return 0;
+        uint16_t proto = eh->h_proto;
 
         ptr += sizeof(struct ethhdr);
 
-        struct iphdr const *ih = (struct iphdr const *)(ptr);
-        if (ih->protocol != IPPROTO_TCP &&
-            ih->protocol != IPPROTO_UDP)
-            return (ih->saddr ^ ih->daddr);
+        if (proto == htons(ETH_P_8021Q)) {
+            proto = *(uint16_t const *)(ptr + 2);
+            ptr += 4;
+        }
+
+        if (proto == htons(ETH_P_IP)) {
 
-        ptr += sizeof(ih->ihl << 2);
+            struct iphdr const *ih = (struct iphdr const *)(ptr);
+            if (ih->protocol != IPPROTO_TCP &&
+                ih->protocol != IPPROTO_UDP)
+                return (ih->saddr ^ ih->daddr);
 
-        struct udphdr const *uh = (struct udphdr const *)(ptr);
-        return (ih->saddr ^ ih->daddr ^ uh->source ^ uh->dest);
+            struct udphdr const *uh = (struct udphdr const *)(ptr + (ih->ihl << 2));
+            return (ih->saddr ^ ih->daddr ^ uh->source ^ uh->dest);
+        }
+
+        if (proto == htons(ETH_P_IPV6)) {
+
+            uint32_t const *addr = (uint32_t const *)(ptr + 8);
+            unsigned int hash = addr[0] ^ addr[1] ^ addr[2] ^ addr[3] ^
+                                addr[4] ^ addr[5] ^ addr[6] ^ addr[7];
+
+            if (ptr[6] == IPPROTO_TCP || ptr[6] == IPPROTO_UDP) {
+                struct udphdr const *uh = (struct udphdr const *)(ptr + 40);
+                hash ^= (unsigned int)(uh->source ^ uh->dest);
+            }
+            return hash;
+        }
 
+        return *(uint32_t const *)eh->h_dest ^ *(uint32_t const *)eh->h_source ^
+               (unsigned int)(*(uint16_t const *)(eh->h_dest + 4) ^ *(uint16_t const *)(eh->h_source + 4));
 }
 
 
@@ -290,6 +314,8 @@ extern int pfq_group_id(pfq_t *q);
  * the Linux HugePages support.
  * If the enviroment variable PFQ_HUGEPAGES is set to 0 (or
  * PFQ_NO_HUGEPAGES is defined) standard 4K pages are used.
+ * When several hugetlbfs are mounted, the one with the largest pages
+ * not exceeding the size of the queues is used (e.g. 1GB pages).
  */
 
 extern int pfq_enable(pfq_t *q);
@@ -370,6 +396,62 @@ extern int pfq_set_tx_slots(pfq_t *q, size_t value);
 extern size_t pfq_get_tx_slots(pfq_t const *q);
 
 
+/*! Enable/disable zero-copy transmission. */
+/*!
+ * In zero-copy mode the skbs refer to the Tx memory of the socket:
+ * the kernel holds a slot until the driver releases it (see pfq_tx_completions).
+ * The mode must be set before the socket is enabled.
+ */
+
+extern int pfq_set_tx_zerocopy(pfq_t *q, int value);
+
+
+/*! Return 1 if zero-copy transmission is enabled, 0 otherwise. */
+
+extern int pfq_get_tx_zerocopy(pfq_t const *q);
+
+
+/*! Collect the Tx slots released by the kernel in zero-copy mode. */
+/*!
+ * The queue is -1 for the synchronous Tx queue or the index of the async queue.
+ * Up to 'max' offsets are stored, each relative to the base of the Tx queue memory.
+ * Return the number of offsets stored.
+ */
+
+extern int pfq_tx_completions(pfq_t *q, int queue, uint32_t *offs, size_t max);
+
+
+/*! Enable the Tx timestamps of the socket. */
+/*!
+ * 'flags' is a combination of Q_TX_TSTAMP_SW (time the packet is handed to the
+ * driver) and Q_TX_TSTAMP_HW (hardware transmit time, where the driver supports
+ * it and hw timestamping is enabled on the device); 0 disables them.
+ * The timestamps ring is allocated by pfq_enable: they can be turned on
+ * later only if they were enabled then.
+ */
+
+extern int pfq_set_tx_tstamp(pfq_t *q, int flags);
+
+
+/*! Return the Tx timestamps flags of the socket. */
+/*!
+ * Pending hardware timestamps are also collected into the ring.
+ */
+
+extern int pfq_get_tx_tstamp(pfq_t const *q);
+
+
+/*! Collect the Tx timestamps of the socket. */
+/*!
+ * Entries are identified by queue (-1 for the synchronous one) and by the
+ * index of the record in that queue, counted from 0 since the socket was
+ * enabled (modulo 2^24). A software entry has hw = 0; a hardware one, for the
+ * same record, has sw = 0. Return the number of entries stored.
+ */
+
+extern int pfq_tx_tstamps(pfq_t *q, struct pfq_tx_tstamp *ts, size_t max);
+
+
 /*! Bind the main group of the socket to the given device/queue. */
 /*!
  * The first argument is the name of the device;
@@ -422,6 +504,18 @@ extern int pfq_egress_unbind(pfq_t *q);
 extern int pfq_bind_tx(pfq_t *q, const char *dev, int queue, int core);
 
 
+/*! Bind the socket for transmission, reserving the given hw queue. */
+/*!
+ *  As pfq_bind_tx, but the hw queue (which must be specified) is reserved
+ *  to this socket among the PFQ sockets: the traffic of other sockets is
+ *  steered to the remaining queues, so that the Tx lock of the queue is not
+ *  contended by PFQ. The stack is not steered and may still use the queue.
+ *  The reservation is released by pfq_unbind_tx.
+ */
+
+extern int pfq_bind_tx_reserved(pfq_t *q, const char *dev, int queue, int core);
+
+
 /*! Unbind the socket for transmission. */
 /*!
  * Unbind the socket for transmission from any device/queue.
@@ -430,6 +524,61 @@ extern int pfq_bind_tx(pfq_t *q, const char *dev, int queue, int core);
 extern int pfq_unbind_tx(pfq_t *q);
 
 
+/*! Specify the number of async Tx queues of the socket. */
+/*!
+ * The number (up to Q_MAX_TX_QUEUES, default Q_DEF_TX_QUEUES) must be set
+ * before the socket is enabled, as it determines the size of the shared memory.
+ */
+
+extern int pfq_set_tx_async_queues(pfq_t *q, size_t value);
+
+
+/*! Return the number of async Tx queues of the socket. */
+
+extern size_t pfq_get_tx_async_queues(pfq_t const *q);
+
+
+/*! Start a new Tx kernel thread on the given cpu. */
+/*!
+ * Return the index of the new thread, to be used with pfq_bind_tx.
+ */
+
+extern int pfq_add_tx_thread(pfq_t *q, int cpu);
+
+
+/*! Stop the last Tx kernel thread, provided no socket is bound to it. */
+
+extern int pfq_del_tx_thread(pfq_t *q);
+
+
+/*! Return the number of running Tx kernel threads. */
+
+extern int pfq_get_tx_threads(pfq_t const *q);
+
+
+/*! Set the rate of the given Tx queue, enforced by the kernel. */
+/*!
+ * The queue is -1 for the synchronous Tx queue or the index of the async queue.
+ * Rates are in packets and bits per second (0 means unlimited); burst is the number
+ * of packets that can be sent back-to-back. pps = bps = 0 disables the pacing.
+ */
+
+extern int pfq_set_tx_rate(pfq_t *q, int queue, unsigned long pps, unsigned long bps, unsigned int burst);
+
+
+/*! Set the priority and the weight of the given async Tx queue. */
+/*!
+ * The Tx kernel thread serves its queues in strict priority order (0 to
+ * Q_TX_MAX_PRIO-1, higher first): a queue is served only when no queue with a
+ * higher priority has packets pending. Queues with the same priority share the
+ * thread by deficit round robin in bytes, each sending up to 'weight' MTU-sized
+ * frames worth of bytes per round, plus the credit left unused in the previous
+ * rounds (0 means the whole queue, the default).
+ */
+
+extern int pfq_set_tx_sched(pfq_t *q, int queue, int prio, unsigned int weight);
+
+
 /*! Join the group with the given class mask and group policy */
 
 extern int pfq_join_group(pfq_t *q, int gid, unsigned long class_mask, int group_policy);
@@ -457,6 +606,19 @@ extern int pfq_groups_mask(pfq_t const *q, unsigned long *_mask);
 extern int pfq_set_group_computation(pfq_t *q, int gid, struct pfq_lang_computation_descr *prg);
 
 
+/*! Set a link group of the given group. */
+/*!
+ * A link group is a set of (up to Q_MAX_LINKS) egress devices, used by the
+ * pfq-lang functions link_group and bridge_link_group. Each flow is forwarded
+ * to one of the devices with carrier, in proportion to the weights; devices
+ * with weight 0 are backups, used when no weighted device has carrier. The
+ * link group 'id' (0 ... Q_MAX_LINK_GROUPS-1) can be updated while the
+ * computation of the group is running; n = 0 removes it.
+ */
+
+extern int pfq_set_group_links(pfq_t *q, int gid, int id, const char **devs, const unsigned int *weights, size_t n);
+
+
 /*! Specify a functional computation for the given group, from string. */
 /*!
  * This ability is limited to simple pfq-lang functional computations.
@@ -548,6 +710,11 @@ extern size_t pfq_mem_size(pfq_t const *q);
 extern const void * pfq_mem_addr(pfq_t const *q);
 
 
+/*! Return the size of the pages backing the shared memory (0 if the socket is not enabled). */
+
+extern size_t pfq_mem_page_size(pfq_t const *q);
+
+
 /*! Return the underlying file descriptor. */
 
 extern int pfq_get_fd(pfq_t const *q);
@@ -568,6 +735,35 @@ extern int pfq_get_group_stats(pfq_t const *q, int gid, struct pfq_stats *stats)
 extern int pfq_get_group_counters(pfq_t const *q, int gid, struct pfq_counters *cs);
 
 
+/*! Return the drop counters of the socket, one per Q_DROP_* reason. */
+
+extern int pfq_get_drop_stats(pfq_t const *q, struct pfq_drop_stats *stats);
+
+
+/*! Return the drop counters of the given group. */
+
+extern int pfq_get_group_drop_stats(pfq_t const *q, int gid, struct pfq_drop_stats *stats);
+
+
+/*! Return the global drop counters. */
+
+extern int pfq_get_global_drop_stats(pfq_t const *q, struct pfq_drop_stats *stats);
+
+
+/*! Return the number of packets copied from linear and paged skbs. */
+
+extern int pfq_get_copy_stats(pfq_t const *q, struct pfq_copy_stats *stats);
+
+
+/*! Return the statistics of the hw queues of the given device. */
+/*!
+ * Up to 'max' entries are stored, one per hw queue.
+ * Return the number of entries stored.
+ */
+
+extern int pfq_get_netq_stats(pfq_t const *q, const char *dev, struct pfq_queue_stats *stats, size_t max);
+
+
 /*! Transmit the packets in the queue. */
 /*!
  * Transmit the packets in the queue of the socket. 'queue = 0' is the
@@ -577,6 +773,29 @@ extern int pfq_get_group_counters(pfq_t const *q, int gid, struct pfq_counters *
 extern int pfq_transmit_queue(pfq_t *q, int queue);
 
 
+/*! Tx queue selectors */
+
+#define Q_TX_SELECT_SYMMETRIC   0       /* symmetric hash of addresses and ports (default) */
+#define Q_TX_SELECT_TOEPLITZ    1       /* Toeplitz hash, as the RSS of the NIC */
+#define Q_TX_SELECT_CALLBACK    2       /* user function */
+
+#define Q_TOEPLITZ_KEY_LEN      40
+
+typedef unsigned int (*pfq_tx_selector_t)(void *user, const char *pkt, size_t len);
+
+
+/*! Select how async Tx queues are chosen for Q_ANY_QUEUE. */
+/*!
+ * With Q_TX_SELECT_TOEPLITZ the hash is computed on the addresses and TCP/UDP
+ * ports of IPv4/IPv6 packets with the given key (Q_TOEPLITZ_KEY_LEN bytes, NULL
+ * for the symmetric key 0x6d5a...), and the queue is picked as by the default
+ * RSS indirection table of 128 entries. With Q_TX_SELECT_CALLBACK 'fun' returns
+ * a hash of the packet, folded to the number of async queues.
+ */
+
+extern int pfq_set_tx_selector(pfq_t *q, int selector, const uint8_t *key, pfq_tx_selector_t fun, void *user);
+
+
 /*! Schedule packet transmission. */
 /*!
  * The packet is copied into a Tx queue. If 'async' is 1 and 'queue' is set to any_queue, a TSS symmetric hash
@@ -588,6 +807,79 @@ extern int pfq_transmit_queue(pfq_t *q, int queue);
 extern int pfq_send_raw(pfq_t *q, const void *ptr, size_t len, int ifindex, int qindex, uint64_t nsec, unsigned int copies, int async, int queue);
 
 
+/*! Schedule the transmission of a burst of packets. */
+/*!
+ * The packets are copied into the Tx queues and published to the kernel at
+ * once. With 'async' and Q_ANY_QUEUE every packet goes to the queue chosen by
+ * the Tx selector (see pfq_set_tx_selector), otherwise all of them go to the
+ * given queue. Return the number of packets stored, which is less than 'n' if
+ * a queue is full.
+ */
+
+extern int pfq_send_raw_vec(pfq_t *q, const struct iovec *pkts, size_t n, int ifindex, int qindex, uint64_t nsec, unsigned int copies, int async, int queue);
+
+
+/*! Schedule the transmission of a packet template. */
+/*!
+ * The packet is stored once with the template 'tmpl': the kernel expands it
+ * into 'copies' distinct packets, each mutated by the operations of the
+ * template (see struct pfq_tx_template), with the IPv4 and TCP/UDP checksums
+ * fixed incrementally. Queue selection and flushing are as in pfq_send_raw.
+ */
+
+extern int pfq_send_template(pfq_t *q, const void *ptr, size_t len, struct pfq_tx_template const *tmpl, int ifindex, int qindex, unsigned int copies, int async, int queue);
+
+
+/*! Store a burst of packets and optionally transmit the packets in the queue. */
+/*!
+ * The queue is flushed once, if 'flush' is not 0.
+ * Requires the socket is bound for transmission to a net device and queue.
+ * See 'pfq_bind_tx'.
+ */
+
+extern
+int pfq_send_vec(pfq_t *q, const struct iovec *pkts, size_t n, int flush, unsigned int copies);
+
+
+/*! Reserve a slot in a Tx queue to build a packet in place. */
+/*!
+ * 'queue' is -1 for the synchronous queue, or the index of an async queue.
+ * Return the address where the 'len' bytes of the packet are to be written,
+ * or NULL if the queue is full. The packet is not visible to the kernel until
+ * pfq_tx_commit is called, and must be written before any other send on the
+ * same queue.
+ */
+
+extern void *pfq_tx_reserve(pfq_t *q, int queue, size_t len, int ifindex, int qindex, uint64_t nsec, unsigned int copies);
+
+
+/*! Publish the packets reserved with pfq_tx_reserve. */
+/*!
+ * Async Tx threads waiting on the doorbell are woken up.
+ */
+
+extern int pfq_tx_commit(pfq_t *q);
+
+
+/*! Replay a pcap file from an async Tx queue. */
+/*!
+ * 'addr' and 'len' describe the pcap file mapped in memory (e.g. with mmap):
+ * the pages are pinned and the packets are transmitted by the Tx thread of the
+ * queue, with no further system calls. The file is played 'loops' times (0
+ * means forever); if 'tstamp' is not 0 the original inter-packet gaps are
+ * honored, scaled by 'speed' (1000 is the original pace, 2000 twice as fast).
+ * Otherwise the packets are sent back-to-back, limited by the Tx rate of the
+ * queue (see pfq_set_tx_rate). A NULL 'addr' stops the replay in progress.
+ */
+
+extern int pfq_tx_replay(pfq_t *q, int queue, const void *addr, size_t len, unsigned int loops, unsigned int speed, int tstamp);
+
+
+/*! Return the progress of the pcap replay of an async Tx queue. */
+
+extern int pfq_get_tx_replay_stats(pfq_t const *q, int queue, struct pfq_tx_replay_stats *stats);
+
+
 /*! Store the packet and transmit the packets in the queue. */
 /*!
  * The queue is flushed every fhint packets.
@@ -637,4 +929,17 @@ int pfq_send_at(pfq_t *q, const void *ptr, size_t len, struct timespec *ts, unsi
 }
 
 
+/*! Transmit a burst of packets asynchronously. */
+/*!
+ * The burst is handled by a single PFQ kernel thread.
+ * See 'pfq_send_raw_vec'.
+ */
+
+static inline
+int pfq_send_vec_async(pfq_t *q, const struct iovec *pkts, size_t n, unsigned int copies)
+{
+	return pfq_send_raw_vec(q, pkts, n, 0, 0, 0, copies, 1, Q_ANY_QUEUE);
+}
+
+
 #endif /* PFQ_H */
@@ -170,6 +170,18 @@ module Network.PFq.Default
         tee        ,
         tap        ,
 
+        forward_queue,
+        bridge_queue ,
+        tee_queue    ,
+        link_queue   ,
+
+        link_group       ,
+        bridge_link_group,
+
+        queue_any    ,
+        queue_ingress,
+        queue_hash   ,
+
         -- * Logging
 
         log_msg    ,
@@ -582,6 +594,56 @@ tee d p = MFunction "tee" d p () () () () () ()
 tap :: String -> NetPredicate -> NetFunction
 tap d p = MFunction "tap" d p () () () () () ()
 
+-- | Tx queue policies of the forwarders: a queue >= 0 is a fixed queue of the
+-- device (modulo the number of its Tx queues).
+queue_any, queue_ingress, queue_hash :: CInt
+queue_any     = -1  -- ^ picked by the driver (ndo_select_queue), or queue 0
+queue_ingress = -2  -- ^ the Rx queue of the packet
+queue_hash    = -3  -- ^ the hash of the steering function
+
+-- | Forward the packet to the given Tx queue of the device, picked by the
+-- given policy. Example:
+--
+-- > steer_flow >-> forward_queue "eth1" queue_hash
+--
+-- Flows are spread across the Tx queues of eth1.
+forward_queue :: String -> CInt -> NetFunction
+forward_queue d q = MFunction "forward_queue" d q () () () () () ()
+
+-- | Like 'bridge', with the Tx queue picked by the given policy.
+--
+-- > bridge_queue "eth1" queue_ingress
+bridge_queue :: String -> CInt -> NetFunction
+bridge_queue d q = MFunction "bridge_queue" d q () () () () () ()
+
+-- | Like 'tee', with the Tx queue picked by the given policy.
+--
+-- > tee_queue "eth1" queue_hash is_udp >-> kernel
+tee_queue :: String -> CInt -> NetPredicate -> NetFunction
+tee_queue d q p = MFunction "tee_queue" d q p () () () () ()
+
+-- | Forward the packet to the given Tx queue of the devices, but the one it
+-- comes from.
+--
+-- > steer_flow >-> link_queue ["eth1", "eth2"] queue_hash >-> kernel
+link_queue :: [String] -> CInt -> NetFunction
+link_queue ds q = MFunction "link_queue" ds q () () () () () ()
+
+-- | Forward the packet to a device of the given link group: the flow of the
+-- packet (the hash of the steering function, or the flow hash) picks one of
+-- the devices with carrier, by weight. Link groups are set at runtime
+-- (see Q_SO_GROUP_LINKS). Example:
+--
+-- > steer_flow >-> link_group 0 >-> kernel
+link_group :: CInt -> NetFunction
+link_group i = MFunction "link_group" i () () () () () () ()
+
+-- | Like 'link_group', and evaluate to /Drop/.
+--
+-- > steer_flow >-> bridge_link_group 0
+bridge_link_group :: CInt -> NetFunction
+bridge_link_group i = MFunction "bridge_link_group" i () () () () () () ()
+
 -- | Forward the packet to the given device. This operation breaks the purity of the language,
 -- and it is possibly slower than the lazy "forward" counterpart.
 --
@@ -88,7 +88,7 @@ regexFunCall fun n =
 tryPatch :: FilePath -> IO ()
 tryPatch file =
     readFile file >>= \c ->
-        when (c =~ (regexFunCall "netif_rx" 1 ++ "|" ++ regexFunCall "netif_receive_skb" 1 ++ "|" ++ regexFunCall "napi_gro_receive" 2)) $
+        when (c =~ (regexFunCall "netif_rx" 1 ++ "|" ++ regexFunCall "netif_receive_skb" 1 ++ "|" ++ regexFunCall "napi_gro_receive" 2 ++ "|" ++ regexFunCall "pfq_netif_receive_list" 1)) $
             doesFileExist (file ++ ".omatic") >>= \orig ->
                 if orig
                 then putStrLn $ "[PFQ] " ++ file ++ " is already patched :)"
@@ -91,6 +91,7 @@ namespace opt
     bool   poisson   = false;
 
     double rate      = 0;
+    bool   kpacing   = false;
 
     std::vector< std::vector<int> > kthread;
 
@@ -189,6 +190,15 @@ namespace thread
                 q.bind_tx (m_bind.dev.front().name.c_str(), m_bind.dev.front().queue[n], kthread.at(n));
             }
 
+            if (opt::kpacing)
+            {
+                auto nq  = m_bind.dev.front().queue.size();
+                auto pps = static_cast<unsigned long>(opt::rate * 1000000 / static_cast<double>(nq));
+
+                for(unsigned int n = 0; n < nq; n++)
+                    q.tx_rate(static_cast<int>(n), pps);
+            }
+
             q.enable();
 
             m_pfq = std::move(q);
@@ -250,7 +260,7 @@ namespace thread
             auto now   = std::chrono::system_clock::now();
             auto len   = opt::len;
 
-            auto rc = opt::rate != 0.0;
+            auto rc = opt::rate != 0.0 && !opt::kpacing;
 
             for(size_t n = 0; n < opt::npackets;)
             {
@@ -299,7 +309,7 @@ namespace thread
 
             size_t idx = 0;
 
-            auto rc = opt::rate != 0.0;
+            auto rc = opt::rate != 0.0 && !opt::kpacing;
 
             for(size_t n = 0; n < opt::npackets;)
             {
@@ -407,7 +417,7 @@ namespace thread
             struct pcap_pkthdr *hdr;
             u_char *data;
 
-            auto rc = opt::rate != 0.0;
+            auto rc = opt::rate != 0.0 && !opt::kpacing;
 
             if (opt::rand_flow)
             {
@@ -593,6 +603,7 @@ void usage(std::string name)
 #endif
         " -P --preload INT              Preload INT packets (must be a power of 2)\n"
         "    --rate DOUBLE              Packet rate in Mpps\n"
+        "    --kernel-rate              Enforce the rate in the kernel Tx threads (requires -k)\n"
         " -a --active-tstamp            Use active timestamp as rate control\n"
         " -p --poisson                  Use a Poisson process for inter-packet gaps, implies -a\n"
         " -f --flush INT                Set flush length, used in sync Tx\n"
@@ -769,6 +780,12 @@ try
             continue;
         }
 
+        if ( any_strcmp(argv[i], "--kernel-rate") )
+        {
+            opt::kpacing = true;
+            continue;
+        }
+
         if ( any_strcmp(argv[i], "-?", "-h", "--help") )
             usage(argv[0]);
 
@@ -815,6 +832,13 @@ try
     if (opt::slots == 0)
         throw std::runtime_error("tx_slots set to 0!");
 
+    if (opt::kpacing && opt::rate == 0.0)
+        throw std::runtime_error("kernel-rate requires a rate (--rate)");
+
+    if (opt::kpacing && std::any_of(std::begin(opt::kthread), std::end(opt::kthread),
+                                    [](std::vector<int> const &k) { return k.empty() || k.front() < 0; }))
+        throw std::runtime_error("kernel-rate requires async transmission (-k)");
+
     if (opt::rand_flow && opt::file.empty())
         throw std::runtime_error("random flow requires reading packets from file (r)");
 
@@ -843,7 +867,7 @@ try
     std::cout << "copies     : "  << opt::copies << std::endl;
 
     if (opt::rate != 0.0)
-        std::cout << "rate       : "  << opt::rate << " Mpps" << std::endl;
+        std::cout << "rate       : "  << opt::rate << " Mpps" << (opt::kpacing ? " (kernel)" : "") << std::endl;
 
     if (opt::active_ts && !opt::poisson)
         std::cout << "timestamp  : active!" << std::endl;